@@ -140,6 +140,10 @@ void readRawBlocks(string host_url, int startId, int endId, vector<Block>& block
     const auto response = request.send("GET", "", {
         "Content-Type: application/octet-stream"
     },std::chrono::milliseconds{TIMEOUT_BLOCK_MS});
+    if (response.status == http::Response::Gone) {
+        // pruned peer, the body explains which blocks it no longer has
+        throw std::runtime_error("Host " + host_url + " cannot serve blocks: " + string(response.body.begin(), response.body.end()));
+    }
     std::vector<char> bytes(response.body.begin(), response.body.end());
     if (bytes.size() < BLOCKHEADER_BUFFER_SIZE) throw std::runtime_error("Invalid data for block");
     uint8_t* buffer = (uint8_t*)bytes.data();
@@ -178,4 +182,31 @@ void readRawTransactions(string host_url, vector<Transaction>& transactions) {
         transactions.push_back(Transaction(t));
         curr+= TRANSACTIONINFO_BUFFER_SIZE;
     }
+}
+
+string readMempoolSketch(string host_url, size_t cells) {
+    http::Request request(host_url + "/mempool_sketch?cells=" + std::to_string(cells));
+    const auto response = request.send("GET", "", {
+        "Content-Type: application/octet-stream"
+    },std::chrono::milliseconds{TIMEOUT_MS});
+    return std::string{response.body.begin(), response.body.end()};
+}
+
+void readTransactionsByShortId(string host_url, const vector<uint64_t>& shortIds, vector<Transaction>& transactions) {
+    http::Request request(host_url + "/mempool_fetch");
+    vector<uint8_t> bytes(sizeof(uint64_t) * shortIds.size());
+    char* ptr = (char*)bytes.data();
+    for (auto id : shortIds) writeNetworkUint64(ptr, id);
+    const auto response = request.send("POST", bytes, {
+        "Content-Type: application/octet-stream"
+    },std::chrono::milliseconds{TIMEOUT_MS});
+
+    std::vector<char> body(response.body.begin(), response.body.end());
+    const char* curr = body.data();
+    size_t numTx = body.size() / TRANSACTIONINFO_BUFFER_SIZE;
+    for (size_t i = 0; i < numTx; i++) {
+        TransactionInfo t = transactionInfoFromBuffer(curr);
+        transactions.push_back(Transaction(t));
+        curr += TRANSACTIONINFO_BUFFER_SIZE;
+    }
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include <vector>
 #include <string>
 #include <array>
+#include <cstring>
 using namespace Dodecahedron;
 using namespace std;
 using namespace nlohmann;
@@ -27,4 +28,21 @@ typedef std::array<uint8_t, 20> RIPEMD160Hash;
 
 #define NULL_SHA256_HASH SHA256Hash({0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0})
 #define NULL_KEY SHA256Hash({0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0})
-#define NULL_ADDRESS PublicWalletAddress({0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0})
\ No newline at end of file
+#define NULL_ADDRESS PublicWalletAddress({0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0})
+// both are already uniformly distributed, so any 8 of their bytes make a bucket hash
+struct SHA256Hasher {
+    size_t operator()(const SHA256Hash& hash) const {
+        uint64_t h;
+        memcpy(&h, hash.data(), sizeof(uint64_t));
+        return h;
+    }
+};
+
+struct WalletAddressHasher {
+    size_t operator()(const PublicWalletAddress& wallet) const {
+        // skip the leading network byte
+        uint64_t h;
+        memcpy(&h, wallet.data() + 1, sizeof(uint64_t));
+        return h;
+    }
+};
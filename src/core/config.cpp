@@ -30,10 +30,21 @@ json getConfig(int argc, char**argv) {
     bool local = false;
     bool rateLimiter = true;
     bool firewall = false;
+    bool watchRemote = false;
     string customWallet = "";
     string customIp = "";
     string customName = randomString(25);
     string networkName = "mainnet";
+    string durability = "per-block";
+    int groupCommitBlocks = 1000;
+    int groupCommitMs = 5000;
+    int pruneDepth = 0;
+    int archiveDepth = 0;
+    int mempoolMB = 300;
+    string ledgerStorage = "leveldb";
+    string blockStorage = "leveldb";
+    string txdbStorage = "leveldb";
+    string pufferfishStorage = "leveldb";
     json hostSources = json::array();
     json checkpoints = json::array();
     json bannedHashes = json::array();
@@ -118,6 +129,66 @@ json getConfig(int argc, char**argv) {
         rateLimiter = false;
     }
 
+    it = std::find(args.begin(), args.end(), "--watch-remote");
+    if (it != args.end()) {
+        watchRemote = true;
+    }
+
+    it = std::find(args.begin(), args.end(), "--durability");
+    if (it != args.end()) {
+        durability = string(*++it);
+    }
+
+    it = std::find(args.begin(), args.end(), "--group-commit-blocks");
+    if (it != args.end()) {
+        groupCommitBlocks = std::stoi(*++it);
+    }
+
+    it = std::find(args.begin(), args.end(), "--group-commit-ms");
+    if (it != args.end()) {
+        groupCommitMs = std::stoi(*++it);
+    }
+
+    it = std::find(args.begin(), args.end(), "--prune");
+    if (it != args.end()) {
+        pruneDepth = std::stoi(*++it);
+    }
+
+    it = std::find(args.begin(), args.end(), "--archive-depth");
+    if (it != args.end()) {
+        archiveDepth = std::stoi(*++it);
+    }
+
+    it = std::find(args.begin(), args.end(), "--mempool-mb");
+    if (it != args.end()) {
+        mempoolMB = std::stoi(*++it);
+    }
+
+    it = std::find(args.begin(), args.end(), "--storage");
+    if (it != args.end()) {
+        ledgerStorage = blockStorage = txdbStorage = pufferfishStorage = string(*++it);
+    }
+
+    it = std::find(args.begin(), args.end(), "--ledger-storage");
+    if (it != args.end()) {
+        ledgerStorage = string(*++it);
+    }
+
+    it = std::find(args.begin(), args.end(), "--block-storage");
+    if (it != args.end()) {
+        blockStorage = string(*++it);
+    }
+
+    it = std::find(args.begin(), args.end(), "--txdb-storage");
+    if (it != args.end()) {
+        txdbStorage = string(*++it);
+    }
+
+    it = std::find(args.begin(), args.end(), "--pufferfish-storage");
+    if (it != args.end()) {
+        pufferfishStorage = string(*++it);
+    }
+
     it = std::find(args.begin(), args.end(), "--firewall");
     if (it != args.end()) {
         firewall = true;
@@ -125,6 +196,7 @@ json getConfig(int argc, char**argv) {
 
     json config;
     config["rateLimiter"] = rateLimiter;
+    config["watchRemote"] = watchRemote;
     config["threads"] = threads;
     config["wallet"] = customWallet;
     config["port"] = customPort;
@@ -138,6 +210,16 @@ json getConfig(int argc, char**argv) {
     config["hostSources"] = hostSources;
     config["minHostVersion"] = "0.9.0-alpha";
     config["showHeaderStats"] = true;
+    config["durability"] = durability;
+    config["groupCommitBlocks"] = groupCommitBlocks;
+    config["groupCommitMs"] = groupCommitMs;
+    config["pruneDepth"] = pruneDepth;
+    config["archiveDepth"] = archiveDepth;
+    config["mempoolMB"] = mempoolMB;
+    config["ledgerStorage"] = ledgerStorage;
+    config["blockStorage"] = blockStorage;
+    config["txdbStorage"] = txdbStorage;
+    config["pufferfishStorage"] = pufferfishStorage;
 
     if (local) {
         // do nothing
@@ -19,6 +19,8 @@
 #define TXDB_FILE_PATH "./data/txdb"
 #define BLOCK_STORE_FILE_PATH "./data/blocks"
 #define PUFFERFISH_CACHE_FILE_PATH "./data/pufferfish"
+#define WATCH_LIST_FILE_PATH "./data/watch"
+#define MEMPOOL_FILE_PATH "./data/mempool"
 
 // Blocks
 #define MAX_TRANSACTIONS_PER_BLOCK 25000
@@ -15,8 +15,14 @@ using namespace std;
 
 
 PufferfishCache * pufferfishCache = NULL;
+StorageBackend pufferfishCacheBackend = STORAGE_LEVELDB;
 std::mutex pufferfishCacheLock;
 
+void setPufferfishCacheBackend(StorageBackend backend) {
+    std::unique_lock<std::mutex> ul(pufferfishCacheLock);
+    pufferfishCacheBackend = backend;
+}
+
 SHA256Hash PUFFERFISH(const char* buffer, size_t len, bool useCache) {
     SHA256Hash inputHash;
     if (useCache) {
@@ -24,7 +30,7 @@ SHA256Hash PUFFERFISH(const char* buffer, size_t len, bool useCache) {
         memcpy(inputHash.data(), buffer, 32);
         if (!pufferfishCache) {
             pufferfishCache = new PufferfishCache();
-            pufferfishCache->init(PUFFERFISH_CACHE_FILE_PATH);
+            pufferfishCache->init(PUFFERFISH_CACHE_FILE_PATH, pufferfishCacheBackend);
         }
         SHA256Hash h;
         try {
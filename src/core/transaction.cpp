@@ -65,18 +65,20 @@ Transaction::Transaction(PublicWalletAddress from, PublicWalletAddress to, Trans
 }
 
 Transaction::Transaction() {
-
+    this->nonce = 0;
 }
 
 Transaction::Transaction(const TransactionInfo& t) {
     this->to = t.to;
     if (!t.isTransactionFee) this->from = t.from;
+    else this->from = NULL_ADDRESS;
     memcpy((void*)this->signature.data(), (void*)t.signature, 64);
     memcpy((void*)this->signingKey.data(), (void*)t.signingKey, 32);
     this->amount = t.amount;
     this->isTransactionFee = t.isTransactionFee;
     this->timestamp = t.timestamp;
     this->fee = t.fee;
+    this->nonce = 0;
 }
 TransactionInfo Transaction::serialize() const {
     TransactionInfo t;
@@ -101,14 +103,19 @@ Transaction::Transaction(const Transaction & t) {
     this->timestamp = t.timestamp;
     this->fee = t.fee;
     this->signingKey = t.signingKey;
+    this->nonce = t.nonce;
 }
 
 Transaction::Transaction(PublicWalletAddress to, TransactionAmount fee) {
     this->to = to;
+    this->from = NULL_ADDRESS;
+    this->signature.fill(0);
+    this->signingKey.fill(0);
     this->amount = fee;
     this->isTransactionFee = true;
     this->timestamp = getCurrentTime();
     this->fee = 0;
+    this->nonce = 0;
 }
 
 Transaction::Transaction(json data) {
@@ -116,7 +123,11 @@ Transaction::Transaction(json data) {
     this->timestamp = stringToUint64(data["timestamp"]);
     this->to = stringToWalletAddress(data["to"]);
     this->fee = data["fee"];
+    this->nonce = 0;
     if(data["from"] == "") {        
+        this->from = NULL_ADDRESS;
+        this->signature.fill(0);
+        this->signingKey.fill(0);
         this->amount = data["amount"];
         this->isTransactionFee = true;
     } else {
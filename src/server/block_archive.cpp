@@ -0,0 +1,140 @@
+#include <cstring>
+#include <stdexcept>
+#include <zlib.h>
+#include "block_archive.hpp"
+using namespace std;
+
+#define ARCHIVE_FORMAT_VERSION 1
+#define SIGNATURE_SIZE 64
+#define SIGNING_KEY_SIZE 32
+#define ADDRESS_SIZE 25
+
+uint32_t MemoryArchiveDictionary::idFor(const string& value) {
+    auto it = this->ids.find(value);
+    if (it != this->ids.end()) return it->second;
+    uint32_t id = this->values.size();
+    this->ids[value] = id;
+    this->values.push_back(value);
+    return id;
+}
+
+string MemoryArchiveDictionary::valueFor(uint32_t id) const {
+    if (id >= this->values.size()) throw std::runtime_error("Unknown archive dictionary id " + to_string(id));
+    return this->values[id];
+}
+
+size_t MemoryArchiveDictionary::size() const {
+    return this->values.size();
+}
+
+static void writeVarint(string& out, uint64_t x) {
+    while (x >= 0x80) {
+        out.push_back((char)((x & 0x7F) | 0x80));
+        x >>= 7;
+    }
+    out.push_back((char)x);
+}
+
+static uint64_t readVarint(const char*& curr, const char* end) {
+    uint64_t x = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (curr >= end) throw std::runtime_error("Truncated archived block");
+        uint8_t byte = (uint8_t)*curr++;
+        x |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return x;
+    }
+    throw std::runtime_error("Invalid varint in archived block");
+}
+
+// timestamps within a block are close together, store signed deltas
+static uint64_t zigzag(int64_t x) {
+    return ((uint64_t)x << 1) ^ (uint64_t)(x >> 63);
+}
+
+static int64_t unzigzag(uint64_t x) {
+    return (int64_t)(x >> 1) ^ -(int64_t)(x & 1);
+}
+
+static void readBytes(const char*& curr, const char* end, void* out, size_t n) {
+    if ((size_t)(end - curr) < n) throw std::runtime_error("Truncated archived block");
+    memcpy(out, curr, n);
+    curr += n;
+}
+
+string encodeArchivedTransactions(const vector<TransactionInfo>& transactions, ArchiveDictionary& dictionary) {
+    string body;
+    writeVarint(body, transactions.size());
+    for (auto& t : transactions) body.push_back(t.isTransactionFee ? 1 : 0);
+    uint64_t lastTimestamp = 0;
+    for (auto& t : transactions) {
+        writeVarint(body, zigzag((int64_t)(t.timestamp - lastTimestamp)));
+        lastTimestamp = t.timestamp;
+    }
+    for (auto& t : transactions) writeVarint(body, t.amount);
+    for (auto& t : transactions) writeVarint(body, t.fee);
+    for (auto& t : transactions) writeVarint(body, dictionary.idFor(string((const char*)t.to.data(), ADDRESS_SIZE)));
+    for (auto& t : transactions) writeVarint(body, dictionary.idFor(string((const char*)t.from.data(), ADDRESS_SIZE)));
+    for (auto& t : transactions) writeVarint(body, dictionary.idFor(string(t.signingKey, SIGNING_KEY_SIZE)));
+    for (auto& t : transactions) body.append(t.signature, SIGNATURE_SIZE);
+
+    uLongf compressedSize = compressBound(body.size());
+    string compressed(compressedSize, '\0');
+    int status = compress2((Bytef*)&compressed[0], &compressedSize, (const Bytef*)body.data(), body.size(), Z_BEST_SPEED);
+    if (status != Z_OK) throw std::runtime_error("Could not compress archived block : " + to_string(status));
+    compressed.resize(compressedSize);
+
+    string out;
+    out.push_back((char)ARCHIVE_FORMAT_VERSION);
+    writeVarint(out, body.size());
+    out.append(compressed);
+    return out;
+}
+
+vector<TransactionInfo> decodeArchivedTransactions(const string& data, const ArchiveDictionary& dictionary) {
+    const char* curr = data.data();
+    const char* end = data.data() + data.size();
+    if (curr >= end || (uint8_t)*curr != ARCHIVE_FORMAT_VERSION) throw std::runtime_error("Unsupported archived block format");
+    curr++;
+    uLongf bodySize = readVarint(curr, end);
+    string body(bodySize, '\0');
+    int status = uncompress((Bytef*)&body[0], &bodySize, (const Bytef*)curr, end - curr);
+    if (status != Z_OK || bodySize != body.size()) throw std::runtime_error("Could not decompress archived block : " + to_string(status));
+
+    curr = body.data();
+    end = body.data() + body.size();
+    size_t count = readVarint(curr, end);
+    if (count > (size_t)(end - curr)) throw std::runtime_error("Invalid transaction count in archived block");
+    vector<TransactionInfo> transactions(count);
+    for (auto& t : transactions) {
+        // zero padding as well so records compare equal bytewise
+        memset(&t, 0, sizeof(TransactionInfo));
+        uint8_t flag;
+        readBytes(curr, end, &flag, 1);
+        t.isTransactionFee = flag != 0;
+    }
+    uint64_t lastTimestamp = 0;
+    for (auto& t : transactions) {
+        t.timestamp = lastTimestamp + unzigzag(readVarint(curr, end));
+        lastTimestamp = t.timestamp;
+    }
+    for (auto& t : transactions) t.amount = readVarint(curr, end);
+    for (auto& t : transactions) t.fee = readVarint(curr, end);
+    for (auto& t : transactions) {
+        string to = dictionary.valueFor(readVarint(curr, end));
+        if (to.size() != ADDRESS_SIZE) throw std::runtime_error("Invalid address in archived block");
+        memcpy(t.to.data(), to.data(), ADDRESS_SIZE);
+    }
+    for (auto& t : transactions) {
+        string from = dictionary.valueFor(readVarint(curr, end));
+        if (from.size() != ADDRESS_SIZE) throw std::runtime_error("Invalid address in archived block");
+        memcpy(t.from.data(), from.data(), ADDRESS_SIZE);
+    }
+    for (auto& t : transactions) {
+        string key = dictionary.valueFor(readVarint(curr, end));
+        if (key.size() != SIGNING_KEY_SIZE) throw std::runtime_error("Invalid signing key in archived block");
+        memcpy(t.signingKey, key.data(), SIGNING_KEY_SIZE);
+    }
+    for (auto& t : transactions) readBytes(curr, end, t.signature, SIGNATURE_SIZE);
+    if (curr != end) throw std::runtime_error("Trailing data in archived block");
+    return transactions;
+}
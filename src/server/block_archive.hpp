@@ -0,0 +1,37 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include "../core/transaction.hpp"
+using namespace std;
+
+/*
+    Maps addresses and signing keys that recur across the chain to small ids
+    so archived blocks store each of them once instead of per transaction.
+*/
+class ArchiveDictionary {
+    public:
+        virtual ~ArchiveDictionary() {}
+        virtual uint32_t idFor(const string& value) = 0;
+        virtual string valueFor(uint32_t id) const = 0;
+};
+
+class MemoryArchiveDictionary : public ArchiveDictionary {
+    public:
+        uint32_t idFor(const string& value);
+        string valueFor(uint32_t id) const;
+        size_t size() const;
+    protected:
+        map<string, uint32_t> ids;
+        vector<string> values;
+};
+
+/*
+    Archived blocks keep their transactions in a single compressed record:
+    each field is stored as its own column, addresses and signing keys are
+    replaced by dictionary ids and integers are varint encoded before the
+    whole body is deflated. Decoding yields the original TransactionInfo
+    field for field.
+*/
+string encodeArchivedTransactions(const vector<TransactionInfo>& transactions, ArchiveDictionary& dictionary);
+vector<TransactionInfo> decodeArchivedTransactions(const string& data, const ArchiveDictionary& dictionary);
@@ -1,25 +1,267 @@
 #include <iostream>
+#include <algorithm>
+#include <memory>
 #include <thread>
 #include "../core/crypto.hpp"
 #include "../core/transaction.hpp"
 #include "../core/logger.hpp"
+#include "leveldb/write_batch.h"
 #include "block_store.hpp"
 using namespace std;
 
 #define BLOCK_COUNT_KEY "BLOCK_COUNT"
 #define TOTAL_WORK_KEY "TOTAL_WORK"
+#define DIRTY_KEY "DIRTY"
+#define PRUNED_HEIGHT_KEY "PRUNED_HEIGHT"
+#define ARCHIVED_HEIGHT_KEY "ARCHIVED_HEIGHT"
+#define ARCHIVE_KEY_PREFIX "ARCHIVE"
+#define DICTIONARY_SIZE_KEY "DICT_SIZE"
+#define DICTIONARY_ID_PREFIX "DICT_ID"
+#define DICTIONARY_VALUE_PREFIX "DICT_VALUE"
+#define DICTIONARY_CACHE_SIZE 1000000
+#define WALLET_INDEX_VERSION_KEY "WALLET_INDEX_VERSION"
+#define WALLET_INDEX_VERSION 2
+#define LEGACY_WALLET_KEY_SIZE 57
+#define BALANCE_KEY_PREFIX "BALANCE"
+#define BALANCE_HISTORY_HEIGHT_KEY "BALANCE_HISTORY_HEIGHT"
+#define TIME_ENVELOPE_PREFIX "TIME_MAX"
+#define TIME_INDEX_PREFIX "TIME_IDX"
+#define TIME_INDEX_VERSION_KEY "TIME_INDEX_VERSION"
+#define TIME_INDEX_VERSION 1
+#define BLOCK_STATS_PREFIX "STATS"
+#define BLOCK_STATS_VERSION_KEY "BLOCK_STATS_VERSION"
+#define BLOCK_STATS_VERSION 1
+
+/*
+    Wallet index keys are (address, blockId, index) with the position stored
+    big endian so leveldb's bytewise ordering walks a wallet's history in
+    chain order. The value is the txid.
+*/
+struct WalletIndexKey {
+    uint8_t addr[25];
+    uint8_t blockId[4];
+    uint8_t index[4];
+};
+
+/*
+    Balance history keys are (prefix, address, blockId) for every block that
+    changed a wallet's balance, so a wallet's change heights sort in chain
+    order. The value is a BalanceChange: the block's net delta and the
+    balance after it, which makes every entry a checkpoint.
+*/
+struct BalanceKey {
+    char prefix[7];
+    uint8_t addr[25];
+    uint8_t blockId[4];
+};
+
+/*
+    Block timestamps are not monotonic, so the time index is built over their
+    running maximum (the envelope), which is. Keys are (envelope, blockId)
+    big endian, so seeking to a timestamp lands on the first block by which
+    the chain had reached it. The envelope of each block is also stored by
+    blockId so the next block can extend it.
+*/
+struct TimeIndexKey {
+    char prefix[8];
+    uint8_t timestamp[8];
+    uint8_t blockId[4];
+};
+
+struct TimeEnvelopeKey {
+    char prefix[8];
+    uint8_t blockId[4];
+};
+
+/*
+    Per block statistics are stored under (prefix, blockId) together with
+    their running totals from block 1, so the sums over any range of blocks
+    are the difference of two records.
+*/
+struct BlockStatsKey {
+    char prefix[5];
+    uint8_t blockId[4];
+};
+
+struct BlockStatsRecord {
+    BlockStats block;
+    BlockStats total;
+    uint64_t timestamp;
+};
+
+static void writeBigEndianUint32(uint8_t* buffer, uint32_t x) {
+    buffer[0] = (x >> 24) & 0xFF;
+    buffer[1] = (x >> 16) & 0xFF;
+    buffer[2] = (x >> 8) & 0xFF;
+    buffer[3] = x & 0xFF;
+}
+
+static uint32_t readBigEndianUint32(const uint8_t* buffer) {
+    return ((uint32_t)buffer[0] << 24) | ((uint32_t)buffer[1] << 16) | ((uint32_t)buffer[2] << 8) | (uint32_t)buffer[3];
+}
+
+static WalletIndexKey walletIndexKey(const PublicWalletAddress& wallet, uint32_t blockId, uint32_t index) {
+    WalletIndexKey key;
+    memcpy(key.addr, wallet.data(), 25);
+    writeBigEndianUint32(key.blockId, blockId);
+    writeBigEndianUint32(key.index, index);
+    return key;
+}
+
+static void writeBigEndianUint64(uint8_t* buffer, uint64_t x) {
+    writeBigEndianUint32(buffer, x >> 32);
+    writeBigEndianUint32(buffer + 4, x & 0xFFFFFFFF);
+}
+
+static TimeIndexKey timeIndexKey(uint64_t timestamp, uint32_t blockId) {
+    TimeIndexKey key;
+    memcpy(key.prefix, TIME_INDEX_PREFIX, sizeof(key.prefix));
+    writeBigEndianUint64(key.timestamp, timestamp);
+    writeBigEndianUint32(key.blockId, blockId);
+    return key;
+}
+
+static TimeEnvelopeKey timeEnvelopeKey(uint32_t blockId) {
+    TimeEnvelopeKey key;
+    memcpy(key.prefix, TIME_ENVELOPE_PREFIX, sizeof(key.prefix));
+    writeBigEndianUint32(key.blockId, blockId);
+    return key;
+}
+
+static BlockStatsKey blockStatsKey(uint32_t blockId) {
+    BlockStatsKey key;
+    memcpy(key.prefix, BLOCK_STATS_PREFIX, sizeof(key.prefix));
+    writeBigEndianUint32(key.blockId, blockId);
+    return key;
+}
+
+static bool readBlockStatsRecord(StorageEngine* db, uint32_t blockId, BlockStatsRecord& record) {
+    BlockStatsKey key = blockStatsKey(blockId);
+    string value;
+    leveldb::Status status = db->get(leveldb::ReadOptions(), leveldb::Slice((const char*) &key, sizeof(key)), &value);
+    if (!status.ok() || value.size() != sizeof(BlockStatsRecord)) return false;
+    memcpy(&record, value.c_str(), sizeof(BlockStatsRecord));
+    return true;
+}
+
+static BalanceKey balanceKey(const PublicWalletAddress& wallet, uint32_t blockId) {
+    BalanceKey key;
+    memcpy(key.prefix, BALANCE_KEY_PREFIX, sizeof(key.prefix));
+    memcpy(key.addr, wallet.data(), 25);
+    writeBigEndianUint32(key.blockId, blockId);
+    return key;
+}
+
+static bool readBalanceEntry(leveldb::Iterator* it, const PublicWalletAddress& wallet, BalanceChange& change) {
+    leveldb::Slice key = it->key();
+    if (key.size() != sizeof(BalanceKey) || memcmp(key.data(), BALANCE_KEY_PREFIX, 7) != 0) return false;
+    if (memcmp(key.data() + 7, wallet.data(), 25) != 0) return false;
+    if (it->value().size() != sizeof(BalanceChange)) return false;
+    memcpy(&change, it->value().data(), sizeof(BalanceChange));
+    return true;
+}
+
+static bool readWalletIndexEntry(leveldb::Iterator* it, const PublicWalletAddress& wallet, WalletTransactionRef& ref) {
+    leveldb::Slice key = it->key();
+    if (key.size() != sizeof(WalletIndexKey) || memcmp(key.data(), wallet.data(), 25) != 0) return false;
+    const uint8_t* pos = (const uint8_t*)key.data() + 25;
+    ref.blockId = readBigEndianUint32(pos);
+    ref.index = readBigEndianUint32(pos + 4);
+    memcpy(ref.txid.data(), it->value().data(), ref.txid.size());
+    return true;
+}
+
+static string archiveKey(uint32_t blockId) {
+    return string(ARCHIVE_KEY_PREFIX) + string((const char*) &blockId, sizeof(uint32_t));
+}
+
+static string dictionaryValueKey(uint32_t id) {
+    return string(DICTIONARY_VALUE_PREFIX) + string((const char*) &id, sizeof(uint32_t));
+}
+
+static uint32_t readHeightKey(StorageEngine* db, const string& heightKey) {
+    string value;
+    leveldb::Status status = db->get(leveldb::ReadOptions(), leveldb::Slice(heightKey), &value);
+    if (!status.ok() || value.size() != sizeof(uint32_t)) return 0;
+    uint32_t height;
+    memcpy(&height, value.c_str(), sizeof(uint32_t));
+    return height;
+}
+
+/*
+    Persistent dictionary used while archiving. New entries are added to the
+    same write batch as the blocks that reference them, so the dictionary on
+    disk never lags behind the archived blocks. Readers pass no batch.
+*/
+class BlockStoreDictionary : public ArchiveDictionary {
+    public:
+        BlockStoreDictionary(const BlockStore& store, leveldb::WriteBatch* batch) : store(store), batch(batch) {
+            this->nextId = batch ? readHeightKey(store.db, DICTIONARY_SIZE_KEY) : 0;
+        }
+        uint32_t idFor(const string& value) {
+            if (!this->batch) throw std::runtime_error("Archive dictionary is read only");
+            auto it = this->pending.find(value);
+            if (it != this->pending.end()) return it->second;
+            string idKey = string(DICTIONARY_ID_PREFIX) + value;
+            string existing;
+            leveldb::Status status = store.db->get(leveldb::ReadOptions(), leveldb::Slice(idKey), &existing);
+            uint32_t id;
+            if (status.ok() && existing.size() == sizeof(uint32_t)) {
+                memcpy(&id, existing.c_str(), sizeof(uint32_t));
+            } else {
+                id = this->nextId++;
+                this->batch->Put(leveldb::Slice(idKey), leveldb::Slice((const char*) &id, sizeof(uint32_t)));
+                this->batch->Put(leveldb::Slice(dictionaryValueKey(id)), leveldb::Slice(value));
+            }
+            this->pending[value] = id;
+            return id;
+        }
+        string valueFor(uint32_t id) const {
+            return store.getDictionaryValue(id);
+        }
+        void finish() {
+            string sizeKey = DICTIONARY_SIZE_KEY;
+            this->batch->Put(leveldb::Slice(sizeKey), leveldb::Slice((const char*) &this->nextId, sizeof(uint32_t)));
+        }
+    protected:
+        const BlockStore& store;
+        leveldb::WriteBatch* batch;
+        uint32_t nextId;
+        map<string, uint32_t> pending;
+};
 
 BlockStore::BlockStore() {
 }
 
-void BlockStore::setBlockCount(size_t count) {
+void BlockStore::clear() {
+    DataStore::clear();
+    // an empty store has a complete balance history, wallet index, time index and block stats
+    this->setBalanceHistoryHeight(0);
+    string versionKey = WALLET_INDEX_VERSION_KEY;
+    string version = to_string(WALLET_INDEX_VERSION);
+    leveldb::Status status = db->put(leveldb::WriteOptions(), leveldb::Slice(versionKey), leveldb::Slice(version));
+    if(!status.ok()) throw std::runtime_error("Could not write wallet index version : " + status.ToString());
+    versionKey = TIME_INDEX_VERSION_KEY;
+    version = to_string(TIME_INDEX_VERSION);
+    status = db->put(leveldb::WriteOptions(), leveldb::Slice(versionKey), leveldb::Slice(version));
+    if(!status.ok()) throw std::runtime_error("Could not write time index version : " + status.ToString());
+    versionKey = BLOCK_STATS_VERSION_KEY;
+    version = to_string(BLOCK_STATS_VERSION);
+    status = db->put(leveldb::WriteOptions(), leveldb::Slice(versionKey), leveldb::Slice(version));
+    if(!status.ok()) throw std::runtime_error("Could not write block stats version : " + status.ToString());
+    // dictionary ids are handed out again from zero
+    std::unique_lock<std::mutex> ul(dictionaryLock);
+    this->dictionaryCache.clear();
+}
+
+void BlockStore::setBlockCount(size_t count, bool sync) {
     string countKey = BLOCK_COUNT_KEY;
     size_t num = count;
     leveldb::Slice key = leveldb::Slice(countKey);
     leveldb::Slice slice = leveldb::Slice((const char*)&num, sizeof(size_t));
     leveldb::WriteOptions write_options;
-    write_options.sync = true;
-    leveldb::Status status = db->Put(write_options, key, slice);
+    write_options.sync = sync;
+    leveldb::Status status = db->put(write_options, key, slice);
     if(!status.ok()) throw std::runtime_error("Could not write block count to DB : " + status.ToString());
 }
 
@@ -27,20 +269,20 @@ size_t BlockStore::getBlockCount() const {
     string countKey = BLOCK_COUNT_KEY;
     leveldb::Slice key = leveldb::Slice(countKey);
     string value;
-    leveldb::Status status = db->Get(leveldb::ReadOptions(),key, &value);
+    leveldb::Status status = db->get(leveldb::ReadOptions(),key, &value);
     if(!status.ok()) throw std::runtime_error("Could not read block count from DB : " + status.ToString());
     size_t ret = *((size_t*)value.c_str());
     return ret;
 }
 
-void BlockStore::setTotalWork(Bigint count) {
+void BlockStore::setTotalWork(Bigint count, bool sync) {
     string countKey = TOTAL_WORK_KEY;
     string sz = to_string(count);
     leveldb::Slice key = leveldb::Slice(countKey);
     leveldb::Slice slice = leveldb::Slice((const char*)sz.c_str(), sz.size());
     leveldb::WriteOptions write_options;
-    write_options.sync = true;
-    leveldb::Status status = db->Put(write_options, key, slice);
+    write_options.sync = sync;
+    leveldb::Status status = db->put(write_options, key, slice);
     if(!status.ok()) throw std::runtime_error("Could not write block count to DB : " + status.ToString());
 }
 
@@ -48,17 +290,44 @@ Bigint BlockStore::getTotalWork() const{
     string countKey = TOTAL_WORK_KEY;
     leveldb::Slice key = leveldb::Slice(countKey);
     string value;
-    leveldb::Status status = db->Get(leveldb::ReadOptions(),key, &value);
+    leveldb::Status status = db->get(leveldb::ReadOptions(),key, &value);
     if(!status.ok()) throw std::runtime_error("Could not read block count from DB : " + status.ToString());
     Bigint b(value);
     return b;
 }
 
+/*
+    The dirty marker is written (synchronously) before the first block whose
+    ledger and txdb updates are not flushed to disk, and cleared once they are.
+    Finding it set on startup means those stores may not match the block count.
+*/
+void BlockStore::setDirty(bool dirty) {
+    string dirtyKey = DIRTY_KEY;
+    leveldb::Slice key = leveldb::Slice(dirtyKey);
+    leveldb::WriteOptions write_options;
+    write_options.sync = true;
+    leveldb::Status status;
+    if (dirty) {
+        status = db->put(write_options, key, leveldb::Slice("", 0));
+    } else {
+        status = db->remove(write_options, key);
+    }
+    if(!status.ok()) throw std::runtime_error("Could not write dirty marker to DB : " + status.ToString());
+}
+
+bool BlockStore::isDirty() const {
+    string dirtyKey = DIRTY_KEY;
+    leveldb::Slice key = leveldb::Slice(dirtyKey);
+    string value;
+    leveldb::Status status = db->get(leveldb::ReadOptions(),key, &value);
+    return (status.ok());
+}
+
 bool BlockStore::hasBlockCount() {
     string countKey = BLOCK_COUNT_KEY;
     leveldb::Slice key = leveldb::Slice(countKey);
     string value;
-    leveldb::Status status = db->Get(leveldb::ReadOptions(),key, &value);
+    leveldb::Status status = db->get(leveldb::ReadOptions(),key, &value);
     size_t ret = *((size_t*)value.c_str());
     return (status.ok());
 }
@@ -66,14 +335,14 @@ bool BlockStore::hasBlockCount() {
 bool BlockStore::hasBlock(uint32_t blockId) {
     leveldb::Slice key = leveldb::Slice((const char*) &blockId, sizeof(uint32_t));
     string value;
-    leveldb::Status status = db->Get(leveldb::ReadOptions(),key, &value);
+    leveldb::Status status = db->get(leveldb::ReadOptions(),key, &value);
     return (status.ok());
 }
 
 BlockHeader BlockStore::getBlockHeader(uint32_t blockId) const{
     leveldb::Slice key = leveldb::Slice((const char*) &blockId, sizeof(uint32_t));
     string valueStr;
-    leveldb::Status status = db->Get(leveldb::ReadOptions(),key, &valueStr);
+    leveldb::Status status = db->get(leveldb::ReadOptions(),key, &valueStr);
     if(!status.ok()) throw std::runtime_error("Could not read block header " + to_string(blockId) + " from BlockStore db : " + status.ToString());
     
     BlockHeader value;
@@ -81,6 +350,22 @@ BlockHeader BlockStore::getBlockHeader(uint32_t blockId) const{
     return value;
 }
 
+Transaction BlockStore::getTransaction(uint32_t blockId, uint32_t index) const{
+    uint32_t transactionId[2];
+    transactionId[0] = blockId;
+    transactionId[1] = index;
+    leveldb::Slice key = leveldb::Slice((const char*) transactionId, 2*sizeof(uint32_t));
+    string valueStr;
+    leveldb::Status status = db->get(leveldb::ReadOptions(),key, &valueStr);
+    if (status.IsNotFound() && index < this->getBlockHeader(blockId).numTransactions) {
+        return Transaction(this->getArchivedTransactions(blockId)[index]);
+    }
+    if(!status.ok()) throw std::runtime_error("Could not read transaction " + to_string(index) + " of block " + to_string(blockId) + " from BlockStore db : " + status.ToString());
+    TransactionInfo t;
+    memcpy(&t, valueStr.c_str(), sizeof(TransactionInfo));
+    return Transaction(t);
+}
+
 vector<TransactionInfo> BlockStore::getBlockTransactions(BlockHeader& block) const{
     vector<TransactionInfo> transactions;
     for(int i = 0; i < block.numTransactions; i++) {
@@ -90,7 +375,8 @@ vector<TransactionInfo> BlockStore::getBlockTransactions(BlockHeader& block) con
         transactionId[1] = idx;
         leveldb::Slice key = leveldb::Slice((const char*) transactionId, 2*sizeof(int));
         string valueStr;
-        leveldb::Status status = db->Get(leveldb::ReadOptions(),key, &valueStr);
+        leveldb::Status status = db->get(leveldb::ReadOptions(),key, &valueStr);
+        if (i == 0 && status.IsNotFound()) return this->getArchivedTransactions(block.id);
         if(!status.ok()) throw std::runtime_error("Could not read transaction from BlockStore db : " + status.ToString());
         TransactionInfo t;
         memcpy(&t, valueStr.c_str(), sizeof(TransactionInfo));
@@ -101,27 +387,27 @@ vector<TransactionInfo> BlockStore::getBlockTransactions(BlockHeader& block) con
 
 std::pair<uint8_t*, size_t> BlockStore::getRawData(uint32_t blockId) const{
     BlockHeader block = this->getBlockHeader(blockId);
-    size_t numBytes = BLOCKHEADER_BUFFER_SIZE + (TRANSACTIONINFO_BUFFER_SIZE * block.numTransactions);
+    vector<TransactionInfo> transactions = this->getBlockTransactions(block);
+    size_t numBytes = BLOCKHEADER_BUFFER_SIZE + (TRANSACTIONINFO_BUFFER_SIZE * transactions.size());
     char* buffer = (char*)malloc(numBytes);
     blockHeaderToBuffer(block, buffer);
-    char* transactionBuffer = buffer + BLOCKHEADER_BUFFER_SIZE;
-    char* currTransactionPtr = transactionBuffer;
-    for(int i = 0; i < block.numTransactions; i++) {
-        int idx = i;
-        uint32_t transactionId[2];
-        transactionId[0] = blockId;
-        transactionId[1] = idx;
-        leveldb::Slice key = leveldb::Slice((const char*) transactionId, 2*sizeof(uint32_t));
-        string value;
-        leveldb::Status status = db->Get(leveldb::ReadOptions(),key, &value);
-        TransactionInfo txinfo = *(TransactionInfo*)(value.c_str());
+    char* currTransactionPtr = buffer + BLOCKHEADER_BUFFER_SIZE;
+    for(auto& txinfo : transactions) {
         transactionInfoToBuffer(txinfo, currTransactionPtr);
-        if (!status.ok()) throw std::runtime_error("Could not read transaction from BlockStore db : " + status.ToString());
         currTransactionPtr += TRANSACTIONINFO_BUFFER_SIZE;
     }
     return std::pair<uint8_t*, size_t>((uint8_t*)buffer, numBytes);
 }
 
+vector<TransactionInfo> BlockStore::getArchivedTransactions(uint32_t blockId) const{
+    string valueStr;
+    leveldb::Status status = db->get(leveldb::ReadOptions(), leveldb::Slice(archiveKey(blockId)), &valueStr);
+    if(!status.ok()) throw std::runtime_error("Could not read transactions of block " + to_string(blockId) + " from BlockStore db : " + status.ToString());
+    BlockStoreDictionary dictionary(*this, NULL);
+    vector<TransactionInfo> transactions = decodeArchivedTransactions(valueStr, dictionary);
+    return std::move(transactions);
+}
+
 Block BlockStore::getBlock(uint32_t blockId) const{
     BlockHeader block = this->getBlockHeader(blockId);
     vector<TransactionInfo> transactionInfo = this->getBlockTransactions(block);
@@ -134,109 +420,541 @@ Block BlockStore::getBlock(uint32_t blockId) const{
 }
 
 vector<SHA256Hash> BlockStore::getTransactionsForWallet(PublicWalletAddress& wallet) const{
-    struct {
-        uint8_t addr[25];
-        uint8_t txId[32];
-    } startKey;
-
-    struct {
-        uint8_t addr[25];
-        uint8_t txId[32];
-    } endKey;
+    vector<SHA256Hash> ret;
+    for (auto ref : this->getWalletTransactionsBefore(wallet, UINT32_MAX, UINT32_MAX, SIZE_MAX)) {
+        ret.push_back(ref.txid);
+    }
+    return std::move(ret);
+}
 
-    memcpy(startKey.addr,wallet.data(), 25);
-    memset(startKey.txId, 0, 32);
-    memcpy(endKey.addr, wallet.data(), 25);
-    memset(endKey.txId, -1, 32);
+vector<WalletTransactionRef> BlockStore::getWalletTransactionsBefore(PublicWalletAddress& wallet, uint32_t blockId, uint32_t index, size_t limit) const{
+    WalletIndexKey startKey = walletIndexKey(wallet, blockId, index);
+    leveldb::Slice startSlice = leveldb::Slice((const char*) &startKey, sizeof(startKey));
+    std::unique_ptr<leveldb::Iterator> it(db->newIterator(leveldb::ReadOptions()));
 
-    auto startSlice = leveldb::Slice((const char*) &startKey, sizeof(startKey));
-    auto endSlice = leveldb::Slice((const char*) &endKey, sizeof(endKey));
+    // position on the last key strictly below the cursor, then walk backwards
+    it->Seek(startSlice);
+    if (it->Valid()) {
+        it->Prev();
+    } else {
+        it->SeekToLast();
+    }
+    vector<WalletTransactionRef> ret;
+    WalletTransactionRef ref;
+    for (; it->Valid() && ret.size() < limit; it->Prev()) {
+        if (!readWalletIndexEntry(it.get(), wallet, ref)) {
+            // legacy keys share the address prefix, skip over them
+            if (it->key().size() == LEGACY_WALLET_KEY_SIZE && memcmp(it->key().data(), wallet.data(), 25) == 0) continue;
+            break;
+        }
+        ret.push_back(ref);
+    }
+    return std::move(ret);
+}
 
-    // Get a database iterator
-    std::shared_ptr<leveldb::Iterator> it(db->NewIterator(leveldb::ReadOptions()));
+vector<WalletTransactionRef> BlockStore::getWalletTransactionsAfter(PublicWalletAddress& wallet, uint32_t blockId, uint32_t index, size_t limit) const{
+    WalletIndexKey startKey = walletIndexKey(wallet, blockId, index);
+    leveldb::Slice startSlice = leveldb::Slice((const char*) &startKey, sizeof(startKey));
+    std::unique_ptr<leveldb::Iterator> it(db->newIterator(leveldb::ReadOptions()));
 
-    vector<SHA256Hash> ret;
-    for(it->Seek(startSlice); it->Valid() && it->key().compare(endSlice) < 0; it->Next()) {                
-        leveldb::Slice keySlice(it->key());
-        SHA256Hash txid;
-        memcpy(txid.data(), keySlice.data() + 25, 32);
-        ret.push_back(txid);
+    it->Seek(startSlice);
+    if (it->Valid() && it->key().compare(startSlice) == 0) it->Next();
+    vector<WalletTransactionRef> ret;
+    WalletTransactionRef ref;
+    for (; it->Valid() && ret.size() < limit; it->Next()) {
+        if (!readWalletIndexEntry(it.get(), wallet, ref)) {
+            if (it->key().size() == LEGACY_WALLET_KEY_SIZE && memcmp(it->key().data(), wallet.data(), 25) == 0) continue;
+            break;
+        }
+        ret.push_back(ref);
     }
+    // the entries closest to the cursor, returned newest first
+    std::reverse(ret.begin(), ret.end());
     return std::move(ret);
 }
 
-
 void BlockStore::removeBlockWalletTransactions(Block& block) {
-    for(auto t : block.getTransactions()) {
-        SHA256Hash txid = t.hashContents();
-        struct {
-            uint8_t addr[25];
-            uint8_t txId[32];
-        } w1Key;
-
-        struct {
-            uint8_t addr[25];
-            uint8_t txId[32];
-        } w2Key;
-
-        memcpy(w1Key.addr, t.fromWallet().data(), 25);
-        memcpy(w1Key.txId, txid.data(), 32);
-        memcpy(w2Key.addr, t.toWallet().data(), 25);
-        memcpy(w2Key.txId, txid.data(), 32);
+    uint32_t blockId = block.getId();
+    vector<Transaction>& transactions = block.getTransactions();
+    for(uint32_t i = 0; i < transactions.size(); i++) {
+        WalletIndexKey w1Key = walletIndexKey(transactions[i].fromWallet(), blockId, i);
+        WalletIndexKey w2Key = walletIndexKey(transactions[i].toWallet(), blockId, i);
 
         leveldb::Slice key = leveldb::Slice((const char*) &w1Key, sizeof(w1Key));
-        leveldb::Status status = db->Delete(leveldb::WriteOptions(), key);
+        leveldb::Status status = db->remove(leveldb::WriteOptions(), key);
         if(!status.ok()) throw std::runtime_error("Could not remove transaction from wallet in blockstore db : " + status.ToString());
 
         key = leveldb::Slice((const char*) &w2Key, sizeof(w2Key));
-        status = db->Delete(leveldb::WriteOptions(), key);
+        status = db->remove(leveldb::WriteOptions(), key);
         if(!status.ok()) throw std::runtime_error("Could not remove transaction from wallet in blockstore db : " + status.ToString());
     }
 }
 
-void BlockStore::setBlock(Block& block) {
+void BlockStore::upgradeWalletIndex() {
+    string versionKey = WALLET_INDEX_VERSION_KEY;
+    string value;
+    leveldb::Status status = db->get(leveldb::ReadOptions(), leveldb::Slice(versionKey), &value);
+    if (status.ok() && value == to_string(WALLET_INDEX_VERSION)) return;
+
+    // stores written before the index was position keyed hold (address, txid)
+    // entries, drop them and re-index every block from its stored transactions
+    leveldb::WriteBatch batch;
+    size_t removed = 0;
+    std::unique_ptr<leveldb::Iterator> it(db->newIterator(leveldb::ReadOptions()));
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        if (it->key().size() == LEGACY_WALLET_KEY_SIZE) {
+            batch.Delete(it->key());
+            removed++;
+        }
+    }
+    it.reset();
+    status = db->write(leveldb::WriteOptions(), &batch);
+    if(!status.ok()) throw std::runtime_error("Could not remove legacy wallet index : " + status.ToString());
+
+    size_t count = this->hasBlockCount() ? this->getBlockCount() : 0;
+    if (removed > 0 || count > 0) Logger::logStatus("Rebuilding wallet index for " + to_string(count) + " blocks");
+    for (uint32_t blockId = this->getPrunedHeight() + 1; blockId <= count; blockId++) {
+        if (blockId % 10000 == 0) Logger::logStatus("Rebuilding wallet index, finished block: " + to_string(blockId));
+        BlockHeader header = this->getBlockHeader(blockId);
+        vector<TransactionInfo> transactions = this->getBlockTransactions(header);
+        leveldb::WriteBatch blockBatch;
+        for (uint32_t i = 0; i < transactions.size(); i++) {
+            SHA256Hash txid = Transaction(transactions[i]).hashContents();
+            WalletIndexKey w1Key = walletIndexKey(transactions[i].from, blockId, i);
+            WalletIndexKey w2Key = walletIndexKey(transactions[i].to, blockId, i);
+            leveldb::Slice txidSlice = leveldb::Slice((const char*) txid.data(), txid.size());
+            blockBatch.Put(leveldb::Slice((const char*) &w1Key, sizeof(w1Key)), txidSlice);
+            blockBatch.Put(leveldb::Slice((const char*) &w2Key, sizeof(w2Key)), txidSlice);
+        }
+        status = db->write(leveldb::WriteOptions(), &blockBatch);
+        if(!status.ok()) throw std::runtime_error("Could not write wallet index : " + status.ToString());
+    }
+
+    string version = to_string(WALLET_INDEX_VERSION);
+    leveldb::WriteOptions write_options;
+    write_options.sync = true;
+    status = db->put(write_options, leveldb::Slice(versionKey), leveldb::Slice(version));
+    if(!status.ok()) throw std::runtime_error("Could not write wallet index version : " + status.ToString());
+}
+
+bool BlockStore::hasBalanceHistory() const{
+    string value;
+    leveldb::Status status = db->get(leveldb::ReadOptions(), leveldb::Slice(BALANCE_HISTORY_HEIGHT_KEY), &value);
+    return status.ok();
+}
+
+uint32_t BlockStore::getBalanceHistoryHeight() const{
+    return readHeightKey(this->db, BALANCE_HISTORY_HEIGHT_KEY);
+}
+
+void BlockStore::setBalanceHistoryHeight(uint32_t blockId) {
+    leveldb::WriteOptions write_options;
+    write_options.sync = true;
+    string key = BALANCE_HISTORY_HEIGHT_KEY;
+    leveldb::Status status = db->put(write_options, leveldb::Slice(key), leveldb::Slice((const char*) &blockId, sizeof(uint32_t)));
+    if(!status.ok()) throw std::runtime_error("Could not write balance history height : " + status.ToString());
+}
+
+void BlockStore::clearBalanceHistory() {
+    leveldb::WriteBatch batch;
+    string prefix = BALANCE_KEY_PREFIX;
+    std::unique_ptr<leveldb::Iterator> it(db->newIterator(leveldb::ReadOptions()));
+    for (it->Seek(leveldb::Slice(prefix)); it->Valid() && it->key().starts_with(leveldb::Slice(prefix)); it->Next()) {
+        if (it->key().size() == sizeof(BalanceKey)) batch.Delete(it->key());
+    }
+    it.reset();
+    batch.Delete(leveldb::Slice(BALANCE_HISTORY_HEIGHT_KEY));
+    leveldb::Status status = db->write(leveldb::WriteOptions(), &batch);
+    if(!status.ok()) throw std::runtime_error("Could not clear balance history : " + status.ToString());
+}
+
+static void putBalanceChanges(leveldb::WriteBatch& batch, uint32_t blockId, const map<PublicWalletAddress, BalanceChange>& changes) {
+    for (auto& it : changes) {
+        BalanceKey key = balanceKey(it.first, blockId);
+        batch.Put(leveldb::Slice((const char*) &key, sizeof(key)), leveldb::Slice((const char*) &it.second, sizeof(BalanceChange)));
+    }
+}
+
+void BlockStore::setBalanceChanges(uint32_t blockId, const map<PublicWalletAddress, BalanceChange>& changes) {
+    leveldb::WriteBatch batch;
+    putBalanceChanges(batch, blockId, changes);
+    leveldb::Status status = db->write(leveldb::WriteOptions(), &batch);
+    if(!status.ok()) throw std::runtime_error("Could not write balance changes to BlockStore db : " + status.ToString());
+}
+
+void BlockStore::removeBalanceChanges(Block& block) {
+    // every wallet a block touches is the sender or receiver of one of its transactions
+    leveldb::WriteBatch batch;
+    for (auto& t : block.getTransactions()) {
+        BalanceKey fromKey = balanceKey(t.fromWallet(), block.getId());
+        BalanceKey toKey = balanceKey(t.toWallet(), block.getId());
+        batch.Delete(leveldb::Slice((const char*) &fromKey, sizeof(fromKey)));
+        batch.Delete(leveldb::Slice((const char*) &toKey, sizeof(toKey)));
+    }
+    leveldb::Status status = db->write(leveldb::WriteOptions(), &batch);
+    if(!status.ok()) throw std::runtime_error("Could not remove balance changes from BlockStore db : " + status.ToString());
+}
+
+/*
+    Balance of a wallet after block blockId. The nearest change at or below
+    the block holds it directly; failing that the first change above it holds
+    the balance before that change. Returns false when the wallet has no
+    recorded change after blockId either, its balance is then unchanged since.
+*/
+bool BlockStore::getBalanceAt(const PublicWalletAddress& wallet, uint32_t blockId, TransactionAmount& balance) const{
+    BalanceKey startKey = balanceKey(wallet, blockId + 1);
+    leveldb::Slice startSlice = leveldb::Slice((const char*) &startKey, sizeof(startKey));
+    std::unique_ptr<leveldb::Iterator> it(db->newIterator(leveldb::ReadOptions()));
+
+    BalanceChange next;
+    it->Seek(startSlice);
+    bool hasNext = it->Valid() && readBalanceEntry(it.get(), wallet, next);
+    if (it->Valid()) {
+        it->Prev();
+    } else {
+        it->SeekToLast();
+    }
+    BalanceChange previous;
+    if (it->Valid() && readBalanceEntry(it.get(), wallet, previous)) {
+        balance = previous.balance;
+        return true;
+    }
+    if (hasNext) {
+        balance = next.balance - next.delta;
+        return true;
+    }
+    return false;
+}
+
+bool BlockStore::getTimeEnvelope(uint32_t blockId, uint64_t& envelope) const{
+    TimeEnvelopeKey key = timeEnvelopeKey(blockId);
+    string value;
+    leveldb::Status status = db->get(leveldb::ReadOptions(), leveldb::Slice((const char*) &key, sizeof(key)), &value);
+    if (!status.ok() || value.size() != sizeof(uint64_t)) return false;
+    memcpy(&envelope, value.c_str(), sizeof(uint64_t));
+    return true;
+}
+
+void BlockStore::setBlockTime(uint32_t blockId, uint64_t timestamp, leveldb::WriteBatch& batch) {
+    uint64_t replaced;
+    if (this->getTimeEnvelope(blockId, replaced)) {
+        TimeIndexKey oldKey = timeIndexKey(replaced, blockId);
+        batch.Delete(leveldb::Slice((const char*) &oldKey, sizeof(oldKey)));
+    }
+    uint64_t envelope = 0;
+    if (blockId > 1) this->getTimeEnvelope(blockId - 1, envelope);
+    envelope = std::max(envelope, timestamp);
+    TimeEnvelopeKey envelopeKey = timeEnvelopeKey(blockId);
+    TimeIndexKey indexKey = timeIndexKey(envelope, blockId);
+    batch.Put(leveldb::Slice((const char*) &envelopeKey, sizeof(envelopeKey)), leveldb::Slice((const char*) &envelope, sizeof(uint64_t)));
+    batch.Put(leveldb::Slice((const char*) &indexKey, sizeof(indexKey)), leveldb::Slice());
+}
+
+void BlockStore::removeBlockTime(uint32_t blockId) {
+    uint64_t envelope;
+    if (!this->getTimeEnvelope(blockId, envelope)) return;
+    leveldb::WriteBatch batch;
+    TimeEnvelopeKey envelopeKey = timeEnvelopeKey(blockId);
+    TimeIndexKey indexKey = timeIndexKey(envelope, blockId);
+    batch.Delete(leveldb::Slice((const char*) &envelopeKey, sizeof(envelopeKey)));
+    batch.Delete(leveldb::Slice((const char*) &indexKey, sizeof(indexKey)));
+    leveldb::Status status = db->write(leveldb::WriteOptions(), &batch);
+    if(!status.ok()) throw std::runtime_error("Could not remove time index from BlockStore db : " + status.ToString());
+}
+
+/*
+    First block, up to maxBlockId, by which the chain had reached timestamp:
+    every block before it is older. Returns 0 when there is none.
+*/
+uint32_t BlockStore::getBlockAtTime(uint64_t timestamp, uint32_t maxBlockId) const{
+    TimeIndexKey startKey = timeIndexKey(timestamp, 0);
+    std::unique_ptr<leveldb::Iterator> it(db->newIterator(leveldb::ReadOptions()));
+    it->Seek(leveldb::Slice((const char*) &startKey, sizeof(startKey)));
+    if (!it->Valid()) return 0;
+    leveldb::Slice key = it->key();
+    if (key.size() != sizeof(TimeIndexKey) || memcmp(key.data(), TIME_INDEX_PREFIX, 8) != 0) return 0;
+    // envelopes never decrease along the chain, so entries are in block order
+    // and any later one belongs to a block past this one too
+    uint32_t blockId = readBigEndianUint32((const uint8_t*) key.data() + 16);
+    return blockId <= maxBlockId ? blockId : 0;
+}
+
+void BlockStore::upgradeTimeIndex() {
+    string versionKey = TIME_INDEX_VERSION_KEY;
+    string value;
+    leveldb::Status status = db->get(leveldb::ReadOptions(), leveldb::Slice(versionKey), &value);
+    if (status.ok() && value == to_string(TIME_INDEX_VERSION)) return;
+
+    leveldb::WriteBatch batch;
+    std::unique_ptr<leveldb::Iterator> it(db->newIterator(leveldb::ReadOptions()));
+    for (it->Seek(leveldb::Slice(TIME_ENVELOPE_PREFIX)); it->Valid() && it->key().starts_with(leveldb::Slice(TIME_ENVELOPE_PREFIX)); it->Next()) {
+        batch.Delete(it->key());
+    }
+    for (it->Seek(leveldb::Slice(TIME_INDEX_PREFIX)); it->Valid() && it->key().starts_with(leveldb::Slice(TIME_INDEX_PREFIX)); it->Next()) {
+        batch.Delete(it->key());
+    }
+    it.reset();
+    status = db->write(leveldb::WriteOptions(), &batch);
+    if(!status.ok()) throw std::runtime_error("Could not remove time index : " + status.ToString());
+
+    // headers survive pruning, so the index always covers the whole chain
+    size_t count = this->hasBlockCount() ? this->getBlockCount() : 0;
+    if (count > 0) Logger::logStatus("Building time index for " + to_string(count) + " blocks");
+    for (uint32_t blockId = 1; blockId <= count; blockId++) {
+        if (blockId % 10000 == 0) Logger::logStatus("Building time index, finished block: " + to_string(blockId));
+        // each envelope builds on the previous one, so every block is its own write
+        leveldb::WriteBatch blockBatch;
+        this->setBlockTime(blockId, this->getBlockHeader(blockId).timestamp, blockBatch);
+        status = db->write(leveldb::WriteOptions(), &blockBatch);
+        if(!status.ok()) throw std::runtime_error("Could not write time index to BlockStore db : " + status.ToString());
+    }
+
+    string version = to_string(TIME_INDEX_VERSION);
+    leveldb::WriteOptions write_options;
+    write_options.sync = true;
+    status = db->put(write_options, leveldb::Slice(versionKey), leveldb::Slice(version));
+    if(!status.ok()) throw std::runtime_error("Could not write time index version : " + status.ToString());
+}
+
+// pruned blocks only have their headers left, their volume & fees count as zero
+BlockStats BlockStore::computeBlockStats(BlockHeader& header) const{
+    BlockStats stats;
+    stats.transactions = header.numTransactions;
+    stats.difficulty = header.difficulty;
+    stats.work = header.difficulty < 64 ? (uint64_t) 1 << header.difficulty : 0;
+    if (header.id > this->getPrunedHeight()) {
+        for (auto& t : this->getBlockTransactions(header)) {
+            stats.volume += t.amount;
+            stats.fees += t.fee;
+        }
+    }
+    return stats;
+}
+
+void BlockStore::writeBlockStats(uint32_t blockId, BlockHeader& header) {
+    leveldb::WriteBatch batch;
+    this->setBlockStats(blockId, this->computeBlockStats(header), header.timestamp, batch);
+    leveldb::Status status = db->write(leveldb::WriteOptions(), &batch);
+    if(!status.ok()) throw std::runtime_error("Could not write block stats to BlockStore db : " + status.ToString());
+}
+
+void BlockStore::setBlockStats(uint32_t blockId, BlockStats stats, uint64_t timestamp, leveldb::WriteBatch& batch) {
+    BlockStatsRecord previous;
+    bool hasPrevious = blockId > 1 && readBlockStatsRecord(this->db, blockId - 1, previous);
+    if (!hasPrevious && blockId > 1 && this->hasBlock(blockId - 1)) {
+        // totals run over every stored block, rebuild the missing records below
+        // this one from their headers rather than restarting the sums here
+        uint32_t from = blockId - 1;
+        while (from > 1 && this->hasBlock(from - 1) && !readBlockStatsRecord(this->db, from - 1, previous)) from--;
+        for (uint32_t id = from; id < blockId; id++) {
+            BlockHeader header = this->getBlockHeader(id);
+            this->writeBlockStats(id, header);
+        }
+        if (!readBlockStatsRecord(this->db, blockId - 1, previous)) throw std::runtime_error("No stats for block " + to_string(blockId - 1));
+        hasPrevious = true;
+    }
+    if (!hasPrevious) {
+        // the first stored block starts the totals
+        previous = BlockStatsRecord();
+        previous.timestamp = timestamp;
+    }
+    BlockStatsRecord record;
+    stats.interval = (int64_t) timestamp - (int64_t) previous.timestamp;
+    record.block = stats;
+    record.total.transactions = previous.total.transactions + stats.transactions;
+    record.total.volume = previous.total.volume + stats.volume;
+    record.total.fees = previous.total.fees + stats.fees;
+    record.total.difficulty = previous.total.difficulty + stats.difficulty;
+    record.total.work = previous.total.work + stats.work;
+    record.total.interval = previous.total.interval + stats.interval;
+    record.timestamp = timestamp;
+    BlockStatsKey key = blockStatsKey(blockId);
+    batch.Put(leveldb::Slice((const char*) &key, sizeof(key)), leveldb::Slice((const char*) &record, sizeof(record)));
+}
+
+void BlockStore::removeBlockStats(uint32_t blockId) {
+    BlockStatsKey key = blockStatsKey(blockId);
+    leveldb::Status status = db->remove(leveldb::WriteOptions(), leveldb::Slice((const char*) &key, sizeof(key)));
+    if(!status.ok()) throw std::runtime_error("Could not remove block stats from BlockStore db : " + status.ToString());
+}
+
+BlockStats BlockStore::getBlockStats(uint32_t blockId) const{
+    BlockStatsRecord record;
+    if (!readBlockStatsRecord(this->db, blockId, record)) throw std::runtime_error("No stats for block " + to_string(blockId));
+    return record.block;
+}
+
+BlockStats BlockStore::getChainStats(uint32_t fromBlockId, uint32_t toBlockId) const{
+    BlockStatsRecord last;
+    if (!readBlockStatsRecord(this->db, toBlockId, last)) throw std::runtime_error("No stats for block " + to_string(toBlockId));
+    BlockStatsRecord before;
+    if (fromBlockId <= 1) {
+        before = BlockStatsRecord();
+    } else if (!readBlockStatsRecord(this->db, fromBlockId - 1, before)) {
+        throw std::runtime_error("No stats for block " + to_string(fromBlockId - 1));
+    }
+    // totals wrap like the sums they hold, the difference of any range that fits is exact
+    BlockStats ret;
+    ret.transactions = last.total.transactions - before.total.transactions;
+    ret.volume = last.total.volume - before.total.volume;
+    ret.fees = last.total.fees - before.total.fees;
+    ret.difficulty = last.total.difficulty - before.total.difficulty;
+    ret.work = last.total.work - before.total.work;
+    ret.interval = last.total.interval - before.total.interval;
+    return ret;
+}
+
+void BlockStore::upgradeBlockStats() {
+    string versionKey = BLOCK_STATS_VERSION_KEY;
+    string value;
+    leveldb::Status status = db->get(leveldb::ReadOptions(), leveldb::Slice(versionKey), &value);
+    if (status.ok() && value == to_string(BLOCK_STATS_VERSION)) return;
+
+    size_t count = this->hasBlockCount() ? this->getBlockCount() : 0;
+    if (count > 0) Logger::logStatus("Building block stats for " + to_string(count) + " blocks");
+    for (uint32_t blockId = 1; blockId <= count; blockId++) {
+        if (blockId % 10000 == 0) Logger::logStatus("Building block stats, finished block: " + to_string(blockId));
+        BlockHeader header = this->getBlockHeader(blockId);
+        this->writeBlockStats(blockId, header);
+    }
+
+    string version = to_string(BLOCK_STATS_VERSION);
+    leveldb::WriteOptions write_options;
+    write_options.sync = true;
+    status = db->put(write_options, leveldb::Slice(versionKey), leveldb::Slice(version));
+    if(!status.ok()) throw std::runtime_error("Could not write block stats version : " + status.ToString());
+}
+
+uint32_t BlockStore::getPrunedHeight() const{
+    return readHeightKey(this->db, PRUNED_HEIGHT_KEY);
+}
+
+uint32_t BlockStore::getArchivedHeight() const{
+    return readHeightKey(this->db, ARCHIVED_HEIGHT_KEY);
+}
+
+string BlockStore::getDictionaryValue(uint32_t id) const{
+    {
+        std::unique_lock<std::mutex> ul(dictionaryLock);
+        auto it = this->dictionaryCache.find(id);
+        if (it != this->dictionaryCache.end()) return it->second;
+    }
+    string value;
+    leveldb::Status status = db->get(leveldb::ReadOptions(), leveldb::Slice(dictionaryValueKey(id)), &value);
+    if(!status.ok()) throw std::runtime_error("Could not read archive dictionary entry " + to_string(id) + " : " + status.ToString());
+    std::unique_lock<std::mutex> ul(dictionaryLock);
+    if (this->dictionaryCache.size() >= DICTIONARY_CACHE_SIZE) this->dictionaryCache.clear();
+    this->dictionaryCache[id] = value;
+    return value;
+}
+
+/*
+    Rewrites the transactions of the blocks after the current archived height,
+    up to blockId and at most maxBlocks of them, into the compressed archive
+    format. Like pruning, each call is one atomic write.
+*/
+uint32_t BlockStore::archiveBlocks(uint32_t blockId, uint32_t maxBlocks) {
+    uint32_t start = std::max(this->getArchivedHeight(), this->getPrunedHeight()) + 1;
+    if (blockId < start || maxBlocks == 0) return start - 1;
+    uint32_t end = std::min(blockId, start + maxBlocks - 1);
+    leveldb::WriteBatch batch;
+    BlockStoreDictionary dictionary(*this, &batch);
+    for (uint32_t id = start; id <= end; id++) {
+        BlockHeader header = this->getBlockHeader(id);
+        vector<TransactionInfo> transactions = this->getBlockTransactions(header);
+        batch.Put(leveldb::Slice(archiveKey(id)), leveldb::Slice(encodeArchivedTransactions(transactions, dictionary)));
+        for (uint32_t i = 0; i < transactions.size(); i++) {
+            uint32_t transactionId[2] = {id, i};
+            batch.Delete(leveldb::Slice((const char*) transactionId, 2*sizeof(uint32_t)));
+        }
+    }
+    dictionary.finish();
+    string archivedKey = ARCHIVED_HEIGHT_KEY;
+    batch.Put(leveldb::Slice(archivedKey), leveldb::Slice((const char*) &end, sizeof(uint32_t)));
+    leveldb::Status status = db->write(leveldb::WriteOptions(), &batch);
+    if(!status.ok()) throw std::runtime_error("Could not archive blocks in BlockStore db : " + status.ToString());
+    return end;
+}
+
+/*
+    Deletes the transaction records, wallet index and balance history entries
+    of the blocks after the current pruned height, up to blockId and at most
+    maxBlocks of them. Headers are kept. Each call is a single atomic write
+    that also advances the pruned height, so an interrupted prune resumes
+    cleanly.
+*/
+uint32_t BlockStore::pruneBlocks(uint32_t blockId, uint32_t maxBlocks) {
+    uint32_t start = this->getPrunedHeight() + 1;
+    if (blockId < start || maxBlocks == 0) return start - 1;
+    uint32_t end = std::min(blockId, start + maxBlocks - 1);
+    leveldb::WriteBatch batch;
+    for (uint32_t id = start; id <= end; id++) {
+        BlockHeader header = this->getBlockHeader(id);
+        vector<TransactionInfo> transactions = this->getBlockTransactions(header);
+        for (uint32_t i = 0; i < transactions.size(); i++) {
+            uint32_t transactionId[2] = {id, i};
+            WalletIndexKey w1Key = walletIndexKey(transactions[i].from, id, i);
+            WalletIndexKey w2Key = walletIndexKey(transactions[i].to, id, i);
+            BalanceKey fromKey = balanceKey(transactions[i].from, id);
+            BalanceKey toKey = balanceKey(transactions[i].to, id);
+            batch.Delete(leveldb::Slice((const char*) transactionId, 2*sizeof(uint32_t)));
+            batch.Delete(leveldb::Slice((const char*) &w1Key, sizeof(w1Key)));
+            batch.Delete(leveldb::Slice((const char*) &w2Key, sizeof(w2Key)));
+            batch.Delete(leveldb::Slice((const char*) &fromKey, sizeof(fromKey)));
+            batch.Delete(leveldb::Slice((const char*) &toKey, sizeof(toKey)));
+        }
+        batch.Delete(leveldb::Slice(archiveKey(id)));
+    }
+    string prunedKey = PRUNED_HEIGHT_KEY;
+    batch.Put(leveldb::Slice(prunedKey), leveldb::Slice((const char*) &end, sizeof(uint32_t)));
+    // the history still answers for the pruned height itself, a change
+    // above it holds the balance before it and none means it is unchanged
+    if (this->hasBalanceHistory() && this->getBalanceHistoryHeight() < end) {
+        batch.Put(leveldb::Slice(BALANCE_HISTORY_HEIGHT_KEY), leveldb::Slice((const char*) &end, sizeof(uint32_t)));
+    }
+    leveldb::Status status = db->write(leveldb::WriteOptions(), &batch);
+    if(!status.ok()) throw std::runtime_error("Could not prune blocks from BlockStore db : " + status.ToString());
+    return end;
+}
+
+/*
+    Writes the block with everything indexed from it, its transactions, wallet
+    history, balance changes, time index entry and stats, in one atomic write
+    so a crash never leaves a block that the indexes only partly know about.
+*/
+void BlockStore::setBlock(Block& block, const map<PublicWalletAddress, BalanceChange>& balanceChanges) {
     uint32_t blockId = block.getId();
-    leveldb::Slice key = leveldb::Slice((const char*) &blockId, sizeof(uint32_t));
+    leveldb::WriteBatch batch;
     BlockHeader blockStruct = block.serialize();
-    leveldb::Slice slice = leveldb::Slice((const char*)&blockStruct, sizeof(BlockHeader));
-    leveldb::Status status = db->Put(leveldb::WriteOptions(), key, slice);
-    if(!status.ok()) throw std::runtime_error("Could not write block to BlockStore db : " + status.ToString());
+    batch.Put(leveldb::Slice((const char*) &blockId, sizeof(uint32_t)), leveldb::Slice((const char*)&blockStruct, sizeof(BlockHeader)));
+    this->setBlockTime(blockId, block.getTimestamp(), batch);
+    BlockStats stats;
+    stats.transactions = block.getTransactions().size();
+    stats.difficulty = block.getDifficulty();
+    stats.work = block.getDifficulty() < 64 ? (uint64_t) 1 << block.getDifficulty() : 0;
+    for (auto& t : block.getTransactions()) {
+        stats.volume += t.getAmount();
+        stats.fees += t.getTransactionFee();
+    }
+    this->setBlockStats(blockId, stats, block.getTimestamp(), batch);
+    // a block replaced after a reorg must not be shadowed by an old archive record
+    if (blockId <= this->getArchivedHeight()) batch.Delete(leveldb::Slice(archiveKey(blockId)));
     for(int i = 0; i < block.getTransactions().size(); i++) {
         uint32_t transactionId[2];
         transactionId[0] = blockId;
         transactionId[1] = i;
         TransactionInfo t = block.getTransactions()[i].serialize();
-        leveldb::Slice key = leveldb::Slice((const char*) transactionId, 2*sizeof(uint32_t));
-        leveldb::Slice slice = leveldb::Slice((const char*)&t, sizeof(TransactionInfo));
-        leveldb::Status status = db->Put(leveldb::WriteOptions(), key, slice);
-        if(!status.ok()) throw std::runtime_error("Could not write transaction to BlockStore db : " + status.ToString());
+        batch.Put(leveldb::Slice((const char*) transactionId, 2*sizeof(uint32_t)), leveldb::Slice((const char*)&t, sizeof(TransactionInfo)));
 
         // add the transaction to from and to wallets list of transactions
         SHA256Hash txid = block.getTransactions()[i].hashContents();
-        struct {
-            uint8_t addr[25];
-            uint8_t txId[32];
-        } w1Key;
-
-        struct {
-            uint8_t addr[25];
-            uint8_t txId[32];
-        } w2Key;
-
-        memcpy(w1Key.addr, t.from.data(), 25);
-        memcpy(w1Key.txId, txid.data(), 32);
-        memcpy(w2Key.addr, t.to.data(), 25);
-        memcpy(w2Key.txId, txid.data(), 32);
-
-        key = leveldb::Slice((const char*) &w1Key, sizeof(w1Key));
-        slice = leveldb::Slice("", 0);
-        status = db->Put(leveldb::WriteOptions(), key, slice);
-        if(!status.ok()) throw std::runtime_error("Could not write wallet transactions to BlockStore db : " + status.ToString());
-
-        key = leveldb::Slice((const char*) &w2Key, sizeof(w2Key));
-        slice = leveldb::Slice("", 0);
-        status = db->Put(leveldb::WriteOptions(), key, slice);
-        if(!status.ok()) throw std::runtime_error("Could not write wallet transactions to BlockStore db : " + status.ToString());
+        WalletIndexKey w1Key = walletIndexKey(t.from, blockId, i);
+        WalletIndexKey w2Key = walletIndexKey(t.to, blockId, i);
+        leveldb::Slice txidSlice = leveldb::Slice((const char*) txid.data(), txid.size());
+        batch.Put(leveldb::Slice((const char*) &w1Key, sizeof(w1Key)), txidSlice);
+        batch.Put(leveldb::Slice((const char*) &w2Key, sizeof(w2Key)), txidSlice);
     }
+    putBalanceChanges(batch, blockId, balanceChanges);
+    leveldb::Status status = db->write(leveldb::WriteOptions(), &batch);
+    if(!status.ok()) throw std::runtime_error("Could not write block to BlockStore db : " + status.ToString());
 }
-
@@ -1,26 +1,86 @@
 #pragma once
 #include <mutex>
+#include <unordered_map>
 #include "leveldb/db.h"
 #include "../core/common.hpp"
 #include "../core/block.hpp"
 #include "data_store.hpp"
+#include "block_archive.hpp"
+
+// a wallet history entry: the transaction's position in the chain and its id
+struct WalletTransactionRef {
+    uint32_t blockId;
+    uint32_t index;
+    SHA256Hash txid;
+};
+
+// a wallet's net balance change in one block and its balance after the block
+struct BalanceChange {
+    TransactionAmount delta;
+    TransactionAmount balance;
+};
+
+// statistics of one block, or their sums over a range of blocks
+struct BlockStats {
+    uint64_t transactions = 0;
+    TransactionAmount volume = 0;
+    TransactionAmount fees = 0;
+    uint64_t difficulty = 0;
+    uint64_t work = 0;
+    int64_t interval = 0;
+};
 
 class BlockStore : public DataStore {
     public:
         BlockStore();
+        void clear();
         bool hasBlock(uint32_t blockId);
         Block getBlock(uint32_t blockId)const;
         std::pair<uint8_t*, size_t> getRawData(uint32_t blockId) const;
         BlockHeader getBlockHeader(uint32_t blockId) const;
-        void setBlock(Block& b);
-        void setBlockCount(size_t count);
+        Transaction getTransaction(uint32_t blockId, uint32_t index) const;
+        void setBlock(Block& b, const map<PublicWalletAddress, BalanceChange>& balanceChanges = {});
+        void setBlockCount(size_t count, bool sync=true);
         size_t getBlockCount() const;
-        void setTotalWork(Bigint work);
+        void setTotalWork(Bigint work, bool sync=true);
         Bigint getTotalWork() const;
         bool hasBlockCount();
+        void setDirty(bool dirty);
+        bool isDirty() const;
 
         vector<SHA256Hash> getTransactionsForWallet(PublicWalletAddress& wallet) const;
+        vector<WalletTransactionRef> getWalletTransactionsBefore(PublicWalletAddress& wallet, uint32_t blockId, uint32_t index, size_t limit) const;
+        vector<WalletTransactionRef> getWalletTransactionsAfter(PublicWalletAddress& wallet, uint32_t blockId, uint32_t index, size_t limit) const;
         void removeBlockWalletTransactions(Block& block);
+        void upgradeWalletIndex();
+        void setBalanceChanges(uint32_t blockId, const map<PublicWalletAddress, BalanceChange>& changes);
+        void removeBalanceChanges(Block& block);
+        bool getBalanceAt(const PublicWalletAddress& wallet, uint32_t blockId, TransactionAmount& balance) const;
+        bool hasBalanceHistory() const;
+        uint32_t getBalanceHistoryHeight() const;
+        void setBalanceHistoryHeight(uint32_t blockId);
+        void clearBalanceHistory();
+        uint32_t getBlockAtTime(uint64_t timestamp, uint32_t maxBlockId) const;
+        void removeBlockTime(uint32_t blockId);
+        void upgradeTimeIndex();
+        BlockStats getBlockStats(uint32_t blockId) const;
+        BlockStats getChainStats(uint32_t fromBlockId, uint32_t toBlockId) const;
+        void removeBlockStats(uint32_t blockId);
+        void upgradeBlockStats();
+        uint32_t getPrunedHeight() const;
+        uint32_t pruneBlocks(uint32_t blockId, uint32_t maxBlocks);
+        uint32_t getArchivedHeight() const;
+        uint32_t archiveBlocks(uint32_t blockId, uint32_t maxBlocks);
     protected:
         vector<TransactionInfo> getBlockTransactions(BlockHeader& block) const;
+        vector<TransactionInfo> getArchivedTransactions(uint32_t blockId) const;
+        bool getTimeEnvelope(uint32_t blockId, uint64_t& envelope) const;
+        void setBlockTime(uint32_t blockId, uint64_t timestamp, leveldb::WriteBatch& batch);
+        BlockStats computeBlockStats(BlockHeader& header) const;
+        void setBlockStats(uint32_t blockId, BlockStats stats, uint64_t timestamp, leveldb::WriteBatch& batch);
+        void writeBlockStats(uint32_t blockId, BlockHeader& header);
+        string getDictionaryValue(uint32_t id) const;
+        mutable std::mutex dictionaryLock;
+        mutable std::unordered_map<uint32_t, string> dictionaryCache;
+        friend class BlockStoreDictionary;
 };
@@ -20,15 +20,43 @@
 #include "../core/user.hpp"
 #include "blockchain.hpp"
 #include "mempool.hpp"
+#include "watch_list.hpp"
 #include "genesis.hpp"
 
 #define FORK_CHAIN_POP_COUNT 100
 #define FORK_RESET_RETRIES 25
+// a fork reset can roll back this many blocks, which needs their bodies
+#define MIN_PRUNE_DEPTH (FORK_CHAIN_POP_COUNT * FORK_RESET_RETRIES)
+// blocks a reorg may still replace are not worth archiving
+#define MIN_ARCHIVE_DEPTH MIN_PRUNE_DEPTH
+#define PRUNE_BATCH_BLOCKS 100
+#define ARCHIVE_BATCH_BLOCKS 100
+#define MAINTENANCE_INTERVAL_MS 10000
 #define MAX_DISCONNECTS_BEFORE_RESET 15
 #define FAILURES_BEFORE_POP_ATTEMPT 1
 
 using namespace std;
 
+DurabilityMode durabilityModeFromString(string mode) {
+    if (mode == "per-block") return DURABILITY_PER_BLOCK;
+    if (mode == "group-commit") return DURABILITY_GROUP_COMMIT;
+    if (mode == "async") return DURABILITY_ASYNC_UNTIL_CAUGHT_UP;
+    throw std::runtime_error("Unknown durability mode: " + mode);
+}
+
+string durabilityModeAsString(DurabilityMode mode) {
+    switch(mode) {
+        case DURABILITY_PER_BLOCK:
+            return "per-block";
+        case DURABILITY_GROUP_COMMIT:
+            return "group-commit";
+        case DURABILITY_ASYNC_UNTIL_CAUGHT_UP:
+            return "async";
+        default:
+            return "unknown";
+    }
+}
+
 void chain_sync(BlockChain& blockchain) {
     while(true) {
         std::this_thread::sleep_for(std::chrono::milliseconds(10000));
@@ -71,17 +99,41 @@ void chain_sync(BlockChain& blockchain) {
     }
 }
 
-BlockChain::BlockChain(HostManager& hosts, string ledgerPath, string blockPath, string txdbPath) : hosts(hosts) {
+void chain_maintenance(BlockChain& blockchain) {
+    while(true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(MAINTENANCE_INTERVAL_MS));
+        if (blockchain.shutdown) break;
+        try {
+            // work in small batches so block writes are never stalled for long
+            while(!blockchain.shutdown && blockchain.pruneBlocks() > 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            while(!blockchain.shutdown && blockchain.archiveBlocks() > 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        } catch(const std::exception &e) {
+            Logger::logError("[MAINTENANCE]", e.what());
+        }
+    }
+}
+
+BlockChain::BlockChain(HostManager& hosts, string ledgerPath, string blockPath, string txdbPath, StorageBackends backends) : hosts(hosts) {
     if (ledgerPath == "") ledgerPath = LEDGER_FILE_PATH;
     if (blockPath == "") blockPath = BLOCK_STORE_FILE_PATH;
     if (txdbPath == "") txdbPath = TXDB_FILE_PATH;
     this->memPool = nullptr;
+    this->watchList = nullptr;
     this->shutdown = false;
     this->retries = 0;
-    this->ledger.init(ledgerPath);
+    this->chainStateDirty = false;
+    this->blocksSinceCommit = 0;
+    this->lastCommitTime = getTimeMilliseconds();
+    this->pruneDepth = 0;
+    this->archiveDepth = 0;
+    this->ledger.init(ledgerPath, backends.ledger);
     this->blockStore = std::make_unique<BlockStore>();
-    this->blockStore->init(blockPath);
-    this->txdb.init(txdbPath);
+    this->blockStore->init(blockPath, backends.blocks);
+    this->txdb.init(txdbPath, backends.txdb);
     hosts.setBlockstore(this->blockStore);
     this->initChain();
 }
@@ -101,11 +153,49 @@ void BlockChain::initChain() {
         this->totalWork = this->blockStore->getTotalWork();
         this->difficulty = lastBlock.getDifficulty();
         this->lastHash = lastBlock.getHash();
+        // a ledger or txdb held in memory starts empty whatever the block store holds
+        bool stateLost = this->ledger.getBackend() == STORAGE_MEMORY || this->txdb.getBackend() == STORAGE_MEMORY;
+        if (this->blockStore->isDirty() && this->blockStore->getPrunedHeight() > 0) {
+            Logger::logError(RED + "[FATAL]" + RESET, "Unclean shutdown of a pruned node, the ledger cannot be rebuilt. Please delete data dir and sync from scratch.");
+            exit(-1);
+        }
+        if (stateLost && this->blockStore->getPrunedHeight() > 0) {
+            Logger::logError(RED + "[FATAL]" + RESET, "Pruned block store with an in memory ledger or txdb, the ledger cannot be rebuilt. Please delete data dir or use leveldb storage.");
+            exit(-1);
+        }
+        if (this->blockStore->isDirty()) {
+            // crashed inside a relaxed durability window: the block store is
+            // intact up to count but ledger & txdb may be ahead or behind it
+            Logger::logStatus("Unclean shutdown detected, rebuilding ledger up to block " + to_string(count));
+            // blocks past count were written but never counted, drop what
+            // they left in the indexes and hold them for the watch list
+            this->discardedBlocks.clear();
+            for (uint32_t id = count + 1; this->blockStore->hasBlock(id); id++) {
+                Block block = this->blockStore->getBlock(id);
+                this->blockStore->removeBlockWalletTransactions(block);
+                this->blockStore->removeBlockTime(id);
+                this->blockStore->removeBlockStats(id);
+                this->discardedBlocks.insert(this->discardedBlocks.begin(), block);
+            }
+            this->recomputeLedger();
+            this->commitChainState();
+            // history may hold entries for blocks past count that were never committed
+            this->blockStore->clearBalanceHistory();
+        } else if (stateLost) {
+            Logger::logStatus("Ledger or txdb kept in memory, rebuilding up to block " + to_string(count));
+            this->recomputeLedger();
+            this->commitChainState();
+        }
     } else {
         this->resetChain();
         // Set Pufferfish difficulty from block 1
         this->difficulty = MIN_DIFFICULTY;
     }
+    this->blockStore->upgradeWalletIndex();
+    this->blockStore->upgradeTimeIndex();
+    this->blockStore->upgradeBlockStats();
+    if (!this->blockStore->hasBalanceHistory()) this->rebuildBalanceHistory();
+    this->publishView();
 }
 
 void BlockChain::resetChain() {
@@ -163,6 +253,8 @@ void BlockChain::resetChain() {
 }
 
 void BlockChain::closeDB() {
+    std::atomic_store(&this->view, std::shared_ptr<const ChainView>());
+    if (this->chainStateDirty) this->commitChainState();
     txdb.closeDB();
     ledger.closeDB();
     this->blockStore->closeDB();
@@ -176,17 +268,101 @@ void BlockChain::deleteDB() {
 }
 
 std::pair<uint8_t*, size_t> BlockChain::getRaw(uint32_t blockId) const{
-    if (blockId <= 0 || blockId > this->numBlocks) throw std::runtime_error("Invalid block");
-    return this->blockStore->getRawData(blockId);
+    return this->liveView().getRaw(blockId);
 }
 
 BlockHeader BlockChain::getBlockHeader(uint32_t blockId) const{
-    if (blockId <= 0 || blockId > this->numBlocks) throw std::runtime_error("Invalid block");
-    return this->blockStore->getBlockHeader(blockId);
+    return this->liveView().getBlockHeader(blockId);
+}
+
+ChainTip BlockChain::getTip() const {
+    ChainTip tip;
+    tip.blockCount = this->numBlocks;
+    tip.lastHash = this->lastHash;
+    tip.totalWork = this->totalWork;
+    tip.difficulty = this->difficulty;
+    return tip;
+}
+
+// reads the stores as they are, for use by the chain itself under its lock
+ChainView BlockChain::liveView() const {
+    return ChainView(*this->blockStore, this->ledger, this->txdb, this->getTip());
+}
+
+/*
+    Pins the current tip for readers. Called with the chain lock held once a
+    block is fully applied or rolled back, so a published view never shows a
+    half-written block. Readers swap in the new view with an atomic load and
+    never wait on the chain lock; the old snapshots are released when the last
+    request holding them finishes.
+*/
+void BlockChain::publishView() {
+    std::shared_ptr<const ChainView> view = ChainView::pin(*this->blockStore, this->ledger, this->txdb, this->getTip());
+    std::atomic_store(&this->view, view);
+}
+
+std::shared_ptr<const ChainView> BlockChain::getView() const {
+    return std::atomic_load(&this->view);
 }
 
 void BlockChain::sync() {
     this->syncThread.push_back(std::thread(chain_sync, ref(*this)));
+    this->syncThread.push_back(std::thread(chain_maintenance, ref(*this)));
+}
+
+void BlockChain::setPruneDepth(uint32_t depth) {
+    if (depth > 0 && depth < MIN_PRUNE_DEPTH) {
+        Logger::logError("[PRUNE]", "Prune depth raised to the minimum of " + to_string(MIN_PRUNE_DEPTH) + " blocks");
+        depth = MIN_PRUNE_DEPTH;
+    }
+    this->pruneDepth = depth;
+    // relaxed durability recovers by replaying every block from genesis,
+    // re-applying the policy falls back to per-block
+    if (depth > 0 && this->durability.mode != DURABILITY_PER_BLOCK) this->setDurabilityPolicy(this->durability);
+}
+
+uint32_t BlockChain::getPruneDepth() const {
+    return this->pruneDepth;
+}
+
+uint32_t BlockChain::getPrunedHeight() const {
+    return this->blockStore->getPrunedHeight();
+}
+
+uint32_t BlockChain::pruneBlocks() {
+    // one batch per call, holding the chain lock so no block is popped or
+    // replaced underneath it
+    std::unique_lock<std::mutex> ul(lock);
+    uint32_t depth = this->pruneDepth;
+    uint32_t tip = this->numBlocks;
+    if (depth == 0 || tip <= depth) return 0;
+    uint32_t before = this->blockStore->getPrunedHeight();
+    uint32_t after = this->blockStore->pruneBlocks(tip - depth, PRUNE_BATCH_BLOCKS);
+    if (after > before && after % 10000 < PRUNE_BATCH_BLOCKS) Logger::logStatus("Pruned blocks up to " + to_string(after));
+    return after - before;
+}
+
+void BlockChain::setArchiveDepth(uint32_t depth) {
+    if (depth > 0 && depth < MIN_ARCHIVE_DEPTH) {
+        Logger::logError("[ARCHIVE]", "Archive depth raised to the minimum of " + to_string(MIN_ARCHIVE_DEPTH) + " blocks");
+        depth = MIN_ARCHIVE_DEPTH;
+    }
+    this->archiveDepth = depth;
+}
+
+uint32_t BlockChain::getArchiveDepth() const {
+    return this->archiveDepth;
+}
+
+uint32_t BlockChain::archiveBlocks() {
+    std::unique_lock<std::mutex> ul(lock);
+    uint32_t depth = this->archiveDepth;
+    uint32_t tip = this->numBlocks;
+    if (depth == 0 || tip <= depth) return 0;
+    uint32_t before = this->blockStore->getArchivedHeight();
+    uint32_t after = this->blockStore->archiveBlocks(tip - depth, ARCHIVE_BATCH_BLOCKS);
+    if (after > before && after % 10000 < ARCHIVE_BATCH_BLOCKS) Logger::logStatus("Archived blocks up to " + to_string(after));
+    return after - before;
 }
 
 const Ledger& BlockChain::getLedger() const{
@@ -215,27 +391,19 @@ uint32_t BlockChain::getCurrentMiningFee(uint64_t blockId) const{
     return PDN(amount);
 }
 double BlockChain::getSupply() const {
-  std::unique_lock<std::mutex> ul(lock);
-  double supply = 0;
-  double amount_offset=6647477.8490; // from previous fork
-  double amount = 50.0;
-  uint64_t blocks = numBlocks;
-  while (blocks >= 666666) {
-    supply += 666666 * amount;
-    amount *= (2.0 / 3.0);
-    blocks -= 666666;
-  }
-  supply += blocks * amount;
-  return supply + amount_offset;
-};
+    return this->getView()->getSupply();
+}
 
 Bigint BlockChain::getTotalWork() const {
     return this->totalWork;
 }
 
 Block BlockChain::getBlock(uint32_t blockId) const {
-    if (blockId <= 0 || blockId > this->numBlocks) throw std::runtime_error("Invalid block");
-    return this->blockStore->getBlock(blockId);
+    return this->liveView().getBlock(blockId);
+}
+
+SHA256Hash BlockChain::getBlockHash(uint32_t blockId) const {
+    return this->liveView().getBlockHash(blockId);
 }
 
 SHA256Hash BlockChain::getLastHash() const {
@@ -243,7 +411,7 @@ SHA256Hash BlockChain::getLastHash() const {
 }
 
 TransactionAmount BlockChain::getWalletValue(PublicWalletAddress addr) const{
-    return this->getLedger().getWalletValue(addr);
+    return this->liveView().getWalletValue(addr);
 }
 
 uint32_t computeDifficulty(int32_t currentDifficulty, int32_t elapsedTime, int32_t expectedTime) {
@@ -303,6 +471,97 @@ void BlockChain::setMemPool(std::shared_ptr<MemPool> memPool) {
     this->memPool = memPool;
 }
 
+void BlockChain::setWatchList(std::shared_ptr<WatchList> watchList) {
+    std::unique_lock<std::mutex> ul(this->lock);
+    // revert what the list logged for blocks an unclean shutdown discarded,
+    // newest first like popBlock would have
+    for (auto& block : this->discardedBlocks) {
+        if (block.getId() <= watchList->getHeight()) watchList->blockRemoved(block);
+    }
+    this->discardedBlocks.clear();
+    watchList->setHeight(this->numBlocks);
+    this->watchList = watchList;
+}
+
+void BlockChain::addBlockListener(BlockListener listener) {
+    std::unique_lock<std::mutex> ul(this->listenerLock);
+    this->blockListeners.push_back(listener);
+}
+
+void BlockChain::notifyBlockListeners(Block& block, bool added) {
+    std::unique_lock<std::mutex> ul(this->listenerLock);
+    for (auto& listener : this->blockListeners) {
+        listener(block, added);
+    }
+}
+
+void BlockChain::setDurabilityPolicy(DurabilityPolicy policy) {
+    if (this->pruneDepth > 0 && policy.mode != DURABILITY_PER_BLOCK) {
+        Logger::logError("[PRUNE]", "Pruning requires per-block durability, switching to per-block");
+        policy.mode = DURABILITY_PER_BLOCK;
+    }
+    std::unique_lock<std::mutex> ul(lock);
+    this->durability = policy;
+    if (this->chainStateDirty && !this->hasRelaxedDurability()) this->commitChainState();
+}
+
+DurabilityPolicy BlockChain::getDurabilityPolicy() const {
+    return this->durability;
+}
+
+bool BlockChain::hasRelaxedDurability() const {
+    switch(this->durability.mode) {
+        case DURABILITY_GROUP_COMMIT:
+            return true;
+        case DURABILITY_ASYNC_UNTIL_CAUGHT_UP:
+            return this->isSyncing;
+        default:
+            return false;
+    }
+}
+
+void BlockChain::beginChainUpdate() {
+    if (this->hasRelaxedDurability() && !this->chainStateDirty) {
+        this->blockStore->setDirty(true);
+        this->chainStateDirty = true;
+        this->lastCommitTime = getTimeMilliseconds();
+    }
+}
+
+void BlockChain::persistChainState() {
+    if (!this->hasRelaxedDurability()) {
+        if (this->chainStateDirty) {
+            this->commitChainState();
+        } else {
+            this->blockStore->setTotalWork(this->totalWork);
+            this->blockStore->setBlockCount(this->numBlocks);
+        }
+        return;
+    }
+    this->blockStore->setTotalWork(this->totalWork, false);
+    this->blockStore->setBlockCount(this->numBlocks, false);
+    this->blocksSinceCommit++;
+    if (this->durability.mode == DURABILITY_GROUP_COMMIT) {
+        if (this->blocksSinceCommit >= this->durability.groupCommitBlocks ||
+            getTimeMilliseconds() - this->lastCommitTime >= this->durability.groupCommitMs) {
+            this->commitChainState();
+        }
+    }
+}
+
+void BlockChain::commitChainState() {
+    // ledger & txdb must be on disk before the dirty marker is cleared, the
+    // synchronous marker write also flushes the buffered count & work above it
+    this->ledger.sync();
+    this->txdb.sync();
+    this->blockStore->setTotalWork(this->totalWork, false);
+    this->blockStore->setBlockCount(this->numBlocks, false);
+    this->blockStore->setDirty(false);
+    this->chainStateDirty = false;
+    this->blocksSinceCommit = 0;
+    this->lastCommitTime = getTimeMilliseconds();
+}
+
 uint8_t BlockChain::getDifficulty() const{
     return this->difficulty;
 }
@@ -311,70 +570,95 @@ ExecutionStatus BlockChain::verifyTransaction(const Transaction& t) {
     if (this->isSyncing) return IS_SYNCING;
     if (t.isFee()) return EXTRA_MINING_FEE;
     if (!t.signatureValid()) return INVALID_SIGNATURE;
-    
-    // Add nonce validation
-    if (!t.isFee()) {
-        PublicWalletAddress from = t.fromWallet();
-        uint64_t expectedNonce = this->getWalletNonce(from);
-        if (t.getNonce() != expectedNonce) {
-            return INVALID_NONCE;
-        }
+    vector<Transaction> transactions = { t };
+    vector<ExecutionStatus> statuses = { SUCCESS };
+    this->verifyTransactions(transactions, statuses);
+    return statuses[0];
+}
+
+// the chain side of verifyTransaction for a batch whose signatures were
+// already checked, entries not SUCCESS on the way in are left alone. admit
+// runs before the chain lock is released, so what it reads of the ledger
+// is still what the statuses were decided against
+void BlockChain::verifyTransactions(const vector<Transaction>& transactions, vector<ExecutionStatus>& statuses, std::function<void()> admit) {
+    if (this->isSyncing) {
+        for (auto& status : statuses) status = IS_SYNCING;
+        if (admit) admit();
+        return;
     }
-    
+
     // Atomic transaction verification
     std::unique_lock<std::mutex> ul(lock);
-    
-    // Take a snapshot of the current state
-    LedgerState snapshot = this->getLedger().getState();
-    
-    // Verify transaction
-    LedgerState deltas;
-    ExecutionStatus status = Executor::ExecuteTransaction(this->getLedger(), t, deltas);
-    
-    // Rollback changes
-    Executor::Rollback(this->getLedger(), deltas);
-    
-    // Check if transaction exists
-    if (this->txdb.hasTransaction(t)) {
-        status = EXPIRED_TRANSACTION;
+    for (size_t i = 0; i < transactions.size(); i++) {
+        if (statuses[i] != SUCCESS) continue;
+        const Transaction& t = transactions[i];
+        if (t.isFee()) {
+            statuses[i] = EXTRA_MINING_FEE;
+            continue;
+        }
+
+        // Add nonce validation
+        if (t.getNonce() != this->ledger.getWalletNonce(t.fromWallet())) {
+            statuses[i] = INVALID_NONCE;
+            continue;
+        }
+
+        // Verify transaction
+        LedgerState deltas;
+        ExecutionStatus status = Executor::ExecuteTransaction(this->getLedger(), t, deltas);
+
+        // Rollback changes
+        Executor::Rollback(this->getLedger(), deltas);
+
+        // Check if transaction exists
+        if (this->txdb.hasTransaction(t)) {
+            status = EXPIRED_TRANSACTION;
+        }
+        statuses[i] = status;
     }
-    
-    return status;
+    if (admit) admit();
 }
 
 vector<Transaction> BlockChain::getTransactionsForWallet(PublicWalletAddress addr) const{
-    vector<SHA256Hash> txids = this->blockStore->getTransactionsForWallet(addr);
-    vector<Transaction> ret;
-    // TODO: this is pretty inefficient -- might want direct index of transactions
-    for (auto txid : txids) {
-        uint32_t blockId = this->txdb.blockForTransactionId(txid);
-        if (blockId > 0)
-        {
-            Block b = this->blockStore->getBlock(blockId);
-            for (auto tx : b.getTransactions()) {
-                if (tx.hashContents() == txid) {
-                    ret.push_back(tx);
-                    break;
-                }
-            }
-        }
-    }
-    return std::move(ret);
+    return this->liveView().getTransactionsForWallet(addr);
+}
+
+vector<WalletTransactionRef> BlockChain::getWalletTransactionsBefore(PublicWalletAddress addr, uint32_t blockId, uint32_t index, size_t limit) const{
+    return this->liveView().getWalletTransactionsBefore(addr, blockId, index, limit);
+}
+
+vector<WalletTransactionRef> BlockChain::getWalletTransactionsAfter(PublicWalletAddress addr, uint32_t blockId, uint32_t index, size_t limit) const{
+    return this->liveView().getWalletTransactionsAfter(addr, blockId, index, limit);
+}
+
+TransactionLocation BlockChain::findTransactionLocation(SHA256Hash txid) const{
+    return this->liveView().findTransactionLocation(txid);
+}
+
+Transaction BlockChain::getTransaction(TransactionLocation loc) const{
+    return this->liveView().getTransaction(loc);
 }
 
 void BlockChain::popBlock() {
     Block last = this->getBlock(this->getBlockCount());
+    this->beginChainUpdate();
     Executor::RollbackBlock(last, this->ledger, this->txdb);
+    if (this->memPool != nullptr) this->memPool->revertBlock(last);
     this->numBlocks--;
     this->totalWork = removeWork(this->totalWork, last.getDifficulty());
-    this->blockStore->setTotalWork(this->totalWork);
-    this->blockStore->setBlockCount(this->numBlocks);
+    this->persistChainState();
     this->blockStore->removeBlockWalletTransactions(last);
+    this->blockStore->removeBalanceChanges(last);
+    this->blockStore->removeBlockTime(last.getId());
+    this->blockStore->removeBlockStats(last.getId());
+    if (this->watchList != nullptr) this->watchList->blockRemoved(last);
+    this->notifyBlockListeners(last, false);
 
     if (this->getBlockCount() > 1) {
         Block newLast = this->getBlock(this->getBlockCount());
         this->updateDifficulty();
         this->lastHash = newLast.getHash();
+        this->publishView();
     } else {
         this->resetChain();
     }
@@ -435,6 +719,7 @@ ExecutionStatus BlockChain::addBlock(Block& block) {
     if (block.getMerkleRoot() != computedRoot) return INVALID_MERKLE_ROOT;
     
     // Execute block transactions atomically
+    this->beginChainUpdate();
     LedgerState deltasFromBlock;
     ExecutionStatus status = Executor::ExecuteBlock(block, this->ledger, this->txdb, deltasFromBlock, this->getCurrentMiningFee(block.getId()));
     
@@ -446,16 +731,19 @@ ExecutionStatus BlockChain::addBlock(Block& block) {
         if (this->memPool != nullptr) {
             this->memPool->finishBlock(block);
         }
-        for(auto t : block.getTransactions()) {
-            this->txdb.insertTransaction(t, block.getId());
+        vector<Transaction>& transactions = block.getTransactions();
+        for(uint32_t i = 0; i < transactions.size(); i++) {
+            this->txdb.insertTransaction(transactions[i], block.getId(), i);
         }
-        this->blockStore->setBlock(block);
+        this->blockStore->setBlock(block, this->getBalanceChanges(deltasFromBlock));
         this->numBlocks++;
         this->totalWork = addWork(this->totalWork, block.getDifficulty());
-        this->blockStore->setTotalWork(this->totalWork);
-        this->blockStore->setBlockCount(this->numBlocks);
+        this->persistChainState();
         this->lastHash = block.getHash();
         this->updateDifficulty();
+        this->publishView();
+        if (this->watchList != nullptr) this->watchList->blockAdded(block);
+        this->notifyBlockListeners(block, true);
         Logger::logStatus("Added block " + to_string(block.getId()));
         Logger::logStatus("difficulty= " + to_string(block.getDifficulty()));
     }
@@ -463,6 +751,46 @@ ExecutionStatus BlockChain::addBlock(Block& block) {
     return status;
 }
 
+map<PublicWalletAddress, BalanceChange> BlockChain::getBalanceChanges(const LedgerState& deltas) const{
+    map<PublicWalletAddress, BalanceChange> changes;
+    for (auto it : deltas) {
+        if (it.second == 0) continue;
+        BalanceChange change;
+        change.delta = it.second;
+        change.balance = this->ledger.getWalletValue(it.first);
+        changes[it.first] = change;
+    }
+    return changes;
+}
+
+/*
+    Builds the balance history of a store written before it was kept. The
+    ledger only holds balances at the tip, so blocks are walked back from it
+    and each block's deltas are undone. History is available down to the
+    pruned height.
+*/
+void BlockChain::rebuildBalanceHistory() {
+    this->blockStore->clearBalanceHistory();
+    uint32_t floor = this->blockStore->getPrunedHeight();
+    Logger::logStatus("Rebuilding balance history for " + to_string(this->numBlocks - floor) + " blocks");
+    LedgerState later;
+    for (uint32_t blockId = this->numBlocks; blockId > floor; blockId--) {
+        if (blockId % 10000 == 0) Logger::logStatus("Rebuilding balance history, reached block: " + to_string(blockId));
+        Block block = this->blockStore->getBlock(blockId);
+        map<PublicWalletAddress, BalanceChange> changes;
+        for (auto it : Executor::BlockDeltas(block)) {
+            if (it.second == 0) continue;
+            BalanceChange change;
+            change.delta = it.second;
+            change.balance = this->ledger.getWalletValue(it.first) - later[it.first];
+            changes[it.first] = change;
+            later[it.first] += it.second;
+        }
+        this->blockStore->setBalanceChanges(blockId, changes);
+    }
+    this->blockStore->setBalanceHistoryHeight(floor);
+}
+
 map<string, uint64_t> BlockChain::getHeaderChainStats() const{
     return this->hosts.getHeaderChainStats();
 }
@@ -478,14 +806,16 @@ void BlockChain::recomputeLedger() {
         Block block = this->getBlock(i);
         ExecutionStatus addResult = Executor::ExecuteBlock(block, this->ledger, this->txdb, deltas, this->getCurrentMiningFee(i));
         // add all transactions to txdb:
-        for(auto t : block.getTransactions()) {
-            if (!t.isFee()) this->txdb.insertTransaction(t, block.getId());
+        vector<Transaction>& transactions = block.getTransactions();
+        for(uint32_t j = 0; j < transactions.size(); j++) {
+            if (!transactions[j].isFee()) this->txdb.insertTransaction(transactions[j], block.getId(), j);
         }
         if (addResult != SUCCESS) {
             Logger::logError(RED + "[FATAL]" + RESET, "Corrupt blockchain. Exiting. Please delete data dir and sync from scratch.");
             exit(-1);
         }
     }
+    this->publishView();
     this->isSyncing = false;
 }
 
@@ -501,7 +831,7 @@ ExecutionStatus BlockChain::startChainSync() {
         uint64_t toPop = 0;
         for(uint64_t i = 1; i <= this->numBlocks; i++) {
             SHA256Hash trustedHash = this->hosts.getBlockHash(bestHost, i);
-            SHA256Hash myHash = this->getBlock(i).getHash();
+            SHA256Hash myHash = this->getBlockHash(i);
             if (trustedHash != myHash) {
                 toPop = this->numBlocks - i + FORK_CHAIN_POP_COUNT;
                 break;
@@ -540,10 +870,12 @@ ExecutionStatus BlockChain::startChainSync() {
             }
             if (failure) {
                 Logger::logError("BlockChain::startChainSync", executionStatusAsString(status));
+                if (this->chainStateDirty) this->commitChainState();
                 this->isSyncing = false;
                 return status;
             }
         } catch (const std::exception &e) {
+            if (this->chainStateDirty) this->commitChainState();
             this->isSyncing = false;
             Logger::logError("BlockChain::startChainSync", "Failed to load block" + string(e.what()));
             return UNKNOWN_ERROR;
@@ -554,6 +886,7 @@ ExecutionStatus BlockChain::startChainSync() {
     stringstream s;
     s<<"Downloaded " << needed <<" blocks in " << d << " seconds from " + bestHost;
     if (needed > 1) Logger::logStatus(s.str());
+    if (this->chainStateDirty) this->commitChainState();
     this->isSyncing = false;
     return SUCCESS;
 }
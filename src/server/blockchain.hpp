@@ -6,6 +6,7 @@
 #include <map>
 #include <memory>
 #include <mutex>
+#include <functional>
 #include "../core/block.hpp"
 #include "../core/api.hpp"
 #include "../core/constants.hpp"
@@ -15,16 +16,38 @@
 #include "block_store.hpp"
 #include "ledger.hpp"
 #include "tx_store.hpp"
+#include "chain_view.hpp"
 using namespace std;
 
 class MemPool;
+class WatchList;
+
+enum DurabilityMode {
+    DURABILITY_PER_BLOCK,
+    DURABILITY_GROUP_COMMIT,
+    DURABILITY_ASYNC_UNTIL_CAUGHT_UP
+};
+
+struct DurabilityPolicy {
+    DurabilityMode mode = DURABILITY_PER_BLOCK;
+    uint32_t groupCommitBlocks = 1000;
+    uint32_t groupCommitMs = 5000;
+};
+
+// told about every block added to or popped from the chain, on the thread that changed it
+typedef std::function<void(Block& block, bool added)> BlockListener;
+
+DurabilityMode durabilityModeFromString(string mode);
+string durabilityModeAsString(DurabilityMode mode);
 
 class BlockChain {
     public:
-        BlockChain(HostManager& hosts, string ledgerPath="", string blockPath="", string txdbPath="");
+        BlockChain(HostManager& hosts, string ledgerPath="", string blockPath="", string txdbPath="", StorageBackends backends=StorageBackends());
         ~BlockChain();
         void sync();
+        std::shared_ptr<const ChainView> getView() const;
         Block getBlock(uint32_t blockId) const;
+        SHA256Hash getBlockHash(uint32_t blockId) const;
         Bigint getTotalWork() const ;
         uint8_t getDifficulty() const;
         uint32_t getBlockCount() const;
@@ -35,15 +58,31 @@ class BlockChain {
         Ledger& getLedger();
         uint32_t findBlockForTransaction(Transaction &t);
         uint32_t findBlockForTransactionId(SHA256Hash txid);
+        TransactionLocation findTransactionLocation(SHA256Hash txid) const;
+        Transaction getTransaction(TransactionLocation loc) const;
         ExecutionStatus addBlockSync(Block& block);
         ExecutionStatus verifyTransaction(const Transaction& t);
+        void verifyTransactions(const vector<Transaction>& transactions, vector<ExecutionStatus>& statuses, std::function<void()> admit = nullptr);
         std::pair<uint8_t*, size_t> getRaw(uint32_t blockId) const;
         BlockHeader getBlockHeader(uint32_t blockId) const;
         TransactionAmount getWalletValue(PublicWalletAddress addr) const;
         uint64_t getWalletNonce(const PublicWalletAddress& wallet) const;
         map<string, uint64_t> getHeaderChainStats() const;
         vector<Transaction> getTransactionsForWallet(PublicWalletAddress addr) const;
+        vector<WalletTransactionRef> getWalletTransactionsBefore(PublicWalletAddress addr, uint32_t blockId, uint32_t index, size_t limit) const;
+        vector<WalletTransactionRef> getWalletTransactionsAfter(PublicWalletAddress addr, uint32_t blockId, uint32_t index, size_t limit) const;
         void setMemPool(std::shared_ptr<MemPool> memPool);
+        void setWatchList(std::shared_ptr<WatchList> watchList);
+        void addBlockListener(BlockListener listener);
+        void setDurabilityPolicy(DurabilityPolicy policy);
+        DurabilityPolicy getDurabilityPolicy() const;
+        void setPruneDepth(uint32_t depth);
+        uint32_t getPruneDepth() const;
+        uint32_t getPrunedHeight() const;
+        uint32_t pruneBlocks();
+        void setArchiveDepth(uint32_t depth);
+        uint32_t getArchiveDepth() const;
+        uint32_t archiveBlocks();
         void initChain();
         void recomputeLedger();
         void resetChain();
@@ -56,6 +95,11 @@ class BlockChain {
         bool shutdown;
         HostManager& hosts;
         std::shared_ptr<MemPool> memPool;
+        std::shared_ptr<WatchList> watchList;
+        // uncounted blocks found after an unclean shutdown, newest first
+        vector<Block> discardedBlocks;
+        vector<BlockListener> blockListeners;
+        std::mutex listenerLock;
         int numBlocks;
         int retries;
         Bigint totalWork;
@@ -64,11 +108,29 @@ class BlockChain {
         TransactionStore txdb;
         SHA256Hash lastHash;
         int difficulty;
+        DurabilityPolicy durability;
+        bool chainStateDirty;
+        uint32_t blocksSinceCommit;
+        int64_t lastCommitTime;
+        uint32_t pruneDepth;
+        uint32_t archiveDepth;
+        std::shared_ptr<const ChainView> view;
+        ChainTip getTip() const;
+        ChainView liveView() const;
+        void publishView();
+        void notifyBlockListeners(Block& block, bool added);
+        bool hasRelaxedDurability() const;
+        void beginChainUpdate();
+        void persistChainState();
+        void commitChainState();
         void updateDifficulty();
+        map<PublicWalletAddress, BalanceChange> getBalanceChanges(const LedgerState& deltas) const;
+        void rebuildBalanceHistory();
         ExecutionStatus startChainSync();
         int targetBlockCount;
         mutable std::mutex lock;
         vector<std::thread> syncThread;
         map<int,SHA256Hash> checkpoints;
         friend void chain_sync(BlockChain& blockchain);
+        friend void chain_maintenance(BlockChain& blockchain);
 };
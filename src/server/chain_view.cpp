@@ -0,0 +1,176 @@
+#include <stdexcept>
+#include "chain_view.hpp"
+using namespace std;
+
+ChainView::ChainView(ChainTip tip) : blocks(NULL), ledger(NULL), txdb(NULL), tip(tip) {
+}
+
+ChainView::ChainView(const BlockStore& blocks, const Ledger& ledger, const TransactionStore& txdb, ChainTip tip) : blocks(&blocks), ledger(&ledger), txdb(&txdb), tip(tip) {
+}
+
+ChainView::~ChainView() {
+    // DataStore does not close itself, release the snapshots
+    if (this->pinnedBlocks) this->pinnedBlocks->closeDB();
+    if (this->pinnedTxdb) this->pinnedTxdb->closeDB();
+}
+
+std::shared_ptr<ChainView> ChainView::pin(const BlockStore& blocks, const Ledger& ledger, const TransactionStore& txdb, ChainTip tip) {
+    std::shared_ptr<ChainView> view(new ChainView(tip));
+    view->pinnedBlocks = std::make_unique<BlockStore>();
+    view->pinnedBlocks->openReadView(blocks);
+    view->pinnedLedger = std::make_unique<Ledger>();
+    view->pinnedLedger->openReadView(ledger);
+    view->pinnedTxdb = std::make_unique<TransactionStore>();
+    view->pinnedTxdb->openReadView(txdb);
+    view->blocks = view->pinnedBlocks.get();
+    view->ledger = view->pinnedLedger.get();
+    view->txdb = view->pinnedTxdb.get();
+    return view;
+}
+
+const ChainTip& ChainView::getTip() const {
+    return this->tip;
+}
+
+uint32_t ChainView::getBlockCount() const {
+    return this->tip.blockCount;
+}
+
+SHA256Hash ChainView::getLastHash() const {
+    return this->tip.lastHash;
+}
+
+Bigint ChainView::getTotalWork() const {
+    return this->tip.totalWork;
+}
+
+uint8_t ChainView::getDifficulty() const {
+    return this->tip.difficulty;
+}
+
+double ChainView::getSupply() const {
+    double supply = 0;
+    double amount_offset=6647477.8490; // from previous fork
+    double amount = 50.0;
+    uint64_t blocks = this->tip.blockCount;
+    while (blocks >= 666666) {
+        supply += 666666 * amount;
+        amount *= (2.0 / 3.0);
+        blocks -= 666666;
+    }
+    supply += blocks * amount;
+    return supply + amount_offset;
+}
+
+uint32_t ChainView::getPrunedHeight() const {
+    return this->blocks->getPrunedHeight();
+}
+
+Block ChainView::getBlock(uint32_t blockId) const {
+    if (blockId <= 0 || blockId > this->tip.blockCount) throw std::runtime_error("Invalid block");
+    if (blockId <= this->blocks->getPrunedHeight()) throw std::runtime_error("Block " + to_string(blockId) + " has been pruned");
+    return this->blocks->getBlock(blockId);
+}
+
+SHA256Hash ChainView::getBlockHash(uint32_t blockId) const {
+    // the hash only covers header fields, so it is available for pruned blocks too
+    vector<Transaction> transactions;
+    return Block(this->getBlockHeader(blockId), transactions).getHash();
+}
+
+BlockHeader ChainView::getBlockHeader(uint32_t blockId) const {
+    if (blockId <= 0 || blockId > this->tip.blockCount) throw std::runtime_error("Invalid block");
+    return this->blocks->getBlockHeader(blockId);
+}
+
+std::pair<uint8_t*, size_t> ChainView::getRaw(uint32_t blockId) const {
+    if (blockId <= 0 || blockId > this->tip.blockCount) throw std::runtime_error("Invalid block");
+    if (blockId <= this->blocks->getPrunedHeight()) throw std::runtime_error("Block " + to_string(blockId) + " has been pruned");
+    return this->blocks->getRawData(blockId);
+}
+
+uint32_t ChainView::getBlockAtTime(uint64_t timestamp) const {
+    return this->blocks->getBlockAtTime(timestamp, this->tip.blockCount);
+}
+
+BlockStats ChainView::getBlockStats(uint32_t blockId) const {
+    if (blockId <= 0 || blockId > this->tip.blockCount) throw std::runtime_error("Invalid block");
+    return this->blocks->getBlockStats(blockId);
+}
+
+BlockStats ChainView::getChainStats(uint32_t fromBlockId, uint32_t toBlockId) const {
+    if (fromBlockId <= 0 || fromBlockId > toBlockId || toBlockId > this->tip.blockCount) throw std::runtime_error("Invalid block range");
+    return this->blocks->getChainStats(fromBlockId, toBlockId);
+}
+
+bool ChainView::hasWallet(PublicWalletAddress addr) const {
+    return this->ledger->hasWallet(addr);
+}
+
+TransactionAmount ChainView::getWalletValue(PublicWalletAddress addr) const {
+    return this->ledger->getWalletValue(addr);
+}
+
+void ChainView::getWalletValues(const PublicWalletAddress* wallets, size_t count, WalletValue* values) const {
+    this->ledger->getWalletValues(wallets, count, values);
+}
+
+TransactionAmount ChainView::getWalletValueAt(PublicWalletAddress addr, uint32_t blockId) const {
+    if (blockId <= 0 || blockId > this->tip.blockCount) throw std::runtime_error("Invalid block");
+    if (blockId < this->blocks->getBalanceHistoryHeight()) throw std::runtime_error("Balance history before block " + to_string(this->blocks->getBalanceHistoryHeight()) + " is not available");
+    TransactionAmount balance;
+    if (this->blocks->getBalanceAt(addr, blockId, balance)) return balance;
+    // no change since blockId, the current balance still applies
+    return this->ledger->hasWallet(addr) ? this->ledger->getWalletValue(addr) : 0;
+}
+
+vector<Transaction> ChainView::getTransactionsForWallet(PublicWalletAddress addr) const {
+    vector<Transaction> ret;
+    for (auto ref : this->getWalletTransactionsBefore(addr, UINT32_MAX, UINT32_MAX, SIZE_MAX)) {
+        ret.push_back(this->blocks->getTransaction(ref.blockId, ref.index));
+    }
+    return std::move(ret);
+}
+
+vector<WalletTransactionRef> ChainView::getWalletTransactionsBefore(PublicWalletAddress addr, uint32_t blockId, uint32_t index, size_t limit) const {
+    // a block being added is indexed before it is counted, start below it
+    uint32_t tip = this->tip.blockCount;
+    if (blockId > tip) {
+        blockId = tip + 1;
+        index = 0;
+    }
+    return this->blocks->getWalletTransactionsBefore(addr, blockId, index, limit);
+}
+
+vector<WalletTransactionRef> ChainView::getWalletTransactionsAfter(PublicWalletAddress addr, uint32_t blockId, uint32_t index, size_t limit) const {
+    uint32_t tip = this->tip.blockCount;
+    vector<WalletTransactionRef> refs = this->blocks->getWalletTransactionsAfter(addr, blockId, index, limit);
+    vector<WalletTransactionRef> ret;
+    for (auto ref : refs) {
+        if (ref.blockId <= tip) ret.push_back(ref);
+    }
+    return std::move(ret);
+}
+
+TransactionLocation ChainView::findTransactionLocation(SHA256Hash txid) const {
+    TransactionLocation loc = this->txdb->locateTransaction(txid);
+    if (loc.blockId > this->tip.blockCount) loc.blockId = 0;
+    if (loc.blockId == 0 || loc.index != UNKNOWN_TX_INDEX) return loc;
+    if (loc.blockId <= this->blocks->getPrunedHeight()) return loc;
+    // txdb written before indices were stored, search the block for it
+    BlockHeader header = this->blocks->getBlockHeader(loc.blockId);
+    for (uint32_t i = 0; i < header.numTransactions; i++) {
+        if (this->blocks->getTransaction(loc.blockId, i).hashContents() == txid) {
+            loc.index = i;
+            return loc;
+        }
+    }
+    loc.blockId = 0;
+    return loc;
+}
+
+Transaction ChainView::getTransaction(TransactionLocation loc) const {
+    if (loc.blockId == 0 || loc.blockId > this->tip.blockCount) throw std::runtime_error("Invalid block");
+    if (loc.blockId <= this->blocks->getPrunedHeight()) throw std::runtime_error("Block " + to_string(loc.blockId) + " has been pruned");
+    return this->blocks->getTransaction(loc.blockId, loc.index);
+}
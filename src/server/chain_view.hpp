@@ -0,0 +1,65 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "../core/block.hpp"
+#include "../core/common.hpp"
+#include "block_store.hpp"
+#include "ledger.hpp"
+#include "tx_store.hpp"
+using namespace std;
+
+// the committed head of the chain a view answers for
+struct ChainTip {
+    uint32_t blockCount = 0;
+    SHA256Hash lastHash = NULL_SHA256_HASH;
+    Bigint totalWork = 0;
+    uint8_t difficulty = 0;
+};
+
+/*
+    Read access to the chain as of one tip. A live view reads the stores as
+    they are and is only meaningful under the chain lock. A pinned view opens
+    snapshots of all three stores while the chain is between blocks, so it
+    keeps answering for that tip without any locking while new blocks land.
+*/
+class ChainView {
+    public:
+        ChainView(const BlockStore& blocks, const Ledger& ledger, const TransactionStore& txdb, ChainTip tip);
+        ~ChainView();
+        static std::shared_ptr<ChainView> pin(const BlockStore& blocks, const Ledger& ledger, const TransactionStore& txdb, ChainTip tip);
+
+        const ChainTip& getTip() const;
+        uint32_t getBlockCount() const;
+        SHA256Hash getLastHash() const;
+        Bigint getTotalWork() const;
+        uint8_t getDifficulty() const;
+        double getSupply() const;
+        uint32_t getPrunedHeight() const;
+
+        Block getBlock(uint32_t blockId) const;
+        SHA256Hash getBlockHash(uint32_t blockId) const;
+        BlockHeader getBlockHeader(uint32_t blockId) const;
+        std::pair<uint8_t*, size_t> getRaw(uint32_t blockId) const;
+        uint32_t getBlockAtTime(uint64_t timestamp) const;
+        BlockStats getBlockStats(uint32_t blockId) const;
+        BlockStats getChainStats(uint32_t fromBlockId, uint32_t toBlockId) const;
+
+        bool hasWallet(PublicWalletAddress addr) const;
+        TransactionAmount getWalletValue(PublicWalletAddress addr) const;
+        void getWalletValues(const PublicWalletAddress* wallets, size_t count, WalletValue* values) const;
+        TransactionAmount getWalletValueAt(PublicWalletAddress addr, uint32_t blockId) const;
+        vector<Transaction> getTransactionsForWallet(PublicWalletAddress addr) const;
+        vector<WalletTransactionRef> getWalletTransactionsBefore(PublicWalletAddress addr, uint32_t blockId, uint32_t index, size_t limit) const;
+        vector<WalletTransactionRef> getWalletTransactionsAfter(PublicWalletAddress addr, uint32_t blockId, uint32_t index, size_t limit) const;
+        TransactionLocation findTransactionLocation(SHA256Hash txid) const;
+        Transaction getTransaction(TransactionLocation loc) const;
+    protected:
+        ChainView(ChainTip tip);
+        const BlockStore* blocks;
+        const Ledger* ledger;
+        const TransactionStore* txdb;
+        ChainTip tip;
+        std::unique_ptr<BlockStore> pinnedBlocks;
+        std::unique_ptr<Ledger> pinnedLedger;
+        std::unique_ptr<TransactionStore> pinnedTxdb;
+};
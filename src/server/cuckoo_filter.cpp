@@ -0,0 +1,187 @@
+#include <fstream>
+#include <cstdlib>
+#include <utility>
+#include "../external/murmurhash3/MurmurHash3.hpp"
+#include "cuckoo_filter.hpp"
+using namespace std;
+
+#define SLOTS_PER_BUCKET 4
+#define MIN_BUCKETS 1024
+#define MAX_KICKS 500
+#define FILTER_FILE_MAGIC 0x46434450
+
+CuckooFilter::CuckooFilter() {
+    this->reset(0);
+}
+
+void CuckooFilter::reset(size_t capacity) {
+    size_t buckets = MIN_BUCKETS;
+    while (buckets * SLOTS_PER_BUCKET < capacity) buckets *= 2;
+    this->numBuckets = buckets;
+    this->slots.assign(buckets * SLOTS_PER_BUCKET, 0);
+    this->count = 0;
+    this->seed = (uint32_t)std::rand();
+    this->hasVictim = false;
+    this->victimIndex = 0;
+    this->victimFingerprint = 0;
+}
+
+void CuckooFilter::locate(const SHA256Hash& key, size_t& index, uint16_t& fingerprint) const {
+    // keys are already uniform, the seeded hash keeps bucket placement unpredictable to peers
+    uint64_t h[2];
+    MurmurHash3_x64_128(key.data(), key.size(), this->seed, h);
+    index = h[0] & (this->numBuckets - 1);
+    fingerprint = (uint16_t)(h[1] & 0xFFFF);
+    if (fingerprint == 0) fingerprint = 1; // 0 marks an empty slot
+}
+
+size_t CuckooFilter::altIndex(size_t index, uint16_t fingerprint) const {
+    // XOR with a hash of the fingerprint is its own inverse, so either bucket leads to the other
+    return (index ^ ((uint64_t)fingerprint * 0x5bd1e995)) & (this->numBuckets - 1);
+}
+
+bool CuckooFilter::insertIntoBucket(size_t index, uint16_t fingerprint) {
+    uint16_t* bucket = this->slots.data() + index * SLOTS_PER_BUCKET;
+    for (int i = 0; i < SLOTS_PER_BUCKET; i++) {
+        if (bucket[i] == 0) {
+            bucket[i] = fingerprint;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CuckooFilter::bucketContains(size_t index, uint16_t fingerprint) const {
+    const uint16_t* bucket = this->slots.data() + index * SLOTS_PER_BUCKET;
+    for (int i = 0; i < SLOTS_PER_BUCKET; i++) {
+        if (bucket[i] == fingerprint) return true;
+    }
+    return false;
+}
+
+bool CuckooFilter::removeFromBucket(size_t index, uint16_t fingerprint) {
+    uint16_t* bucket = this->slots.data() + index * SLOTS_PER_BUCKET;
+    for (int i = 0; i < SLOTS_PER_BUCKET; i++) {
+        if (bucket[i] == fingerprint) {
+            bucket[i] = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CuckooFilter::insert(const SHA256Hash& key) {
+    if (this->hasVictim) return false;
+    size_t i1;
+    uint16_t fingerprint;
+    this->locate(key, i1, fingerprint);
+    size_t i2 = this->altIndex(i1, fingerprint);
+    if (this->insertIntoBucket(i1, fingerprint) || this->insertIntoBucket(i2, fingerprint)) {
+        this->count++;
+        return true;
+    }
+    // both buckets full: displace residents along the cuckoo path
+    size_t index = (std::rand() & 1) ? i1 : i2;
+    for (int kick = 0; kick < MAX_KICKS; kick++) {
+        size_t slot = index * SLOTS_PER_BUCKET + (std::rand() % SLOTS_PER_BUCKET);
+        std::swap(fingerprint, this->slots[slot]);
+        index = this->altIndex(index, fingerprint);
+        if (this->insertIntoBucket(index, fingerprint)) {
+            this->count++;
+            return true;
+        }
+    }
+    // hold on to the last displaced fingerprint so no member is ever lost
+    this->hasVictim = true;
+    this->victimIndex = index;
+    this->victimFingerprint = fingerprint;
+    this->count++;
+    return false;
+}
+
+bool CuckooFilter::contains(const SHA256Hash& key) const {
+    size_t i1;
+    uint16_t fingerprint;
+    this->locate(key, i1, fingerprint);
+    size_t i2 = this->altIndex(i1, fingerprint);
+    if (this->bucketContains(i1, fingerprint) || this->bucketContains(i2, fingerprint)) return true;
+    return this->hasVictim && this->victimFingerprint == fingerprint &&
+        (this->victimIndex == i1 || this->victimIndex == i2);
+}
+
+bool CuckooFilter::remove(const SHA256Hash& key) {
+    size_t i1;
+    uint16_t fingerprint;
+    this->locate(key, i1, fingerprint);
+    size_t i2 = this->altIndex(i1, fingerprint);
+    if (this->hasVictim && this->victimFingerprint == fingerprint &&
+        (this->victimIndex == i1 || this->victimIndex == i2)) {
+        this->hasVictim = false;
+        this->count--;
+        return true;
+    }
+    if (this->removeFromBucket(i1, fingerprint) || this->removeFromBucket(i2, fingerprint)) {
+        this->count--;
+        if (this->hasVictim) {
+            size_t alt = this->altIndex(this->victimIndex, this->victimFingerprint);
+            if (this->insertIntoBucket(this->victimIndex, this->victimFingerprint) ||
+                this->insertIntoBucket(alt, this->victimFingerprint)) {
+                this->hasVictim = false;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+bool CuckooFilter::isFull() const {
+    // past ~90% load insertions start failing, callers should rebuild larger
+    return this->hasVictim || this->count * 10 >= this->slots.size() * 9;
+}
+
+size_t CuckooFilter::size() const {
+    return this->count;
+}
+
+size_t CuckooFilter::capacity() const {
+    return this->slots.size();
+}
+
+bool CuckooFilter::save(string path) const {
+    if (this->hasVictim) return false;
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out.is_open()) return false;
+    uint32_t magic = FILTER_FILE_MAGIC;
+    uint64_t buckets = this->numBuckets;
+    uint64_t items = this->count;
+    out.write((const char*)&magic, sizeof(uint32_t));
+    out.write((const char*)&this->seed, sizeof(uint32_t));
+    out.write((const char*)&buckets, sizeof(uint64_t));
+    out.write((const char*)&items, sizeof(uint64_t));
+    out.write((const char*)this->slots.data(), this->slots.size() * sizeof(uint16_t));
+    return out.good();
+}
+
+bool CuckooFilter::load(string path) {
+    ifstream in(path, ios::binary);
+    if (!in.is_open()) return false;
+    uint32_t magic = 0;
+    uint32_t fileSeed = 0;
+    uint64_t buckets = 0;
+    uint64_t items = 0;
+    in.read((char*)&magic, sizeof(uint32_t));
+    in.read((char*)&fileSeed, sizeof(uint32_t));
+    in.read((char*)&buckets, sizeof(uint64_t));
+    in.read((char*)&items, sizeof(uint64_t));
+    if (!in || magic != FILTER_FILE_MAGIC) return false;
+    if (buckets < MIN_BUCKETS || (buckets & (buckets - 1)) != 0) return false;
+    vector<uint16_t> data(buckets * SLOTS_PER_BUCKET);
+    in.read((char*)data.data(), data.size() * sizeof(uint16_t));
+    if (!in) return false;
+    this->slots = std::move(data);
+    this->numBuckets = buckets;
+    this->count = items;
+    this->seed = fileSeed;
+    this->hasVictim = false;
+    return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "../core/common.hpp"
+using namespace std;
+
+/*
+    Approximate set of SHA256 hashes supporting insert and remove.
+    contains() never returns a false negative; false positives occur at a
+    rate of roughly 8 / 2^16 and must be confirmed against the real store.
+*/
+class CuckooFilter {
+    public:
+        CuckooFilter();
+        void reset(size_t capacity);
+        bool insert(const SHA256Hash& key);
+        bool contains(const SHA256Hash& key) const;
+        bool remove(const SHA256Hash& key);
+        bool isFull() const;
+        size_t size() const;
+        size_t capacity() const;
+        bool save(string path) const;
+        bool load(string path);
+    protected:
+        void locate(const SHA256Hash& key, size_t& index, uint16_t& fingerprint) const;
+        size_t altIndex(size_t index, uint16_t fingerprint) const;
+        bool insertIntoBucket(size_t index, uint16_t fingerprint);
+        bool bucketContains(size_t index, uint16_t fingerprint) const;
+        bool removeFromBucket(size_t index, uint16_t fingerprint);
+        vector<uint16_t> slots;
+        size_t numBuckets;
+        size_t count;
+        uint32_t seed;
+        bool hasVictim;
+        size_t victimIndex;
+        uint16_t victimFingerprint;
+};
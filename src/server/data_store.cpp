@@ -1,5 +1,5 @@
 #include "data_store.hpp"
-#include <thread>
+#include "leveldb/write_batch.h"
 
 #ifdef _WIN32
 #include <filesystem>
@@ -9,30 +9,44 @@
 
 DataStore::DataStore() {
     this->db = NULL;
+    this->backend = STORAGE_LEVELDB;
 }
 
 void DataStore::closeDB() {
     delete db;
+    db = NULL;
 }
 
 string DataStore::getPath() const{
     return this->path;
 }
 
+StorageBackend DataStore::getBackend() const {
+    return this->backend;
+}
+
 void DataStore::clear() {
-    leveldb::Iterator* it = db->NewIterator(leveldb::ReadOptions());
+    leveldb::Iterator* it = db->newIterator(leveldb::ReadOptions());
     for (it->SeekToFirst(); it->Valid(); it->Next()) {
         string key = it->key().ToString();
-        leveldb::Status status = db->Delete(leveldb::WriteOptions(), key);
+        leveldb::Status status = db->remove(leveldb::WriteOptions(), key);
         if(!status.ok()) throw std::runtime_error("Could not clear data store : " + status.ToString());
     }
     assert(it->status().ok()); 
     delete it;
 }
 
+void DataStore::sync() {
+    // an empty synchronous write flushes every earlier buffered write in the log
+    leveldb::WriteOptions write_options;
+    write_options.sync = true;
+    leveldb::WriteBatch batch;
+    leveldb::Status status = db->write(write_options, &batch);
+    if(!status.ok()) throw std::runtime_error("Could not sync DataStore db : " + status.ToString());
+}
+
 void DataStore::deleteDB() {
-    leveldb::Options options;
-    leveldb::Status status = leveldb::DestroyDB(this->path, options);
+    leveldb::Status status = StorageEngine::destroy(this->backend, this->path);
 #ifdef _WIN32
     filesystem::remove_all(this->path); 
 #else
@@ -41,14 +55,22 @@ void DataStore::deleteDB() {
     if(!status.ok()) throw std::runtime_error("Could not close DataStore db : " + status.ToString());
 }
 
-void DataStore::init(string path) {
+// reads the source's data as of now until closed, writes fail
+void DataStore::openReadView(const DataStore& source) {
+    if (this->db) {
+        this->closeDB();
+    }
+    this->path = source.path;
+    this->backend = source.backend;
+    this->db = new SnapshotStorageEngine(source.db);
+}
+
+void DataStore::init(string path, StorageBackend backend) {
     if (this->db) {
         this->closeDB();
     }
     this->path = path;
-    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-    leveldb::Options options;
-    options.create_if_missing = true;
-    leveldb::Status status = leveldb::DB::Open(options, path, &this->db);
+    this->backend = backend;
+    leveldb::Status status = StorageEngine::open(backend, path, &this->db);
     if(!status.ok()) throw std::runtime_error("Could not write DataStore db : " + status.ToString());
 }
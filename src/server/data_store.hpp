@@ -1,17 +1,22 @@
 #pragma once
 #include <string>
 #include "leveldb/db.h"
+#include "storage_engine.hpp"
 using namespace std;
 
 class DataStore {
     public:
         DataStore();
-        void init(string path);
+        void init(string path, StorageBackend backend = STORAGE_LEVELDB);
+        void openReadView(const DataStore& source);
         void deleteDB();
         void closeDB();
         void clear();
+        void sync();
         string getPath() const;
+        StorageBackend getBackend() const;
     protected:
-        leveldb::DB* db;
+        StorageEngine* db;
         string path;
+        StorageBackend backend;
 };
@@ -225,8 +225,10 @@ void rollbackLedger(Transaction t,  PublicWalletAddress& miner, Ledger& ledger)
 }
 
 void Executor::Rollback(Ledger& ledger, LedgerState& deltas) {
+    // a sender's delta is its withdrawal wrapped below zero, subtracting
+    // in the same wrapping arithmetic undoes it where withdraw would throw
     for(auto it : deltas) {
-        ledger.withdraw(it.first, it.second);
+        ledger.setWalletValue(it.first, ledger.getWalletValue(it.first) - it.second);
     }
 }
 
@@ -247,6 +249,22 @@ void Executor::RollbackBlock(Block& curr, Ledger& ledger, TransactionStore & txd
     }
 }
 
+// the net deltas ExecuteBlock records for an already valid block, without a ledger
+LedgerState Executor::BlockDeltas(Block& block) {
+    LedgerState deltas;
+    PublicWalletAddress miner;
+    for(auto t : block.getTransactions()) {
+        if (t.isFee()) miner = t.toWallet();
+    }
+    for(auto t : block.getTransactions()) {
+        deltas[t.toWallet()] += t.getAmount();
+        if (t.isFee() || block.getId() == 1) continue;
+        deltas[t.fromWallet()] -= t.getAmount() + t.getTransactionFee();
+        if (t.getTransactionFee() > 0) deltas[miner] += t.getTransactionFee();
+    }
+    return deltas;
+}
+
 ExecutionStatus Executor::ExecuteTransaction(Ledger& ledger, Transaction t,  LedgerState& deltas) {
     if (!t.isFee() && !t.signatureValid()) {
         return INVALID_SIGNATURE;
@@ -44,5 +44,6 @@ class Executor {
         static void Rollback(Ledger& ledger, LedgerState& deltas);
         static void RollbackBlock(Block& curr, Ledger& ledger, TransactionStore & txdb);
         static ExecutionStatus ExecuteBlock(Block& block, Ledger& ledger, TransactionStore & txdb, LedgerState& deltas, TransactionAmount miningFee);
+        static LedgerState BlockDeltas(Block& block);
         static ExecutionStatus ExecuteTransaction(Ledger& ledger, Transaction t, LedgerState& deltas);
 };
@@ -0,0 +1,120 @@
+#include <stdexcept>
+#include <unordered_set>
+#include "../core/helpers.hpp"
+#include "../external/murmurhash3/MurmurHash3.hpp"
+#include "iblt.hpp"
+using namespace std;
+
+#define IBLT_CHECKSUM_SEED 0x9747b28c
+
+IBLT::IBLT(size_t cells) {
+    // one partition per hash so a key never lands in the same cell twice
+    size_t partition = std::max<size_t>((cells + IBLT_HASH_COUNT - 1) / IBLT_HASH_COUNT, 1);
+    this->cells.resize(partition * IBLT_HASH_COUNT);
+}
+
+void IBLT::insert(uint64_t key) {
+    this->update(key, 1);
+}
+
+void IBLT::erase(uint64_t key) {
+    this->update(key, -1);
+}
+
+void IBLT::subtract(const IBLT& other) {
+    if (other.cells.size() != this->cells.size()) throw std::runtime_error("IBLT sizes differ");
+    for (size_t i = 0; i < this->cells.size(); i++) {
+        this->cells[i].count -= other.cells[i].count;
+        this->cells[i].keySum ^= other.cells[i].keySum;
+        this->cells[i].checkSum ^= other.cells[i].checkSum;
+    }
+}
+
+bool IBLT::decode(vector<uint64_t>& added, vector<uint64_t>& removed) const {
+    IBLT table = *this;
+    std::unordered_set<uint64_t> decoded;
+    vector<size_t> pure;
+    for (size_t i = 0; i < table.cells.size(); i++) {
+        if (table.isPure(table.cells[i])) pure.push_back(i);
+    }
+    // peeling a key off its cells can leave more of them with a single key
+    while (!pure.empty()) {
+        size_t i = pure.back();
+        pure.pop_back();
+        if (!table.isPure(table.cells[i])) continue;
+        uint64_t key = table.cells[i].keySum;
+        int32_t count = table.cells[i].count;
+        // an honest table yields every key once, a crafted one can make
+        // peeling a key leave it pure again with the opposite sign forever
+        if (!decoded.insert(key).second) return false;
+        if (count == 1) {
+            added.push_back(key);
+        } else {
+            removed.push_back(key);
+        }
+        table.update(key, -count);
+        for (uint32_t h = 0; h < IBLT_HASH_COUNT; h++) {
+            size_t j = table.cellIndex(key, h);
+            if (table.isPure(table.cells[j])) pure.push_back(j);
+        }
+    }
+    for (auto& cell : table.cells) {
+        if (cell.count != 0 || cell.keySum != 0 || cell.checkSum != 0) return false;
+    }
+    return true;
+}
+
+size_t IBLT::size() const {
+    return this->cells.size();
+}
+
+string IBLT::serialize() const {
+    string buffer(this->cells.size() * IBLT_CELL_BUFFER_SIZE, '\0');
+    char* ptr = &buffer[0];
+    for (auto& cell : this->cells) {
+        writeNetworkUint32(ptr, (uint32_t) cell.count);
+        writeNetworkUint64(ptr, cell.keySum);
+        writeNetworkUint64(ptr, cell.checkSum);
+    }
+    return buffer;
+}
+
+IBLT IBLT::deserialize(const char* buffer, size_t length) {
+    if (length == 0 || length % (IBLT_CELL_BUFFER_SIZE * IBLT_HASH_COUNT) != 0) throw std::runtime_error("Malformed IBLT");
+    IBLT table(length / IBLT_CELL_BUFFER_SIZE);
+    // the constructor rounds the cell count, never read past what was sent
+    if (length / IBLT_CELL_BUFFER_SIZE != table.cells.size()) throw std::runtime_error("Malformed IBLT");
+    for (auto& cell : table.cells) {
+        cell.count = (int32_t) readNetworkUint32(buffer);
+        cell.keySum = readNetworkUint64(buffer);
+        cell.checkSum = readNetworkUint64(buffer);
+    }
+    return table;
+}
+
+void IBLT::update(uint64_t key, int32_t delta) {
+    uint64_t check = checksum(key);
+    for (uint32_t h = 0; h < IBLT_HASH_COUNT; h++) {
+        Cell& cell = this->cells[this->cellIndex(key, h)];
+        cell.count += delta;
+        cell.keySum ^= key;
+        cell.checkSum ^= check;
+    }
+}
+
+size_t IBLT::cellIndex(uint64_t key, uint32_t hashIndex) const {
+    uint64_t h[2];
+    MurmurHash3_x64_128(&key, sizeof(key), hashIndex, h);
+    size_t partition = this->cells.size() / IBLT_HASH_COUNT;
+    return hashIndex * partition + h[0] % partition;
+}
+
+bool IBLT::isPure(const Cell& cell) const {
+    return (cell.count == 1 || cell.count == -1) && cell.checkSum == checksum(cell.keySum);
+}
+
+uint64_t IBLT::checksum(uint64_t key) {
+    uint64_t h[2];
+    MurmurHash3_x64_128(&key, sizeof(key), IBLT_CHECKSUM_SEED, h);
+    return h[0];
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "../core/common.hpp"
+using namespace std;
+
+#define IBLT_HASH_COUNT 3
+#define IBLT_CELL_BUFFER_SIZE 20
+
+/*
+    Invertible bloom lookup table over 64 bit keys. Subtracting the table
+    of one set from the table of another leaves only the symmetric
+    difference, which decodes as long as the table has roughly 1.5 cells
+    per differing key, no matter how large the sets themselves are.
+*/
+class IBLT {
+    public:
+        IBLT(size_t cells);
+        void insert(uint64_t key);
+        void erase(uint64_t key);
+        void subtract(const IBLT& other);
+        // keys only in this table and keys only in the subtracted one, false if the difference was too large
+        bool decode(vector<uint64_t>& added, vector<uint64_t>& removed) const;
+        size_t size() const;
+        string serialize() const;
+        static IBLT deserialize(const char* buffer, size_t length);
+    protected:
+        struct Cell {
+            int32_t count = 0;
+            uint64_t keySum = 0;
+            uint64_t checkSum = 0;
+        };
+        void update(uint64_t key, int32_t delta);
+        size_t cellIndex(uint64_t key, uint32_t hashIndex) const;
+        bool isPure(const Cell& cell) const;
+        static uint64_t checksum(uint64_t key);
+        vector<Cell> cells;
+};
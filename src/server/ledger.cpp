@@ -2,40 +2,60 @@
 #include <thread>
 #include "../core/crypto.hpp"
 #include "ledger.hpp"
+#include "leveldb/write_batch.h"
 using namespace std;
 
-Ledger::Ledger() : db(nullptr) {
+// sorted lookups step the iterator forward this many keys before seeking
+#define MULTI_GET_MAX_STEPS 8
+
+Ledger::Ledger() : db(nullptr), backend(STORAGE_LEVELDB) {
 }
 
 Ledger::~Ledger() {
     closeDB();
 }
 
-void Ledger::init(const std::string& path) {
+void Ledger::init(const std::string& path, StorageBackend backend) {
     dbPath = path;
-    leveldb::Options options;
-    options.create_if_missing = true;
-    leveldb::DB* raw_db = nullptr;
-    leveldb::Status status = leveldb::DB::Open(options, path, &raw_db);
+    this->backend = backend;
+    StorageEngine* raw_db = nullptr;
+    leveldb::Status status = StorageEngine::open(backend, path, &raw_db);
     if (!status.ok()) {
         throw std::runtime_error("Failed to open database: " + status.ToString());
     }
     db.reset(raw_db);
 }
 
+void Ledger::openReadView(const Ledger& source) {
+    dbPath = source.dbPath;
+    backend = source.backend;
+    db.reset(new SnapshotStorageEngine(source.db.get()));
+}
+
+StorageBackend Ledger::getBackend() const {
+    return this->backend;
+}
+
 void Ledger::closeDB() {
     db.reset();
 }
 
 void Ledger::deleteDB() {
     closeDB();
-    leveldb::Options options;
-    leveldb::Status status = leveldb::DestroyDB(dbPath, options);
+    leveldb::Status status = StorageEngine::destroy(backend, dbPath);
     if (!status.ok()) {
         throw std::runtime_error("Failed to delete database: " + status.ToString());
     }
 }
 
+void Ledger::sync() {
+    leveldb::WriteOptions write_options;
+    write_options.sync = true;
+    leveldb::WriteBatch batch;
+    leveldb::Status status = db->write(write_options, &batch);
+    if (!status.ok()) throw std::runtime_error("Sync failed: " + status.ToString());
+}
+
 leveldb::Slice walletToSlice(const PublicWalletAddress& w) {
     leveldb::Slice s2 = leveldb::Slice((const char*) w.data(), w.size());
     return s2;
@@ -48,7 +68,7 @@ leveldb::Slice amountToSlice(const TransactionAmount& t) {
 
 bool Ledger::hasWallet(const PublicWalletAddress& wallet) const{
     std::string value;
-    leveldb::Status status = db->Get(leveldb::ReadOptions(), walletToSlice(wallet), &value);
+    leveldb::Status status = db->get(leveldb::ReadOptions(), walletToSlice(wallet), &value);
     return (status.ok());
 }
 
@@ -58,17 +78,42 @@ void Ledger::createWallet(const PublicWalletAddress& wallet) {
 }
 
 void Ledger::setWalletValue(const PublicWalletAddress& wallet, TransactionAmount amount) {
-    leveldb::Status status = db->Put(leveldb::WriteOptions(), walletToSlice(wallet), amountToSlice(amount));
+    leveldb::Status status = db->put(leveldb::WriteOptions(), walletToSlice(wallet), amountToSlice(amount));
     if (!status.ok()) throw std::runtime_error("Write failed: " + status.ToString());
 }
 
 TransactionAmount Ledger::getWalletValue(const PublicWalletAddress& wallet) const{
     std::string value;
-    leveldb::Status status = db->Get(leveldb::ReadOptions(), walletToSlice(wallet), &value);
+    leveldb::Status status = db->get(leveldb::ReadOptions(), walletToSlice(wallet), &value);
     if(!status.ok()) throw std::runtime_error("Tried fetching wallet value for non-existant wallet");
     return *((TransactionAmount*)value.c_str());
 }
 
+/*
+    Looks up many wallets with a single iterator. The wallets must be sorted,
+    so each lookup continues from where the previous one stopped: nearby keys
+    are reached by stepping and only distant ones need a full seek.
+*/
+void Ledger::getWalletValues(const PublicWalletAddress* wallets, size_t count, WalletValue* values) const{
+    std::unique_ptr<leveldb::Iterator> it(db->newIterator(leveldb::ReadOptions()));
+    bool positioned = false;
+    for (size_t i = 0; i < count; i++) {
+        leveldb::Slice key = walletToSlice(wallets[i]);
+        int steps = 0;
+        while (positioned && it->Valid() && it->key().compare(key) < 0 && steps < MULTI_GET_MAX_STEPS) {
+            it->Next();
+            steps++;
+        }
+        if (!positioned || (it->Valid() && it->key().compare(key) < 0)) {
+            it->Seek(key);
+            positioned = true;
+        }
+        values[i].found = it->Valid() && it->key().compare(key) == 0;
+        values[i].balance = 0;
+        if (values[i].found) memcpy(&values[i].balance, it->value().data(), sizeof(TransactionAmount));
+    }
+}
+
 void Ledger::withdraw(const PublicWalletAddress& wallet, TransactionAmount amt) {
     TransactionAmount value = this->getWalletValue(wallet);
     if (amt > value) {
@@ -129,9 +174,9 @@ bool Ledger::atomicDepositIfValid(const PublicWalletAddress& wallet, Transaction
 
 void Ledger::clear() {
     std::lock_guard<std::mutex> lock(ledger_mutex);
-    leveldb::Iterator* it = db->NewIterator(leveldb::ReadOptions());
+    leveldb::Iterator* it = db->newIterator(leveldb::ReadOptions());
     for (it->SeekToFirst(); it->Valid(); it->Next()) {
-        db->Delete(leveldb::WriteOptions(), it->key());
+        db->remove(leveldb::WriteOptions(), it->key());
     }
     delete it;
 }
@@ -139,7 +184,7 @@ void Ledger::clear() {
 LedgerState Ledger::getState() const {
     std::lock_guard<std::mutex> lock(ledger_mutex);
     LedgerState state;
-    leveldb::Iterator* it = db->NewIterator(leveldb::ReadOptions());
+    leveldb::Iterator* it = db->newIterator(leveldb::ReadOptions());
     for (it->SeekToFirst(); it->Valid(); it->Next()) {
         PublicWalletAddress wallet;
         std::memcpy(wallet.data(), it->key().data(), wallet.size());
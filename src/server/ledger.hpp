@@ -1,23 +1,34 @@
 #pragma once
 #include "../core/common.hpp"
 #include <leveldb/db.h>
+#include "storage_engine.hpp"
 #include <mutex>
 #include <memory>
 #include <map>
 #include "../core/transaction.hpp"
 #include "ledger_state.hpp"
 
+// one result of a batched balance lookup, found is false for unknown wallets
+struct WalletValue {
+    bool found = false;
+    TransactionAmount balance = 0;
+};
+
 class Ledger {
     public:
         Ledger();
         ~Ledger();
-        void init(const std::string& dbPath);
+        void init(const std::string& dbPath, StorageBackend backend = STORAGE_LEVELDB);
+        void openReadView(const Ledger& source);
         void closeDB();
         void deleteDB();
+        void sync();
+        StorageBackend getBackend() const;
         bool hasWallet(const PublicWalletAddress& wallet) const;
         void createWallet(const PublicWalletAddress& wallet);
         void setWalletValue(const PublicWalletAddress& wallet, TransactionAmount amount);
         TransactionAmount getWalletValue(const PublicWalletAddress& wallet) const;
+        void getWalletValues(const PublicWalletAddress* wallets, size_t count, WalletValue* values) const;
         void withdraw(const PublicWalletAddress& wallet, TransactionAmount amt);
         void deposit(const PublicWalletAddress& wallet, TransactionAmount amt);
         void revertSend(const PublicWalletAddress& wallet, TransactionAmount amt);
@@ -34,8 +45,9 @@ class Ledger {
         void incrementWalletNonce(const PublicWalletAddress& wallet);
         
     protected:
-        std::unique_ptr<leveldb::DB> db;
+        std::unique_ptr<StorageEngine> db;
         std::string dbPath;
+        StorageBackend backend;
         mutable std::mutex ledger_mutex;
         std::map<PublicWalletAddress, TransactionAmount> balances;
         std::map<PublicWalletAddress, uint64_t> nonces;
@@ -0,0 +1,183 @@
+#include <chrono>
+#include "long_poll.hpp"
+using namespace std;
+
+static uint64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+LongPollQueue::LongPollQueue(uWS::Loop* loop) : LongPollQueue([loop](std::function<void()> job) { loop->defer(job); }) {
+}
+
+LongPollQueue::LongPollQueue(Defer defer) : defer(defer), pending(false), shutdown(false) {
+    this->ticker = std::thread([this]() {
+        while (!this->shutdown) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            if (!this->shutdown) this->defer([this]() {
+                this->expire();
+            });
+        }
+    });
+}
+
+LongPollQueue::~LongPollQueue() {
+    this->shutdown = true;
+    this->ticker.join();
+}
+
+void LongPollQueue::park(uint64_t timeoutMs, Waiter waiter) {
+    // answer straight away when there is already something to send
+    if (waiter(false)) return;
+    this->parked.insert(std::make_pair(nowMs() + timeoutMs, waiter));
+}
+
+void LongPollQueue::wake() {
+    // any number of wakes before the loop gets to it collapse into one poll
+    if (this->pending.exchange(true)) return;
+    this->defer([this]() {
+        this->pending = false;
+        this->poll();
+    });
+}
+
+size_t LongPollQueue::size() const {
+    return this->parked.size();
+}
+
+void LongPollQueue::poll() {
+    uint64_t now = nowMs();
+    for (auto it = this->parked.begin(); it != this->parked.end();) {
+        if (it->second(now >= it->first)) {
+            it = this->parked.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+void LongPollQueue::expire() {
+    // only the front of the deadline order is due, the rest wait for an event
+    uint64_t now = nowMs();
+    while (!this->parked.empty() && this->parked.begin()->first <= now) {
+        Waiter waiter = this->parked.begin()->second;
+        this->parked.erase(this->parked.begin());
+        waiter(true);
+    }
+}
+
+TxWaitQueue::TxWaitQueue(uWS::Loop* loop) : TxWaitQueue([loop](std::function<void()> job) { loop->defer(job); }) {
+}
+
+TxWaitQueue::TxWaitQueue(Defer defer) : defer(defer), waiting(0), shutdown(false) {
+    this->ticker = std::thread([this]() {
+        while (!this->shutdown) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            if (!this->shutdown) this->defer([this]() {
+                this->expire();
+            });
+        }
+    });
+}
+
+TxWaitQueue::~TxWaitQueue() {
+    this->shutdown = true;
+    this->ticker.join();
+}
+
+size_t TxWaitQueue::size() const {
+    return this->waiting;
+}
+
+void TxWaitQueue::park(SHA256Hash txid, uint32_t blockId, uint32_t confirmations, uint64_t timeoutMs, std::shared_ptr<bool> aborted, Reply reply) {
+    std::shared_ptr<Waiter> waiter = std::make_shared<Waiter>();
+    waiter->txid = txid;
+    waiter->blockId = 0;
+    waiter->confirmations = std::max<uint32_t>(confirmations, 1);
+    waiter->deadline = nowMs() + timeoutMs;
+    waiter->done = false;
+    waiter->aborted = aborted;
+    waiter->reply = reply;
+    this->waiting++;
+    this->byDeadline.insert(std::make_pair(waiter->deadline, waiter));
+    if (blockId > 0) {
+        this->confirm(waiter, blockId);
+    } else {
+        this->byTxid[txid].push_back(waiter);
+    }
+}
+
+void TxWaitQueue::confirm(std::shared_ptr<Waiter> waiter, uint32_t blockId) {
+    waiter->blockId = blockId;
+    this->byHeight.insert(std::make_pair(blockId + waiter->confirmations - 1, waiter));
+}
+
+void TxWaitQueue::answer(std::shared_ptr<Waiter> waiter) {
+    // a waiter sits in more than one index, the others drop it lazily
+    if (waiter->done) return;
+    waiter->done = true;
+    this->waiting--;
+    if (waiter->blockId == 0) {
+        // timed out before the transaction landed, stop matching its txid
+        auto it = this->byTxid.find(waiter->txid);
+        if (it != this->byTxid.end()) {
+            it->second.remove(waiter);
+            if (it->second.empty()) this->byTxid.erase(it);
+        }
+    }
+    if (!*waiter->aborted) waiter->reply();
+}
+
+void TxWaitQueue::blockAdded(Block& block) {
+    std::shared_ptr<vector<Transaction>> transactions = std::make_shared<vector<Transaction>>(block.getTransactions());
+    uint32_t blockId = block.getId();
+    this->defer([this, transactions, blockId]() {
+        // hashing every transaction is only worth it when someone is waiting,
+        // which is only known here: a request may park, or a popped block
+        // re-arm its waiters, between the block landing and this running
+        if (!this->byTxid.empty()) {
+            for (auto& t : *transactions) {
+                auto it = this->byTxid.find(t.hashContents());
+                if (it == this->byTxid.end()) continue;
+                for (auto& waiter : it->second) this->confirm(waiter, blockId);
+                this->byTxid.erase(it);
+            }
+        }
+        this->reachHeight(blockId);
+    });
+}
+
+void TxWaitQueue::blockRemoved(Block& block) {
+    uint32_t blockId = block.getId();
+    this->defer([this, blockId]() {
+        // transactions of the popped block are waited for again from scratch
+        for (auto it = this->byHeight.lower_bound(blockId); it != this->byHeight.end();) {
+            std::shared_ptr<Waiter> waiter = it->second;
+            if (waiter->done) {
+                it = this->byHeight.erase(it);
+            } else if (waiter->blockId == blockId) {
+                waiter->blockId = 0;
+                this->byTxid[waiter->txid].push_back(waiter);
+                it = this->byHeight.erase(it);
+            } else {
+                it++;
+            }
+        }
+    });
+}
+
+void TxWaitQueue::reachHeight(uint32_t blockCount) {
+    while (!this->byHeight.empty() && this->byHeight.begin()->first <= blockCount) {
+        std::shared_ptr<Waiter> waiter = this->byHeight.begin()->second;
+        this->byHeight.erase(this->byHeight.begin());
+        this->answer(waiter);
+    }
+}
+
+void TxWaitQueue::expire() {
+    uint64_t now = nowMs();
+    while (!this->byDeadline.empty() && this->byDeadline.begin()->first <= now) {
+        std::shared_ptr<Waiter> waiter = this->byDeadline.begin()->second;
+        this->byDeadline.erase(this->byDeadline.begin());
+        this->answer(waiter);
+    }
+}
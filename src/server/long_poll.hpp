@@ -0,0 +1,87 @@
+#pragma once
+#include <App.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include "../core/block.hpp"
+#include "../core/common.hpp"
+using namespace std;
+
+/*
+    Requests parked until something they wait on happens. Parking and
+    answering run on the event loop thread, the only thread allowed to touch
+    a response. wake() may be called from any thread and reruns every parked
+    waiter on the loop, so waiters should check cheaply whether there is
+    anything new. Waiters are kept in deadline order and a ticker hands the
+    loop only the ones whose deadline passed each second.
+*/
+class LongPollQueue {
+    public:
+        // answers the request when it can, returns true once it has ended it
+        typedef std::function<bool(bool timedOut)> Waiter;
+        // runs a job on the thread that parks and answers
+        typedef std::function<void(std::function<void()>)> Defer;
+        LongPollQueue(uWS::Loop* loop);
+        LongPollQueue(Defer defer);
+        ~LongPollQueue();
+        void park(uint64_t timeoutMs, Waiter waiter);
+        void wake();
+        size_t size() const;
+    protected:
+        void poll();
+        void expire();
+        Defer defer;
+        std::multimap<uint64_t, Waiter> parked;
+        std::atomic<bool> pending;
+        std::atomic<bool> shutdown;
+        std::thread ticker;
+};
+
+/*
+    Requests waiting for a transaction to reach a number of confirmations.
+    Waiters are found by txid when a block lands and by the height they are
+    satisfied at afterwards, so a block costs a lookup per transaction and
+    an idle waiter costs nothing. Block events may come from any thread, they
+    are handed to the event loop where parking and replies happen, and are
+    matched there so a waiter parked before the event runs is never missed.
+*/
+class TxWaitQueue {
+    public:
+        typedef std::function<void()> Reply;
+        // runs a job on the thread that parks and answers
+        typedef std::function<void(std::function<void()>)> Defer;
+        TxWaitQueue(uWS::Loop* loop);
+        TxWaitQueue(Defer defer);
+        ~TxWaitQueue();
+        // blockId is where the transaction already is, 0 if not in the chain yet
+        void park(SHA256Hash txid, uint32_t blockId, uint32_t confirmations, uint64_t timeoutMs, std::shared_ptr<bool> aborted, Reply reply);
+        void blockAdded(Block& block);
+        void blockRemoved(Block& block);
+        size_t size() const;
+    protected:
+        struct Waiter {
+            SHA256Hash txid;
+            uint32_t blockId;
+            uint32_t confirmations;
+            uint64_t deadline;
+            bool done;
+            std::shared_ptr<bool> aborted;
+            Reply reply;
+        };
+        void confirm(std::shared_ptr<Waiter> waiter, uint32_t blockId);
+        void answer(std::shared_ptr<Waiter> waiter);
+        void reachHeight(uint32_t blockCount);
+        void expire();
+        Defer defer;
+        std::unordered_map<SHA256Hash, std::list<std::shared_ptr<Waiter>>, SHA256Hasher> byTxid;
+        std::multimap<uint32_t, std::shared_ptr<Waiter>> byHeight;
+        std::multimap<uint64_t, std::shared_ptr<Waiter>> byDeadline;
+        size_t waiting;
+        std::atomic<bool> shutdown;
+        std::thread ticker;
+};
@@ -9,6 +9,11 @@
 #include <cstdlib>
 #include <thread>
 #include <chrono>
+#include <ctime>
+#include <unordered_set>
+#include <algorithm>
+#include <fstream>
+#include <filesystem>
 #include "../core/logger.hpp"
 #include "../core/api.hpp"
 #include "../core/helpers.hpp"
@@ -16,11 +21,43 @@
 #include "blockchain.hpp"
 
 #define TX_BRANCH_FACTOR 10
-#define MIN_FEE_TO_ENTER_MEMPOOL 1
+#define ADMISSION_MIN_CHUNK 64
+// transactions per announced batch, their bodies stay well under what /add_transaction accepts
+#define RELAY_MAX_BATCH 10000
+// relay rounds a pending transaction gets before it is left to reconciliation
+#define RELAY_MAX_ATTEMPTS 3
+
+static uint64_t expiresAt(const Transaction& t) {
+    return t.getTimestamp() + Transaction::TRANSACTION_EXPIRY + 1;
+}
+
+// a pending transaction and its entries in the txid index, its sender queue, the head and tail sets and the expiry wheel
+const size_t MemPool::PENDING_TRANSACTION_BYTES = sizeof(SHA256Hash) + sizeof(PendingTransaction) + sizeof(SenderSlot) + 2 * sizeof(SHA256Hash) + 2 * sizeof(FeeKey) + 16 * sizeof(void*);
+
+size_t feeHistogramBucket(TransactionAmount fee) {
+    if (fee == 0) return 0;
+    return 63 - __builtin_clzll(fee);
+}
+
+uint64_t shortTxid(const SHA256Hash& txid) {
+    const char* ptr = (const char*) txid.data();
+    return readNetworkUint64(ptr);
+}
 
 MemPool::MemPool(HostManager &h, BlockChain &b) : hosts(h), blockchain(b)
 {
     shutdown = false;
+    arrivals = 0;
+    version = 0;
+    savedVersion = 0;
+    snapshotVersion = 0;
+    expiryMinute = getCurrentTime() / 60;
+    usedBytes = 0;
+    maxBytes = MEMPOOL_DEFAULT_MAX_BYTES;
+    raisedMinFee = MIN_FEE_TO_ENTER_MEMPOOL;
+    minFeeRaisedAt = 0;
+    feeHistogram.fill(0);
+    verifiers = std::make_unique<WorkerPool>(std::thread::hardware_concurrency());
 }
 
 MemPool::~MemPool()
@@ -34,11 +71,6 @@ MemPool::~MemPool()
 }
 
 void MemPool::mempool_sync() {
-
-    const int MAX_RETRIES = 3;
-    std::map<std::string, std::chrono::system_clock::time_point> failedNeighbors;
-    std::mutex failedNeighborsMutex;
-
     while (!shutdown)
     {
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
@@ -54,51 +86,12 @@ void MemPool::mempool_sync() {
             toSend.clear();
         }
 
-        std::vector<Transaction> invalidTxs;
-        {
-            std::unique_lock<std::mutex> lock(mempool_mutex);
-            for (auto it = transactionQueue.begin(); it != transactionQueue.end();)
-            {
-                try
-                {
-                    ExecutionStatus status = blockchain.verifyTransaction(*it);
-                    if (status != SUCCESS)
-                    {
-                        invalidTxs.push_back(*it);
-                        it = transactionQueue.erase(it);
-                    }
-                    else
-                    {
-                        ++it;
-                    }
-                }
-                catch (const std::exception &e)
-                {
-                    std::cout << "Caught exception: " << e.what() << '\n';
-                    invalidTxs.push_back(*it);
-                    it = transactionQueue.erase(it);
-                }
-            }
-        }
-
-        if (transactionQueue.empty())
+        // pending transactions are revalidated as blocks change balances, see finishBlock
+        if (this->size() == 0)
         {
             continue;
         }
 
-        auto now = std::chrono::system_clock::now();
-        for (auto it = failedNeighbors.begin(); it != failedNeighbors.end();)
-        {
-            if ((now - it->second) > std::chrono::hours(24))
-            {
-                it = failedNeighbors.erase(it);
-            }
-            else
-            {
-                ++it;
-            }
-        }
-
         std::set<std::string> neighbors = hosts.sampleFreshHosts(TX_BRANCH_FACTOR);
         std::map<std::string, int> neighborHeights; // Store block heights for neighbors
 
@@ -107,6 +100,11 @@ void MemPool::mempool_sync() {
             int height = hosts.getBlockHeightFromPeer(neighbor);
             neighborHeights[neighbor] = height;
         }
+        if (neighbors.empty())
+        {
+            retryRelay(txs);
+            continue;
+        }
 
         auto maxIter = std::max_element(neighborHeights.begin(), neighborHeights.end(),
             [](const auto &lhs, const auto &rhs) {
@@ -122,69 +120,136 @@ void MemPool::mempool_sync() {
                 }
         }
 
-        std::vector<std::future<bool>> sendResults;
-        for (auto neighbor : neighbors) {
-            if (failedNeighbors.find(neighbor) != failedNeighbors.end())
-            {
-                continue;
-            }
-
-             for (const auto& tx : txs) {
-                sendResults.push_back(std::async(std::launch::async, [this, &neighbor, &tx, &failedNeighbors, &failedNeighborsMutex]() -> bool {
-                for (int retry = 0; retry < MAX_RETRIES; ++retry) {
-                    try {
-                        sendTransaction(neighbor, tx);
-                        return true;
-                     } catch (...) {
-                        Logger::logError("Failed to send tx to ", neighbor);
-                    }
-                }
-                Logger::logStatus("MemPool::mempool_sync: Skipped sending to " + neighbor);
-                
-                // Lock the mutex only for the duration of modifying the map
-                {
-                    std::lock_guard<std::mutex> lock(failedNeighborsMutex);
-                    failedNeighbors[neighbor] = std::chrono::system_clock::now();
-                }
-                
-                return false;
-                }));
-            }
+        for (size_t start = 0; start < txs.size(); start += RELAY_MAX_BATCH)
+        {
+            size_t end = std::min(txs.size(), start + RELAY_MAX_BATCH);
+            relayBatch(neighbors, std::vector<Transaction>(txs.begin() + start, txs.begin() + end));
         }
+    }
+}
 
-            // Logging invalidTxs
-            for (const auto& tx : invalidTxs) {
-            Logger::logError("MemPool::mempool_sync", "A transaction is invalid and removed from the queue.");
-            }
+/*
+    Announces the batch's txids to every neighbor, each answers with the ones
+    it is missing and only those are sent to it. Peers that predate
+    /tx_inventory answer 404 and get the whole batch pushed instead. A
+    neighbor counts as reached once it has everything it asked for. If no
+    neighbor was reached the transactions still pending are retried.
+*/
+void MemPool::relayBatch(const std::set<std::string>& neighbors, std::vector<Transaction> batch)
+{
+    struct Delivery {
+        std::mutex lock;
+        size_t remaining = 0;
+        bool delivered = false;
+        std::vector<Transaction> transactions;
+        std::unordered_map<SHA256Hash, size_t, SHA256Hasher> byTxid;
+    };
+    std::shared_ptr<Delivery> delivery = std::make_shared<Delivery>();
+    std::shared_ptr<std::string> inventory = std::make_shared<std::string>(batch.size() * sizeof(SHA256Hash), '\0');
+    for (size_t i = 0; i < batch.size(); i++) {
+        SHA256Hash txid = batch[i].hashContents();
+        memcpy(&(*inventory)[i * sizeof(SHA256Hash)], txid.data(), sizeof(SHA256Hash));
+        delivery->byTxid[txid] = i;
+    }
+    delivery->transactions = std::move(batch);
+    delivery->remaining = 1;
 
-        bool all_sent = true;
-        for (auto &future : sendResults)
+    auto finish = [this, delivery](bool delivered) {
         {
-            if (!future.get())
-            {
-                all_sent = false;
-            }
+            std::unique_lock<std::mutex> ul(delivery->lock);
+            delivery->delivered = delivery->delivered || delivered;
+            if (--delivery->remaining > 0) return;
         }
-
-        if (!all_sent)
-        {
+        if (delivery->delivered) {
             std::unique_lock<std::mutex> lock(toSend_mutex);
-            for (const auto &tx : txs)
-            {
-                toSend.push_back(tx);
+            for (auto& it : delivery->byTxid) relayAttempts.erase(it.first);
+        } else {
+            retryRelay(delivery->transactions);
+        }
+    };
+    // posts the body to the neighbor and finishes its part of the batch with the result
+    auto push = [this, finish](const std::string& neighbor, std::shared_ptr<std::string> body) {
+        bool posted = relay->post(neighbor, "/add_transaction", body, [finish](bool delivered, long status, const std::string& response) {
+            finish(delivered);
+        });
+        if (!posted) finish(false);
+    };
+
+    for (auto& neighbor : neighbors) {
+        {
+            std::unique_lock<std::mutex> ul(delivery->lock);
+            delivery->remaining++;
+        }
+        bool posted = relay->post(neighbor, "/tx_inventory", inventory, [neighbor, delivery, finish, push](bool delivered, long status, const std::string& response) {
+            std::shared_ptr<std::string> body = std::make_shared<std::string>();
+            auto append = [&body](const Transaction& t) {
+                TransactionInfo info = t.serialize();
+                body->resize(body->size() + TRANSACTIONINFO_BUFFER_SIZE);
+                transactionInfoToBuffer(info, &(*body)[body->size() - TRANSACTIONINFO_BUFFER_SIZE]);
+            };
+            if (status == 404) {
+                for (auto& t : delivery->transactions) append(t);
+                push(neighbor, body);
+                return;
+            }
+            if (!delivered || response.size() % sizeof(SHA256Hash) != 0) {
+                finish(false);
+                return;
+            }
+            for (size_t offset = 0; offset < response.size(); offset += sizeof(SHA256Hash)) {
+                SHA256Hash txid;
+                memcpy(txid.data(), response.data() + offset, sizeof(SHA256Hash));
+                auto it = delivery->byTxid.find(txid);
+                if (it != delivery->byTxid.end()) append(delivery->transactions[it->second]);
             }
+            // a neighbor that already has every transaction is reached as well
+            if (body->empty()) {
+                finish(true);
+            } else {
+                push(neighbor, body);
+            }
+        });
+        // a refused post is a neighbor not reached
+        if (!posted) finish(false);
+    }
+    // drop the count that held the batch open while posting
+    finish(false);
+}
+
+// puts the transactions still pending back on toSend, until they run out of attempts
+void MemPool::retryRelay(const std::vector<Transaction>& transactions)
+{
+    std::vector<SHA256Hash> txids(transactions.size());
+    for (size_t i = 0; i < transactions.size(); i++) txids[i] = transactions[i].hashContents();
+    std::vector<bool> pending(transactions.size(), false);
+    {
+        std::unique_lock<std::mutex> lock(mempool_mutex);
+        for (size_t i = 0; i < txids.size(); i++) pending[i] = pendingByTxid.count(txids[i]) > 0;
+    }
+    size_t dropped = 0;
+    std::unique_lock<std::mutex> lock(toSend_mutex);
+    for (size_t i = 0; i < txids.size(); i++) {
+        if (pending[i] && ++relayAttempts[txids[i]] < RELAY_MAX_ATTEMPTS) {
+            toSend.push_back(transactions[i]);
+            continue;
         }
+        if (pending[i]) dropped++;
+        relayAttempts.erase(txids[i]);
     }
+    if (dropped > 0) Logger::logStatus("MemPool: gave up relaying " + to_string(dropped) + " transactions, no neighbor took them");
 }
 
 void MemPool::sync()
 {
+    relay = std::make_unique<PeerRelay>();
     syncThread.push_back(std::thread(&MemPool::mempool_sync, this));
     cleanupThread.push_back(std::thread([this]() {
+        uint64_t ticks = 0;
         while (!this->shutdown) {
-            std::this_thread::sleep_for(std::chrono::seconds(60));
+            std::this_thread::sleep_for(std::chrono::seconds(1));
             if (!this->shutdown) {
                 cleanupExpiredTransactions();
+                if (++ticks % MEMPOOL_SAVE_INTERVAL == 0) save();
             }
         }
     }));
@@ -193,134 +258,561 @@ void MemPool::sync()
 bool MemPool::hasTransaction(Transaction t)
 {
     std::unique_lock<std::mutex> lock(mempool_mutex);
-    return transactionQueue.count(t) > 0;
+    return pendingByTxid.count(t.hashContents()) > 0;
 }
 
 ExecutionStatus MemPool::addTransaction(Transaction t)
 {
-    std::unique_lock<std::mutex> lock(mempool_mutex);
+    std::vector<Transaction> transactions = { t };
+    return addTransactions(transactions)[0];
+}
 
-    // Check if transaction is expired
-    if (t.isExpired()) {
-        return EXPIRED_TRANSACTION;
+/*
+    Admits a batch in two passes: signatures are checked in parallel
+    without any lock, then the chain checks run under one chain lock and,
+    still holding it, the mempool checks and inserts under the mempool
+    lock. No block can be applied between a balance being read and the
+    transaction it covered entering the pool. Chain lock before mempool
+    lock is the order addBlock takes them in for finishBlock.
+*/
+std::vector<ExecutionStatus> MemPool::addTransactions(const std::vector<Transaction>& transactions)
+{
+    size_t count = transactions.size();
+    std::vector<ExecutionStatus> statuses(count, SUCCESS);
+    std::vector<SHA256Hash> txids(count);
+    auto checkRange = [this, &transactions, &statuses, &txids](size_t start, size_t end) {
+        for (size_t i = start; i < end; i++) {
+            const Transaction& t = transactions[i];
+            txids[i] = t.hashContents();
+            ExecutionStatus seenStatus;
+            if (seen.lookup(txids[i], seenStatus)) {
+                // judged before, skip the signature and chain work
+                statuses[i] = seenStatus == SUCCESS ? ALREADY_IN_QUEUE : seenStatus;
+            } else if (t.isExpired()) {
+                statuses[i] = EXPIRED_TRANSACTION;
+            } else if (!t.isFee() && !t.signatureValid()) {
+                statuses[i] = INVALID_SIGNATURE;
+            }
+        }
+    };
+    size_t workers = std::min<size_t>(verifiers->threadCount(), (count + ADMISSION_MIN_CHUNK - 1) / ADMISSION_MIN_CHUNK);
+    if (workers <= 1) {
+        checkRange(0, count);
+    } else {
+        size_t chunk = (count + workers - 1) / workers;
+        std::vector<std::future<void>> checks;
+        for (size_t start = 0; start < count; start += chunk) {
+            auto check = std::make_shared<std::packaged_task<void()>>(std::bind(checkRange, start, std::min(count, start + chunk)));
+            checks.push_back(check->get_future());
+            if (!verifiers->submit([check]() { (*check)(); })) (*check)();
+        }
+        for (auto& check : checks) check.get();
     }
 
-    // Check if transaction is already in queue
-    if (transactionQueue.count(t) > 0) {
-        return ALREADY_IN_QUEUE;
+    std::vector<Transaction> admitted;
+    blockchain.verifyTransactions(transactions, statuses, [&]() {
+        std::unique_lock<std::mutex> lock(mempool_mutex);
+        const Ledger& ledger = blockchain.getLedger();
+        TransactionAmount minFee = currentMinFee();
+        for (size_t i = 0; i < count; i++) {
+            const Transaction& t = transactions[i];
+            if (pendingByTxid.count(txids[i]) > 0) {
+                statuses[i] = ALREADY_IN_QUEUE;
+                continue;
+            }
+            // verdicts that can not change are remembered, the rest may pass once balances or fees move.
+            // the txid does not cover the signature, a forged copy must not shadow the signed original
+            if (statuses[i] == EXTRA_MINING_FEE || statuses[i] == EXPIRED_TRANSACTION) {
+                seen.record(txids[i], statuses[i]);
+            }
+            if (statuses[i] != SUCCESS) continue;
+            if (t.getFee() < minFee) {
+                statuses[i] = TRANSACTION_FEE_TOO_LOW;
+                continue;
+            }
+
+            // the sender has to cover everything it already has pending as well
+            if (!t.isFee()) {
+                auto sender = senders.find(t.fromWallet());
+                TransactionAmount pendingOutgoing = sender == senders.end() ? 0 : sender->second.outgoing;
+                TransactionAmount balance = ledger.hasWallet(t.fromWallet()) ? ledger.getWalletValue(t.fromWallet()) : 0;
+                if (balance < t.getAmount() + t.getFee() + pendingOutgoing) {
+                    statuses[i] = BALANCE_TOO_LOW;
+                    continue;
+                }
+            }
+
+            if (!makeRoom(t.getFee())) {
+                statuses[i] = TRANSACTION_FEE_TOO_LOW;
+                continue;
+            }
+            insertPending(t, txids[i]);
+            seen.record(txids[i], SUCCESS);
+            admitted.push_back(t);
+            // evicting may have raised the floor for the rest of the batch
+            minFee = currentMinFee();
+        }
+    });
+
+    if (!admitted.empty()) {
+        std::unique_lock<std::mutex> lock(toSend_mutex);
+        toSend.insert(toSend.end(), admitted.begin(), admitted.end());
     }
+    return statuses;
+}
 
-    // Check if transaction fee is sufficient
-    if (t.getFee() < MIN_FEE_TO_ENTER_MEMPOOL) {
-        return TRANSACTION_FEE_TOO_LOW;
+// the announced txids this node wants sent to it
+std::vector<SHA256Hash> MemPool::requestTransactions(const std::vector<SHA256Hash>& txids)
+{
+    std::vector<SHA256Hash> wanted;
+    uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    for (const auto& txid : txids) {
+        if (seen.request(txid, now)) wanted.push_back(txid);
     }
+    return wanted;
+}
 
-    // Atomic balance check and transaction verification
-    if (!t.isFee()) {
-        // Get a snapshot of the current state
-        TransactionAmount totalRequired = t.getAmount() + t.getFee();
-        TransactionAmount currentBalance = blockchain.getWalletValue(t.fromWallet());
-        TransactionAmount pendingOutgoing = mempoolOutgoing[t.fromWallet()];
-        
-        // Verify transaction first
-        ExecutionStatus status = blockchain.verifyTransaction(t);
-        if (status != SUCCESS) {
-            return status;
-        }
+// evicts cheaper transactions until one more fits, mempool_mutex held
+bool MemPool::makeRoom(TransactionAmount fee)
+{
+    while (usedBytes + PENDING_TRANSACTION_BYTES > maxBytes) {
+        if (senderTails.empty() || senderTails.begin()->first >= fee) return false;
+        TransactionAmount evictedFee = senderTails.begin()->first;
+        erasePending(senderTails.begin()->second);
+        // whatever was just outbid should not get straight back in
+        TransactionAmount floor = std::max(currentMinFee(), evictedFee + 1);
+        raisedMinFee = floor;
+        minFeeRaisedAt = std::time(0);
+    }
+    return true;
+}
+
+TransactionAmount MemPool::currentMinFee() const
+{
+    if (raisedMinFee <= MIN_FEE_TO_ENTER_MEMPOOL) return MIN_FEE_TO_ENTER_MEMPOOL;
+    uint64_t halvings = (std::time(0) - minFeeRaisedAt) / MEMPOOL_MIN_FEE_HALFLIFE;
+    if (halvings >= 64) return MIN_FEE_TO_ENTER_MEMPOOL;
+    return MIN_FEE_TO_ENTER_MEMPOOL + ((raisedMinFee - MIN_FEE_TO_ENTER_MEMPOOL) >> halvings);
+}
+
+TransactionAmount MemPool::getMinFee() const
+{
+    std::unique_lock<std::mutex> lock(mempool_mutex);
+    return currentMinFee();
+}
+
+void MemPool::setMaxBytes(size_t maxBytes)
+{
+    std::unique_lock<std::mutex> lock(mempool_mutex);
+    this->maxBytes = maxBytes;
+    // shrinking the budget evicts right away
+    while (usedBytes > maxBytes && !senderTails.empty()) {
+        erasePending(senderTails.begin()->second);
+    }
+}
+
+size_t MemPool::getMaxBytes() const
+{
+    std::unique_lock<std::mutex> lock(mempool_mutex);
+    return maxBytes;
+}
+
+size_t MemPool::getUsedBytes() const
+{
+    std::unique_lock<std::mutex> lock(mempool_mutex);
+    return usedBytes;
+}
+
+// the helpers below keep the txid index, sender queues and heads in step, mempool_mutex held
+void MemPool::insertPending(const Transaction& t, const SHA256Hash& txid)
+{
+    version++;
+    SenderQueue& queue = senders[t.fromWallet()];
+    SenderSlot slot(t.getNonce(), arrivals++);
+    bool hadHead = !queue.pending.empty();
+    SHA256Hash oldHead = hadHead ? queue.pending.begin()->second : NULL_SHA256_HASH;
+    SHA256Hash oldTail = hadHead ? queue.pending.rbegin()->second : NULL_SHA256_HASH;
+    queue.pending[slot] = txid;
+    if (!t.isFee()) queue.outgoing += t.getAmount() + t.getFee();
+    PendingTransaction& pending = pendingByTxid[txid];
+    pending.tx = t;
+    pending.slot = slot;
+    if (queue.pending.begin()->first == slot) {
+        if (hadHead) senderHeads.erase(FeeKey(pendingByTxid[oldHead].tx.getFee(), oldHead));
+        senderHeads.insert(FeeKey(t.getFee(), txid));
+    }
+    if (queue.pending.rbegin()->first == slot) {
+        if (hadHead) senderTails.erase(FeeKey(pendingByTxid[oldTail].tx.getFee(), oldTail));
+        senderTails.insert(FeeKey(t.getFee(), txid));
+    }
+    std::vector<SHA256Hash>& wheelSlot = expiryWheel[(expiresAt(t) / 60) % MEMPOOL_EXPIRY_WHEEL_SLOTS];
+    pendingByTxid[txid].wheelIndex = wheelSlot.size();
+    wheelSlot.push_back(txid);
+    usedBytes += PENDING_TRANSACTION_BYTES;
+    updateFeeHistogram(t, true);
+}
 
-        // Double check balance hasn't changed
-        if (currentBalance < (totalRequired + pendingOutgoing)) {
-            return BALANCE_TOO_LOW;
+bool MemPool::erasePending(const SHA256Hash& txid)
+{
+    auto it = pendingByTxid.find(txid);
+    if (it == pendingByTxid.end()) return false;
+    const Transaction& t = it->second.tx;
+    auto sender = senders.find(t.fromWallet());
+    SenderQueue& queue = sender->second;
+    bool wasHead = queue.pending.begin()->first == it->second.slot;
+    bool wasTail = queue.pending.rbegin()->first == it->second.slot;
+    queue.pending.erase(it->second.slot);
+    if (!t.isFee()) queue.outgoing -= t.getAmount() + t.getFee();
+    if (wasHead) {
+        senderHeads.erase(FeeKey(t.getFee(), txid));
+        if (!queue.pending.empty()) {
+            SHA256Hash next = queue.pending.begin()->second;
+            senderHeads.insert(FeeKey(pendingByTxid[next].tx.getFee(), next));
+        }
+    }
+    if (wasTail) {
+        senderTails.erase(FeeKey(t.getFee(), txid));
+        if (!queue.pending.empty()) {
+            SHA256Hash last = queue.pending.rbegin()->second;
+            senderTails.insert(FeeKey(pendingByTxid[last].tx.getFee(), last));
         }
+    }
+    if (queue.pending.empty()) senders.erase(sender);
+    // swap the last entry of the wheel slot into this one's place
+    std::vector<SHA256Hash>& wheelSlot = expiryWheel[(expiresAt(t) / 60) % MEMPOOL_EXPIRY_WHEEL_SLOTS];
+    size_t wheelIndex = it->second.wheelIndex;
+    if (wheelIndex + 1 < wheelSlot.size()) {
+        wheelSlot[wheelIndex] = wheelSlot.back();
+        pendingByTxid[wheelSlot[wheelIndex]].wheelIndex = wheelIndex;
+    }
+    wheelSlot.pop_back();
+    usedBytes -= PENDING_TRANSACTION_BYTES;
+    version++;
+    updateFeeHistogram(t, false);
+    // evicted or no longer covered transactions may be offered again later
+    seen.forget(txid);
+    pendingByTxid.erase(it);
+    return true;
+}
 
-        // Check nonce
-        PublicWalletAddress from = t.fromWallet();
-        uint64_t expectedNonce = walletNonces[from];
-        if (t.getNonce() != expectedNonce) {
-            return INVALID_NONCE;
+// best fee first, a sender's next transaction becomes eligible once its previous one is taken
+std::vector<Transaction> MemPool::selectPending(size_t limit) const
+{
+    std::vector<Transaction> selected;
+    std::set<FeeKey, std::greater<FeeKey>> heads = senderHeads;
+    while (!heads.empty() && selected.size() < limit) {
+        SHA256Hash txid = heads.begin()->second;
+        heads.erase(heads.begin());
+        const PendingTransaction& pending = pendingByTxid.at(txid);
+        selected.push_back(pending.tx);
+        const SenderQueue& queue = senders.at(pending.tx.fromWallet());
+        auto next = queue.pending.upper_bound(pending.slot);
+        if (next != queue.pending.end()) {
+            heads.insert(FeeKey(pendingByTxid.at(next->second).tx.getFee(), next->second));
         }
+    }
+    return selected;
+}
 
-        // All checks passed, update state atomically
-        mempoolOutgoing[from] += totalRequired;
-        transactionQueue.insert(t);
-        walletNonces[from]++;
-        return SUCCESS;
+// called with mempool_mutex held whenever a transaction enters or leaves the queue
+void MemPool::updateFeeHistogram(const Transaction& t, bool added)
+{
+    if (t.isFee()) return;
+    uint64_t& bucket = feeHistogram[feeHistogramBucket(t.getFee())];
+    if (added) {
+        bucket++;
     } else {
-        // For fee transactions, just verify and add
-        ExecutionStatus status = blockchain.verifyTransaction(t);
-        if (status != SUCCESS) {
-            return status;
-        }
-        transactionQueue.insert(t);
-        return SUCCESS;
+        bucket--;
     }
 }
 
+FeeHistogram MemPool::getFeeHistogram() const
+{
+    std::unique_lock<std::mutex> lock(mempool_mutex);
+    return feeHistogram;
+}
+
 size_t MemPool::size()
 {
     std::unique_lock<std::mutex> lock(mempool_mutex);
-    return transactionQueue.size();
+    return pendingByTxid.size();
 }
 
 std::vector<Transaction> MemPool::getTransactions() const
 {
     std::unique_lock<std::mutex> lock(mempool_mutex);
-    std::vector<Transaction> transactions;
-    for (const auto &tx : transactionQueue)
+    return selectPending(SIZE_MAX);
+}
+
+/*
+    The pending transactions serialized in selection order. The buffer is
+    immutable and shared by every reader until the pending set changes, the
+    first reader after a change rebuilds it while later ones wait for that.
+*/
+std::shared_ptr<const std::string> MemPool::getRaw() const
+{
+    std::unique_lock<std::mutex> ul(snapshotLock);
+    if (snapshot && snapshotVersion == version) return snapshot;
+    std::shared_ptr<std::string> buffer = std::make_shared<std::string>();
     {
-        transactions.push_back(tx);
+        std::unique_lock<std::mutex> lock(mempool_mutex);
+        snapshotVersion = version;
+        std::vector<Transaction> pending = selectPending(SIZE_MAX);
+        buffer->resize(pending.size() * TRANSACTIONINFO_BUFFER_SIZE);
+        for (size_t i = 0; i < pending.size(); i++) {
+            TransactionInfo t = pending[i].serialize();
+            transactionInfoToBuffer(t, &(*buffer)[i * TRANSACTIONINFO_BUFFER_SIZE]);
+        }
     }
-    return transactions;
+    snapshot = buffer;
+    return snapshot;
 }
 
-std::pair<char *, size_t> MemPool::getRaw() const
+IBLT MemPool::getSketch(size_t cells, uint32_t& count) const
 {
+    IBLT sketch(std::min<size_t>(std::max<size_t>(cells, MEMPOOL_SKETCH_MIN_CELLS), MEMPOOL_SKETCH_MAX_CELLS));
     std::unique_lock<std::mutex> lock(mempool_mutex);
-    size_t len = transactionQueue.size() * TRANSACTIONINFO_BUFFER_SIZE;
-    char *buf = (char *)malloc(len);
-    int count = 0;
+    for (const auto& entry : pendingByTxid) {
+        sketch.insert(shortTxid(entry.first));
+    }
+    count = pendingByTxid.size();
+    return sketch;
+}
+
+std::vector<Transaction> MemPool::getTransactionsByShortId(const std::vector<uint64_t>& shortIds) const
+{
+    std::unordered_set<uint64_t> wanted(shortIds.begin(), shortIds.end());
+    std::vector<Transaction> found;
+    std::unique_lock<std::mutex> lock(mempool_mutex);
+    for (const auto& entry : pendingByTxid) {
+        if (wanted.count(shortTxid(entry.first)) > 0) found.push_back(entry.second.tx);
+    }
+    return found;
+}
+
+/*
+    Fetches only the transactions host has that we do not. Both sides build
+    a sketch of their short txids with the same number of cells, the
+    difference of the two decodes to the short txids that differ. Returns
+    false if the sets are too far apart, the caller then downloads the
+    whole mempool instead.
+*/
+bool MemPool::reconcile(const std::string& host)
+{
+    // with nothing to compare against a sketch would only cost a round trip
+    if (size() == 0) return false;
+    size_t cells = MEMPOOL_SKETCH_MIN_CELLS;
+    for (size_t round = 0; round < MEMPOOL_RECONCILE_MAX_ROUNDS; round++) {
+        std::string response = readMempoolSketch(host, cells);
+        if (response.size() < sizeof(uint32_t)) throw std::runtime_error("Malformed mempool sketch");
+        const char* ptr = response.data();
+        uint32_t remoteCount = readNetworkUint32(ptr);
+        // a peer that answers with less than we asked for would keep us asking
+        if (response.size() - sizeof(uint32_t) < cells * IBLT_CELL_BUFFER_SIZE) return false;
+        IBLT remote = IBLT::deserialize(ptr, response.size() - sizeof(uint32_t));
+        uint32_t localCount;
+        IBLT local = getSketch(remote.size(), localCount);
+
+        // the sizes alone show the difference can not decode in this many cells
+        size_t gap = remoteCount > localCount ? remoteCount - localCount : localCount - remoteCount;
+        std::vector<uint64_t> missing;
+        std::vector<uint64_t> extra;
+        if (gap * 3 / 2 <= remote.size()) {
+            remote.subtract(local);
+            if (remote.decode(missing, extra)) {
+                std::vector<Transaction> transactions;
+                if (!missing.empty()) readTransactionsByShortId(host, missing, transactions);
+                addTransactions(transactions);
+                Logger::logStatus("MemPool: reconciled with " + host + ", fetched " + to_string(transactions.size()) + " transactions from a sketch of " + to_string(remote.size()) + " cells");
+                return true;
+            }
+        }
+        if (remote.size() >= MEMPOOL_SKETCH_MAX_CELLS) return false;
+        cells = std::min<size_t>(std::max(cells * 2, gap * 3 / 2), MEMPOOL_SKETCH_MAX_CELLS);
+    }
+    return false;
+}
 
-    for (const auto &tx : transactionQueue)
+/*
+    Persisted mempool: a header of the format version, the save time and the
+    record count, then each transaction in its wire format followed by its
+    nonce. Records are in arrival order so reloading rebuilds every sender's
+    queue in the same order.
+*/
+#define MEMPOOL_FILE_VERSION 1
+#define MEMPOOL_FILE_HEADER_SIZE (2 * sizeof(uint32_t) + sizeof(uint64_t))
+#define MEMPOOL_FILE_RECORD_SIZE (TRANSACTIONINFO_BUFFER_SIZE + sizeof(uint64_t))
+
+// loads what was saved at path, saves there from now on, returns how many were restored
+size_t MemPool::enablePersistence(const std::string& path)
+{
     {
-        TransactionInfo t = tx.serialize();
-        transactionInfoToBuffer(t, buf + count);
-        count += TRANSACTIONINFO_BUFFER_SIZE;
+        std::unique_lock<std::mutex> ul(saveLock);
+        persistPath = path;
+    }
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return 0;
+    std::string buffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (buffer.size() < MEMPOOL_FILE_HEADER_SIZE) {
+        Logger::logError("MemPool", "Ignoring truncated mempool file " + path);
+        return 0;
+    }
+    const char* ptr = buffer.data();
+    uint32_t fileVersion = readNetworkUint32(ptr);
+    uint64_t savedAt = readNetworkUint64(ptr);
+    uint32_t count = readNetworkUint32(ptr);
+    if (fileVersion != MEMPOOL_FILE_VERSION || buffer.size() != MEMPOOL_FILE_HEADER_SIZE + (size_t) count * MEMPOOL_FILE_RECORD_SIZE) {
+        Logger::logError("MemPool", "Ignoring malformed mempool file " + path);
+        return 0;
+    }
+    // everything in it has expired since
+    if (savedAt + Transaction::TRANSACTION_EXPIRY < getCurrentTime()) {
+        Logger::logStatus("MemPool: saved mempool is older than the transaction expiry, starting empty");
+        return 0;
     }
 
-    return std::make_pair(buf, len);
+    std::vector<Transaction> transactions;
+    transactions.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        Transaction t(transactionInfoFromBuffer(ptr));
+        ptr += TRANSACTIONINFO_BUFFER_SIZE;
+        t.setNonce(readNetworkUint64(ptr));
+        transactions.push_back(t);
+    }
+    size_t restored = 0;
+    for (auto status : addTransactions(transactions)) {
+        if (status == SUCCESS) restored++;
+    }
+    Logger::logStatus("MemPool: restored " + to_string(restored) + " of " + to_string(count) + " saved transactions");
+    return restored;
 }
 
+// writes the pending transactions if they changed since the last save
+void MemPool::save()
+{
+    std::unique_lock<std::mutex> ul(saveLock);
+    if (persistPath.empty()) return;
+    std::vector<std::pair<uint64_t, const PendingTransaction*>> byArrival;
+    std::string buffer;
+    uint64_t savingVersion;
+    {
+        std::unique_lock<std::mutex> lock(mempool_mutex);
+        savingVersion = version;
+        if (savingVersion == savedVersion) return;
+        for (const auto& entry : pendingByTxid) {
+            byArrival.push_back(std::make_pair(entry.second.slot.second, &entry.second));
+        }
+        std::sort(byArrival.begin(), byArrival.end(), [](const auto& a, const auto& b) {
+            return a.first < b.first;
+        });
+        buffer.resize(MEMPOOL_FILE_HEADER_SIZE + byArrival.size() * MEMPOOL_FILE_RECORD_SIZE);
+        char* ptr = &buffer[0];
+        writeNetworkUint32(ptr, MEMPOOL_FILE_VERSION);
+        writeNetworkUint64(ptr, getCurrentTime());
+        writeNetworkUint32(ptr, byArrival.size());
+        for (const auto& entry : byArrival) {
+            TransactionInfo info = entry.second->tx.serialize();
+            transactionInfoToBuffer(info, ptr);
+            ptr += TRANSACTIONINFO_BUFFER_SIZE;
+            writeNetworkUint64(ptr, entry.second->slot.first);
+        }
+    }
+
+    // write aside and rename so a crash mid-write leaves the last save intact
+    std::string tmpPath = persistPath + ".tmp";
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    file.write(buffer.data(), buffer.size());
+    file.close();
+    if (!file) {
+        Logger::logError("MemPool", "Could not write " + tmpPath);
+        return;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, persistPath, ec);
+    if (ec) {
+        Logger::logError("MemPool", "Could not replace " + persistPath + " : " + ec.message());
+        return;
+    }
+    savedVersion = savingVersion;
+}
+
+// called with the block applied to the ledger
 void MemPool::finishBlock(Block& block) {
     std::unique_lock<std::mutex> lock(mempool_mutex);
+    std::vector<PublicWalletAddress> spenders;
     for (const auto& tx : block.getTransactions()) {
-        auto it = transactionQueue.find(tx);
-        if (it != transactionQueue.end()) {
-            transactionQueue.erase(it);
+        SHA256Hash txid = tx.hashContents();
+        erasePending(txid);
+        seen.record(txid, EXPIRED_TRANSACTION);
+        if (!tx.isFee()) spenders.push_back(tx.fromWallet());
+    }
+    revalidateSenders(spenders);
+}
 
-            if (!tx.isFee()) {
-                mempoolOutgoing[tx.fromWallet()] -= tx.getAmount() + tx.getFee();
+// called with the block rolled back, its recipients lost what it paid them
+void MemPool::revertBlock(Block& block) {
+    std::unique_lock<std::mutex> lock(mempool_mutex);
+    std::vector<PublicWalletAddress> recipients;
+    for (const auto& tx : block.getTransactions()) {
+        seen.forget(tx.hashContents());
+        recipients.push_back(tx.toWallet());
+    }
+    revalidateSenders(recipients);
+}
 
-                if (mempoolOutgoing[tx.fromWallet()] == 0) {
-                    mempoolOutgoing.erase(tx.fromWallet());
-                }
+// only a drop in balance can invalidate pending transactions, and then only
+// from the first one the balance no longer covers, so the tail is dropped
+void MemPool::revalidateSenders(const std::vector<PublicWalletAddress>& wallets)
+{
+    const Ledger& ledger = blockchain.getLedger();
+    for (const auto& wallet : wallets) {
+        auto sender = senders.find(wallet);
+        if (sender == senders.end()) continue;
+        TransactionAmount balance = ledger.hasWallet(wallet) ? ledger.getWalletValue(wallet) : 0;
+        TransactionAmount covered = 0;
+        std::vector<SHA256Hash> dropped;
+        for (const auto& slot : sender->second.pending) {
+            const Transaction& t = pendingByTxid.at(slot.second).tx;
+            TransactionAmount cost = t.getAmount() + t.getFee();
+            if (dropped.empty() && covered + cost <= balance) {
+                covered += cost;
+            } else {
+                dropped.push_back(slot.second);
             }
         }
+        for (const auto& txid : dropped) erasePending(txid);
+        if (!dropped.empty()) {
+            Logger::logStatus("MemPool: dropped " + to_string(dropped.size()) + " pending transactions no longer covered by their sender's balance");
+        }
     }
 }
 
+// only the slots of minutes that have fully passed are visited
 void MemPool::cleanupExpiredTransactions() {
     std::unique_lock<std::mutex> lock(mempool_mutex);
-    auto now = std::chrono::system_clock::now();
-    
-    for (auto it = transactionQueue.begin(); it != transactionQueue.end();) {
-        if (it->isExpired()) {
-            if (!it->isFee()) {
-                // Revert pending outgoing amount
-                mempoolOutgoing[it->fromWallet()] -= (it->getAmount() + it->getFee());
-            }
-            it = transactionQueue.erase(it);
+    uint64_t now = getCurrentTime();
+    uint64_t minute = now / 60;
+    if (minute > expiryMinute + MEMPOOL_EXPIRY_WHEEL_SLOTS) {
+        // asleep for more than a turn, every slot is due once
+        expiryMinute = minute - MEMPOOL_EXPIRY_WHEEL_SLOTS;
+    }
+    while (expiryMinute < minute) {
+        expireSlot(expiryMinute, now);
+        expiryMinute++;
+    }
+}
+
+void MemPool::expireSlot(uint64_t minute, uint64_t now) {
+    std::vector<SHA256Hash>& slot = expiryWheel[minute % MEMPOOL_EXPIRY_WHEEL_SLOTS];
+    for (size_t i = 0; i < slot.size();) {
+        // erasing moves the slot's last entry into position i
+        SHA256Hash txid = slot[i];
+        if (expiresAt(pendingByTxid.at(txid).tx) <= now) {
+            erasePending(txid);
+            seen.record(txid, EXPIRED_TRANSACTION);
         } else {
-            ++it;
+            // due on a later turn of the wheel
+            i++;
         }
     }
 }
@@ -6,55 +6,133 @@
 #include <mutex>
 #include <list>
 #include <map>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
 #include "../core/host_manager.hpp"
 #include "../core/transaction.hpp"
 #include "executor.hpp"
+#include "peer_relay.hpp"
+#include "seen_txids.hpp"
+#include "iblt.hpp"
+#include "worker_pool.hpp"
 #include "../core/block.hpp"
 #include "../core/common.hpp"
 
+#define MIN_FEE_TO_ENTER_MEMPOOL 1
+#define MEMPOOL_DEFAULT_MAX_BYTES (300 * 1024 * 1024)
+// seconds for an eviction-raised minimum fee to fall halfway back
+#define MEMPOOL_MIN_FEE_HALFLIFE 600
+// one minute slots, enough to cover Transaction::TRANSACTION_EXPIRY in a single turn
+#define MEMPOOL_EXPIRY_WHEEL_SLOTS 64
+// reconciliation sketches start small and double until the difference decodes
+#define MEMPOOL_SKETCH_MIN_CELLS 96
+#define MEMPOOL_SKETCH_MAX_CELLS (1 << 15)
+#define MEMPOOL_RECONCILE_MAX_ROUNDS 4
+// seconds between saves of a changed mempool when persistence is enabled
+#define MEMPOOL_SAVE_INTERVAL 60
+
 class BlockChain;
 
+// pending transaction counts by fee, bucket i holds fees in [2^i, 2^(i+1))
+#define FEE_HISTOGRAM_BUCKETS 64
+typedef std::array<uint64_t, FEE_HISTOGRAM_BUCKETS> FeeHistogram;
+size_t feeHistogramBucket(TransactionAmount fee);
+// the key reconciliation sketches are built over
+uint64_t shortTxid(const SHA256Hash& txid);
+
 class MemPool {
 public:
     MemPool(HostManager& h, BlockChain& b);
     ~MemPool();
     void sync();
     ExecutionStatus addTransaction(Transaction t);
+    std::vector<ExecutionStatus> addTransactions(const std::vector<Transaction>& transactions);
+    std::vector<SHA256Hash> requestTransactions(const std::vector<SHA256Hash>& txids);
+    IBLT getSketch(size_t cells, uint32_t& count) const;
+    std::vector<Transaction> getTransactionsByShortId(const std::vector<uint64_t>& shortIds) const;
+    bool reconcile(const std::string& host);
+    size_t enablePersistence(const std::string& path);
+    void save();
     void finishBlock(Block& block);
+    void revertBlock(Block& block);
     bool hasTransaction(Transaction t);
     size_t size();
-    std::pair<char*, size_t> getRaw() const;
+    std::shared_ptr<const std::string> getRaw() const;
     std::vector<Transaction> getTransactions() const;
     void removeTransaction(Transaction t);
     void cleanupExpiredTransactions();
+    FeeHistogram getFeeHistogram() const;
+    void setMaxBytes(size_t maxBytes);
+    size_t getMaxBytes() const;
+    size_t getUsedBytes() const;
+    TransactionAmount getMinFee() const;
 
 protected:
+    // a sender's pending transactions execute by nonce, then in arrival order
+    typedef std::pair<uint64_t, uint64_t> SenderSlot;
+    typedef std::pair<TransactionAmount, SHA256Hash> FeeKey;
+    struct SenderQueue {
+        std::map<SenderSlot, SHA256Hash> pending;
+        TransactionAmount outgoing = 0;
+    };
+    struct PendingTransaction {
+        Transaction tx;
+        SenderSlot slot;
+        size_t wheelIndex;
+    };
     void mempool_sync();
+    void relayBatch(const std::set<std::string>& neighbors, std::vector<Transaction> batch);
+    void retryRelay(const std::vector<Transaction>& transactions);
+    void updateFeeHistogram(const Transaction& t, bool added);
+    void insertPending(const Transaction& t, const SHA256Hash& txid);
+    bool erasePending(const SHA256Hash& txid);
+    void revalidateSenders(const std::vector<PublicWalletAddress>& wallets);
+    std::vector<Transaction> selectPending(size_t limit) const;
+    bool makeRoom(TransactionAmount fee);
+    void expireSlot(uint64_t minute, uint64_t now);
+    TransactionAmount currentMinFee() const;
+    static const size_t PENDING_TRANSACTION_BYTES;
+    FeeHistogram feeHistogram;
     bool shutdown;
     std::mutex shutdownLock;
-    std::map<PublicWalletAddress, TransactionAmount> mempoolOutgoing;
     std::list<Transaction> toSend;
+    // failed relay rounds of the transactions on toSend, toSend_mutex held
+    std::unordered_map<SHA256Hash, uint32_t, SHA256Hasher> relayAttempts;
     BlockChain& blockchain;
     HostManager& hosts;
-    
-    // Transaction ordering by fee
-    struct TransactionComparator {
-        bool operator()(const Transaction& a, const Transaction& b) const {
-            if (a.getFee() != b.getFee()) {
-                return a.getFee() > b.getFee();
-            }
-            return a.getHash() < b.getHash();
-        }
-    };
-    
-    std::set<Transaction, TransactionComparator> transactionQueue;
+
+    std::unordered_map<SHA256Hash, PendingTransaction, SHA256Hasher> pendingByTxid;
+    std::unordered_map<PublicWalletAddress, SenderQueue, WalletAddressHasher> senders;
+    // only the head of each sender's queue can be mined next, best fee first
+    std::set<FeeKey, std::greater<FeeKey>> senderHeads;
+    // only the last of each sender's queue can be evicted without breaking its order, cheapest first
+    std::set<FeeKey> senderTails;
+    // txids by the minute they expire in
+    std::array<std::vector<SHA256Hash>, MEMPOOL_EXPIRY_WHEEL_SLOTS> expiryWheel;
+    uint64_t expiryMinute;
+    size_t usedBytes;
+    size_t maxBytes;
+    TransactionAmount raisedMinFee;
+    uint64_t minFeeRaisedAt;
+    uint64_t arrivals;
+    // bumped whenever the pending set changes
+    std::atomic<uint64_t> version;
+    uint64_t savedVersion;
+    mutable std::shared_ptr<const std::string> snapshot;
+    mutable uint64_t snapshotVersion;
+    mutable std::mutex snapshotLock;
+    std::string persistPath;
+    std::mutex saveLock;
+    SeenTxids seen;
     std::vector<std::thread> syncThread;
     mutable std::mutex mempool_mutex;
     std::mutex toSend_mutex;
-    
-    // Track nonces for each wallet
-    std::map<PublicWalletAddress, uint64_t> walletNonces;
-    std::map<SHA256Hash, Transaction> transactions;
     std::vector<std::thread> cleanupThread;
     mutable std::mutex lock;
+    // checks signatures of large admission batches in parallel
+    std::unique_ptr<WorkerPool> verifiers;
+    // last so its workers stop before anything their callbacks touch goes away
+    std::unique_ptr<PeerRelay> relay;
 };
@@ -0,0 +1,122 @@
+#include <chrono>
+#include <curl/curl.h>
+#include "../core/constants.hpp"
+#include "peer_relay.hpp"
+using namespace std;
+
+static uint64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static size_t appendResponse(void* contents, size_t size, size_t nmemb, void* userp) {
+    ((string*)userp)->append((char*)contents, size * nmemb);
+    return size * nmemb;
+}
+
+PeerRelay::PeerRelay(size_t connections) : shutdown(false) {
+    for (size_t i = 0; i < std::max<size_t>(connections, 1); i++) {
+        this->workers.push_back(std::make_unique<Worker>());
+    }
+    for (auto& worker : this->workers) {
+        Worker* w = worker.get();
+        w->thread = std::thread([this, w]() {
+            this->work(*w);
+        });
+    }
+}
+
+PeerRelay::~PeerRelay() {
+    {
+        std::unique_lock<std::mutex> ul(lock);
+        this->shutdown = true;
+    }
+    for (auto& worker : this->workers) {
+        worker->ready.notify_all();
+        worker->thread.join();
+    }
+}
+
+bool PeerRelay::post(const string& host, const string& path, std::shared_ptr<const string> body, Callback done) {
+    std::unique_lock<std::mutex> ul(lock);
+    auto it = this->backoff.find(host);
+    if (it != this->backoff.end() && it->second.retryAt > nowMs()) return false;
+    Worker& worker = *this->workers[std::hash<string>()(host) % this->workers.size()];
+    if (worker.jobs.size() >= RELAY_QUEUE_LIMIT) return false;
+    Job job;
+    job.host = host;
+    job.path = path;
+    job.body = body;
+    job.done = done;
+    worker.jobs.push_back(std::move(job));
+    worker.ready.notify_one();
+    return true;
+}
+
+bool PeerRelay::isBackingOff(const string& host) const {
+    std::unique_lock<std::mutex> ul(lock);
+    auto it = this->backoff.find(host);
+    return it != this->backoff.end() && it->second.retryAt > nowMs();
+}
+
+size_t PeerRelay::queued() const {
+    std::unique_lock<std::mutex> ul(lock);
+    size_t count = 0;
+    for (auto& worker : this->workers) count += worker->jobs.size();
+    return count;
+}
+
+void PeerRelay::recordResult(const string& host, bool answered) {
+    std::unique_lock<std::mutex> ul(lock);
+    if (answered) {
+        this->backoff.erase(host);
+        return;
+    }
+    Backoff& b = this->backoff[host];
+    uint64_t delay = RELAY_BACKOFF_BASE_MS << std::min<uint32_t>(b.failures, 20);
+    b.failures++;
+    b.retryAt = nowMs() + std::min<uint64_t>(delay, RELAY_BACKOFF_MAX_MS);
+}
+
+void PeerRelay::work(Worker& worker) {
+    CURL* curl = curl_easy_init();
+    struct curl_slist* headers = curl_slist_append(NULL, "Content-Type: application/octet-stream");
+    while (true) {
+        Job job;
+        bool skip;
+        {
+            std::unique_lock<std::mutex> ul(lock);
+            worker.ready.wait(ul, [this, &worker]() {
+                return this->shutdown || !worker.jobs.empty();
+            });
+            if (this->shutdown) break;
+            job = std::move(worker.jobs.front());
+            worker.jobs.pop_front();
+            // the peer failed while this was queued
+            auto it = this->backoff.find(job.host);
+            skip = it != this->backoff.end() && it->second.retryAt > nowMs();
+        }
+        if (skip || !curl) {
+            job.done(false, 0, "");
+            continue;
+        }
+
+        string response;
+        curl_easy_setopt(curl, CURLOPT_URL, (job.host + job.path).c_str());
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, job.body->data());
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) job.body->size());
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, appendResponse);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long) TIMEOUT_MS * 3);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        CURLcode res = curl_easy_perform(curl);
+        long code = 0;
+        if (res == CURLE_OK) curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+        // a peer that answers with a client error is up, it just does not take this post
+        this->recordResult(job.host, res == CURLE_OK && code < 500);
+        job.done(res == CURLE_OK && code == 200, code, response);
+    }
+    curl_slist_free_all(headers);
+    if (curl) curl_easy_cleanup(curl);
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+#define RELAY_CONNECTIONS 4
+#define RELAY_BACKOFF_BASE_MS 1000
+#define RELAY_BACKOFF_MAX_MS (10 * 60 * 1000)
+// queued posts per connection before new ones are refused
+#define RELAY_QUEUE_LIMIT 256
+
+/*
+    Posts binary bodies to peers over a fixed set of connections. Every peer
+    is pinned to one worker, and each worker keeps a curl handle whose
+    connection cache holds the peer's socket open between posts. A post the
+    peer did not answer, or answered with a server error, puts the peer into
+    exponential backoff. Posts for it are refused or dropped until the
+    backoff runs out, and the first answered post clears it.
+*/
+class PeerRelay {
+    public:
+        // delivered is a 200 answer, status is the HTTP status or 0 if there was no answer
+        typedef std::function<void(bool delivered, long status, const string& response)> Callback;
+        PeerRelay(size_t connections = RELAY_CONNECTIONS);
+        ~PeerRelay();
+        // false if the post was refused, done is only called for accepted posts
+        bool post(const string& host, const string& path, std::shared_ptr<const string> body, Callback done);
+        bool isBackingOff(const string& host) const;
+        size_t queued() const;
+    protected:
+        struct Job {
+            string host;
+            string path;
+            std::shared_ptr<const string> body;
+            Callback done;
+        };
+        struct Worker {
+            std::deque<Job> jobs;
+            std::condition_variable ready;
+            std::thread thread;
+        };
+        struct Backoff {
+            uint32_t failures = 0;
+            uint64_t retryAt = 0;
+        };
+        void work(Worker& worker);
+        void recordResult(const string& host, bool answered);
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::unordered_map<string, Backoff> backoff;
+        bool shutdown;
+        mutable std::mutex lock;
+};
@@ -5,6 +5,9 @@
 #include "data_store.hpp"
 using namespace std;
 
+// backend for the process wide cache used by PUFFERFISH(), set before the first hash
+void setPufferfishCacheBackend(StorageBackend backend);
+
 class PufferfishCache : public DataStore {
     public:
         bool hasHash(const SHA256Hash& hash) const;
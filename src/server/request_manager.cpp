@@ -2,6 +2,8 @@
 #include <iostream>
 #include <future>
 #include <math.h>
+#include <algorithm>
+#include <numeric>
 #include "../core/helpers.hpp"
 #include "../core/logger.hpp"
 #include "../core/merkle_tree.hpp"
@@ -9,26 +11,49 @@
 using namespace std;
 
 #define NEW_BLOCK_PEER_FANOUT 8
-
-RequestManager::RequestManager(HostManager& hosts, string ledgerPath, string blockPath, string txdbPath) : hosts(hosts) {
-    this->blockchain = std::make_shared<BlockChain>(hosts, ledgerPath, blockPath, txdbPath);
+#define WALLET_HISTORY_DEFAULT_LIMIT 100
+#define WALLET_HISTORY_MAX_LIMIT 1000
+#define LEDGER_BATCH_MAX_WALLETS 100000
+#define LEDGER_BATCH_MIN_CHUNK 4096
+#define FEE_ESTIMATE_MAX_TARGET 100
+#define FEE_ESTIMATE_HISTORY_BLOCKS 10
+#define FEE_ESTIMATE_FULL_BLOCK_RATIO 0.9
+#define WATCH_MAX_ADDRESSES_PER_REQUEST 1000
+#define WATCH_MAX_ADDRESSES 100000
+#define WATCH_EVENTS_MAX_LIMIT 1000
+// threads and queued jobs for request work kept off the event loop
+#define REQUEST_WORKERS 4
+#define REQUEST_QUEUE_LIMIT 1024
+
+RequestManager::RequestManager(HostManager& hosts, string ledgerPath, string blockPath, string txdbPath, StorageBackends backends) : hosts(hosts) {
+    this->blockchain = std::make_shared<BlockChain>(hosts, ledgerPath, blockPath, txdbPath, backends);
     this->mempool = std::make_shared<MemPool>(hosts, *this->blockchain);
     this->rateLimiter = std::make_shared<RateLimiter>(30,5); // max of 30 requests over 5 sec period 
     this->limitRequests = true;
+    this->workers = std::make_shared<WorkerPool>(REQUEST_WORKERS, REQUEST_QUEUE_LIMIT);
+    this->lookups = std::make_shared<WorkerPool>(std::max<size_t>(std::thread::hardware_concurrency(), 1));
 
     bool mempoolInitSuccessful = false;
 
     if (!hosts.isDisabled()) {
+        // restored before syncing starts, while the ledger accepts transactions
+        this->mempool->enablePersistence(MEMPOOL_FILE_PATH);
         this->blockchain->sync();
 
         // Try to initialize mempool with transactions from top-synced hosts
         auto topSyncedHosts = hosts.sampleFreshHosts(3); // Get top 3 synced hosts for retry attempts
         for (const auto& bestHost : topSyncedHosts) {
             try {
-                vector<Transaction> transactions;
-                readRawTransactions(bestHost, transactions);
-                for(auto& t : transactions) {
-                    mempool->addTransaction(t);
+                bool reconciled = false;
+                try {
+                    reconciled = mempool->reconcile(bestHost);
+                } catch(const std::exception& e) {
+                    Logger::logError("RequestManager::Mempool reconciliation failed with host: ", bestHost);
+                }
+                if (!reconciled) {
+                    vector<Transaction> transactions;
+                    readRawTransactions(bestHost, transactions);
+                    mempool->addTransactions(transactions);
                 }
                 mempoolInitSuccessful = true;
                 break;  // Successfully initialized mempool, break out of the loop
@@ -51,6 +76,34 @@ void RequestManager::enableRateLimiting(bool enabled) {
     this->limitRequests = enabled;
 }
 
+void RequestManager::setDurabilityPolicy(DurabilityPolicy policy) {
+    this->blockchain->setDurabilityPolicy(policy);
+}
+
+DurabilityPolicy RequestManager::getDurabilityPolicy() const {
+    return this->blockchain->getDurabilityPolicy();
+}
+
+void RequestManager::setPruneDepth(uint32_t depth) {
+    this->blockchain->setPruneDepth(depth);
+}
+
+uint32_t RequestManager::getPruneDepth() const {
+    return this->blockchain->getPruneDepth();
+}
+
+uint32_t RequestManager::getPrunedHeight() const {
+    return this->blockchain->getView()->getPrunedHeight();
+}
+
+std::shared_ptr<const ChainView> RequestManager::getView() const {
+    return this->blockchain->getView();
+}
+
+void RequestManager::setArchiveDepth(uint32_t depth) {
+    this->blockchain->setArchiveDepth(depth);
+}
+
 json RequestManager::getPeerStats() {
     json ret;
     for(auto elem : this->blockchain->getHeaderChainStats()) {
@@ -59,8 +112,16 @@ json RequestManager::getPeerStats() {
     return ret;
 }
 
+void RequestManager::saveMempool() {
+    this->mempool->save();
+}
+
 void RequestManager::exit() {
+    // jobs still running hold references into the chain and mempool
+    this->workers->stop();
+    this->lookups->stop();
     this->blockchain->closeDB();
+    if (this->watchList) this->watchList->closeDB();
 }
 
 RequestManager::~RequestManager() {
@@ -68,17 +129,83 @@ RequestManager::~RequestManager() {
 
 void RequestManager::deleteDB() {
     this->blockchain->deleteDB();
+    if (this->watchList) {
+        this->watchList->closeDB();
+        this->watchList->deleteDB();
+    }
 }
 
 json RequestManager::getTransactionsForWallet(PublicWalletAddress addr) {
+    std::shared_ptr<const ChainView> view = this->blockchain->getView();
     json ret = json::array();
-    vector<Transaction> txs = this->blockchain->getTransactionsForWallet(addr);
+    vector<Transaction> txs = view->getTransactionsForWallet(addr);
     for(auto tx : txs) {
         ret.push_back(tx.toJson());
     }
     return ret;
 }
 
+// wallet history cursors are "blockId:index" of a transaction in the chain
+static string walletCursor(const WalletTransactionRef& ref) {
+    return to_string(ref.blockId) + ":" + to_string(ref.index);
+}
+
+static void parseWalletCursor(string cursor, uint32_t& blockId, uint32_t& index) {
+    size_t sep = cursor.find(':');
+    if (sep == string::npos) throw std::runtime_error("Invalid cursor");
+    blockId = std::stoul(cursor.substr(0, sep));
+    index = std::stoul(cursor.substr(sep + 1));
+}
+
+json RequestManager::getWalletTransactions(PublicWalletAddress addr, size_t limit, string before, string after) {
+    std::shared_ptr<const ChainView> view = this->blockchain->getView();
+    json ret;
+    if (before.length() > 0 && after.length() > 0) {
+        ret["error"] = "Only one of before and after may be specified";
+        return ret;
+    }
+    if (limit == 0) limit = WALLET_HISTORY_DEFAULT_LIMIT;
+    limit = std::min<size_t>(limit, WALLET_HISTORY_MAX_LIMIT);
+    uint32_t blockId = UINT32_MAX;
+    uint32_t index = UINT32_MAX;
+    try {
+        if (before.length() > 0) parseWalletCursor(before, blockId, index);
+        if (after.length() > 0) parseWalletCursor(after, blockId, index);
+    } catch(...) {
+        ret["error"] = "Invalid cursor";
+        return ret;
+    }
+    // fetch one extra entry to learn whether another page follows
+    vector<WalletTransactionRef> refs;
+    bool hasMore;
+    if (after.length() > 0) {
+        refs = view->getWalletTransactionsAfter(addr, blockId, index, limit + 1);
+        hasMore = refs.size() > limit;
+        if (hasMore) refs.erase(refs.begin());
+    } else {
+        refs = view->getWalletTransactionsBefore(addr, blockId, index, limit + 1);
+        hasMore = refs.size() > limit;
+        if (hasMore) refs.pop_back();
+    }
+    json transactions = json::array();
+    for (auto ref : refs) {
+        TransactionLocation loc;
+        loc.blockId = ref.blockId;
+        loc.index = ref.index;
+        json tx = view->getTransaction(loc).toJson();
+        tx["blockId"] = ref.blockId;
+        tx["index"] = ref.index;
+        transactions.push_back(tx);
+    }
+    ret["transactions"] = transactions;
+    ret["hasMore"] = hasMore;
+    if (refs.size() > 0) {
+        ret["newest"] = walletCursor(refs.front());
+        ret["oldest"] = walletCursor(refs.back());
+    }
+    return ret;
+}
+
 bool RequestManager::acceptRequest(std::string& ip) {
     if (!this->limitRequests) return true;
     return this->rateLimiter->limit(ip);
@@ -90,6 +217,20 @@ json RequestManager::addTransaction(Transaction& t) {
     return result;
 }
 
+bool RequestManager::runInBackground(std::function<void()> job) {
+    return this->workers->submit(std::move(job));
+}
+
+json RequestManager::addTransactions(vector<Transaction>& transactions) {
+    json result = json::array();
+    for (auto status : this->mempool->addTransactions(transactions)) {
+        json item;
+        item["status"] = executionStatusAsString(status);
+        result.push_back(item);
+    }
+    return result;
+}
+
 json RequestManager::submitProofOfWork(Block& newBlock) {
     json result;
 
@@ -134,26 +275,47 @@ json hashTreeToJson(shared_ptr<HashTree> root) {
 }
 
 json RequestManager::getTransactionStatus(SHA256Hash txid) {
+    std::shared_ptr<const ChainView> view = this->blockchain->getView();
     json response;
     Block b;
     try {
-        uint32_t blockId = this->blockchain->findBlockForTransactionId(txid);
-        b = this->blockchain->getBlock(blockId);
+        uint32_t blockId = view->findTransactionLocation(txid).blockId;
+        b = view->getBlock(blockId);
         response["status"] = "IN_CHAIN";
         response["blockId"] = b.getId();
+        response["confirmations"] = view->getBlockCount() - b.getId() + 1;
     } catch(...) {
         response["status"] = "NOT_IN_CHAIN";
         response["blockId"] = -1;
+        response["confirmations"] = 0;
     }
     return response;  
 }
 
+json RequestManager::getTransaction(SHA256Hash txid) {
+    std::shared_ptr<const ChainView> view = this->blockchain->getView();
+    json response;
+    TransactionLocation loc = view->findTransactionLocation(txid);
+    if (loc.blockId == 0) {
+        response["error"] = "Transaction not found";
+    } else if (loc.blockId <= view->getPrunedHeight()) {
+        response["error"] = "Block has been pruned";
+        response["blockId"] = loc.blockId;
+    } else {
+        response["blockId"] = loc.blockId;
+        response["index"] = loc.index;
+        response["transaction"] = view->getTransaction(loc).toJson();
+    }
+    return response;
+}
+
 json RequestManager::verifyTransaction(Transaction& t) {
+    std::shared_ptr<const ChainView> view = this->blockchain->getView();
     json response;
     Block b;
     try {
-        uint32_t blockId = this->blockchain->findBlockForTransaction(t);
-        b = this->blockchain->getBlock(blockId);
+        uint32_t blockId = view->findTransactionLocation(t.hashContents()).blockId;
+        b = view->getBlock(blockId);
         MerkleTree m;
         m.setItems(b.getTransactions());
         shared_ptr<HashTree> root = m.getMerkleProof(t);
@@ -170,8 +332,9 @@ json RequestManager::verifyTransaction(Transaction& t) {
 }
 
 json RequestManager::getMineStatus(uint32_t blockId) {
+    std::shared_ptr<const ChainView> view = this->blockchain->getView();
     json result;
-    Block b = this->blockchain->getBlock(blockId).toJson();
+    Block b = view->getBlock(blockId).toJson();
     PublicWalletAddress minerAddress;
     TransactionAmount txFees = 0;
     TransactionAmount mintFee = 0;
@@ -192,12 +355,13 @@ json RequestManager::getMineStatus(uint32_t blockId) {
 
 
 json RequestManager::getProofOfWork() {
+    std::shared_ptr<const ChainView> view = this->blockchain->getView();
     json result;
-    result["lastHash"] = SHA256toString(this->blockchain->getLastHash());
-    result["challengeSize"] = this->blockchain->getDifficulty();
-    result["chainLength"] = this->blockchain->getBlockCount();
-    result["miningFee"] = this->blockchain->getCurrentMiningFee(this->blockchain->getBlockCount()+1);
-    BlockHeader last = this->blockchain->getBlockHeader(this->blockchain->getBlockCount());
+    result["lastHash"] = SHA256toString(view->getLastHash());
+    result["challengeSize"] = view->getDifficulty();
+    result["chainLength"] = view->getBlockCount();
+    result["miningFee"] = this->blockchain->getCurrentMiningFee(view->getBlockCount()+1);
+    BlockHeader last = view->getBlockHeader(view->getBlockCount());
     result["lastTimestamp"] = uint64ToString(last.timestamp);
     return result;
 }
@@ -211,20 +375,85 @@ json RequestManager::getTransactionQueue() {
 }
 
 std::pair<uint8_t*, size_t> RequestManager::getRawBlockData(uint32_t blockId) {
-    return this->blockchain->getRaw(blockId);
+    return this->blockchain->getView()->getRaw(blockId);
 }
 
 BlockHeader RequestManager::getBlockHeader(uint32_t blockId) {
-    return this->blockchain->getBlockHeader(blockId);
+    return this->blockchain->getView()->getBlockHeader(blockId);
 }
 
 
-std::pair<char*, size_t> RequestManager::getRawTransactionData() {
+std::shared_ptr<const string> RequestManager::getRawTransactionData() {
     return this->mempool->getRaw();
 }
 
+vector<SHA256Hash> RequestManager::requestTransactions(const vector<SHA256Hash>& txids) {
+    return this->mempool->requestTransactions(txids);
+}
+
+string RequestManager::getMempoolSketch(size_t cells) {
+    uint32_t count;
+    IBLT sketch = this->mempool->getSketch(cells, count);
+    string buffer(sizeof(uint32_t), '\0');
+    char* ptr = &buffer[0];
+    writeNetworkUint32(ptr, count);
+    return buffer + sketch.serialize();
+}
+
+vector<Transaction> RequestManager::getTransactionsByShortId(const vector<uint64_t>& shortIds) {
+    return this->mempool->getTransactionsByShortId(shortIds);
+}
+
 json RequestManager::getBlock(uint32_t blockId) {
-    return this->blockchain->getBlock(blockId).toJson();
+    return this->blockchain->getView()->getBlock(blockId).toJson();
+}
+
+json blockHeaderToJson(BlockHeader& header) {
+    vector<Transaction> transactions;
+    json ret = Block(header, transactions).toJson();
+    ret.erase("transactions");
+    ret["numTransactions"] = header.numTransactions;
+    return ret;
+}
+
+json RequestManager::getBlockAtTime(uint64_t timestamp) {
+    std::shared_ptr<const ChainView> view = this->blockchain->getView();
+    json result;
+    uint32_t blockId = view->getBlockAtTime(timestamp);
+    if (blockId == 0) {
+        result["error"] = "No block at or after timestamp";
+        return result;
+    }
+    BlockHeader header = view->getBlockHeader(blockId);
+    return blockHeaderToJson(header);
+}
+
+/*
+    Headers of the blocks from the first one to reach fromTime up to the last
+    one before the chain passed toTime, at most BLOCK_HEADERS_PER_FETCH of
+    them. Longer ranges are paged by passing next back as start.
+*/
+json RequestManager::getBlocksInTimeRange(uint64_t fromTime, uint64_t toTime, uint32_t start) {
+    std::shared_ptr<const ChainView> view = this->blockchain->getView();
+    json result;
+    if (toTime < fromTime) {
+        result["error"] = "to_time is before from_time";
+        return result;
+    }
+    uint32_t first = view->getBlockAtTime(fromTime);
+    uint32_t end = toTime == UINT64_MAX ? 0 : view->getBlockAtTime(toTime + 1);
+    if (end == 0) end = view->getBlockCount() + 1;
+    if (first == 0) first = end;
+    first = std::max(first, start);
+    json headers = json::array();
+    uint32_t blockId = first;
+    for (; blockId < end && headers.size() < BLOCK_HEADERS_PER_FETCH; blockId++) {
+        BlockHeader header = view->getBlockHeader(blockId);
+        headers.push_back(blockHeaderToJson(header));
+    }
+    result["headers"] = headers;
+    if (blockId < end) result["next"] = blockId;
+    return result;
 }
 
 json RequestManager::getPeers() {
@@ -249,86 +478,283 @@ json RequestManager::addPeer(string address, uint64_t time, string version, stri
 
 
 json RequestManager::getLedger(PublicWalletAddress w) {
+    std::shared_ptr<const ChainView> view = this->blockchain->getView();
     json result;
-    const Ledger& ledger = this->blockchain->getLedger();
-    if (!ledger.hasWallet(w)) {
+    if (!view->hasWallet(w)) {
         result["error"] = "Wallet not found";
     } else {
-        result["balance"] = ledger.getWalletValue(w);
+        result["balance"] = view->getWalletValue(w);
+    }
+    return result;
+}
+
+json RequestManager::getLedger(PublicWalletAddress w, uint32_t blockId) {
+    std::shared_ptr<const ChainView> view = this->blockchain->getView();
+    json result;
+    try {
+        result["balance"] = view->getWalletValueAt(w, blockId);
+        result["height"] = blockId;
+    } catch(const std::exception &e) {
+        result["error"] = e.what();
     }
     return result;
 }
+
+/*
+    Balances of a batch of wallets from one chain view, in request order.
+    The wallets are sorted and split into contiguous ranges so each worker
+    walks its own part of the ledger keyspace with a single iterator.
+    Returns the block count the balances are for.
+*/
+uint32_t RequestManager::getWalletValues(const vector<PublicWalletAddress>& wallets, vector<WalletValue>& values) {
+    if (wallets.size() > LEDGER_BATCH_MAX_WALLETS) {
+        throw std::runtime_error("Too many wallets, at most " + to_string(LEDGER_BATCH_MAX_WALLETS) + " per request");
+    }
+    std::shared_ptr<const ChainView> view = this->blockchain->getView();
+    size_t count = wallets.size();
+    vector<size_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&wallets](size_t a, size_t b) {
+        return wallets[a] < wallets[b];
+    });
+    vector<PublicWalletAddress> sorted;
+    sorted.reserve(count);
+    for (size_t i : order) sorted.push_back(wallets[i]);
+
+    vector<WalletValue> sortedValues(count);
+    size_t workers = std::min<size_t>(this->lookups->threadCount(), (count + LEDGER_BATCH_MIN_CHUNK - 1) / LEDGER_BATCH_MIN_CHUNK);
+    if (workers <= 1) {
+        view->getWalletValues(sorted.data(), count, sortedValues.data());
+    } else {
+        size_t chunk = (count + workers - 1) / workers;
+        vector<future<void>> ranges;
+        for (size_t start = 0; start < count; start += chunk) {
+            size_t length = std::min(chunk, count - start);
+            auto lookup = std::make_shared<std::packaged_task<void()>>([&view, &sorted, &sortedValues, start, length]() {
+                view->getWalletValues(sorted.data() + start, length, sortedValues.data() + start);
+            });
+            ranges.push_back(lookup->get_future());
+            if (!this->lookups->submit([lookup]() { (*lookup)(); })) (*lookup)();
+        }
+        for (auto& range : ranges) range.get();
+    }
+
+    values.resize(count);
+    for (size_t i = 0; i < count; i++) values[order[i]] = sortedValues[i];
+    return view->getBlockCount();
+}
+
 string RequestManager::getBlockCount() {
-    uint32_t count = this->blockchain->getBlockCount();
+    std::shared_ptr<const ChainView> view = this->blockchain->getView();
+    uint32_t count = view->getBlockCount();
     return std::to_string(count);
 }
 
 string RequestManager::getTotalWork() {
-    Bigint totalWork = this->blockchain->getTotalWork();
+    std::shared_ptr<const ChainView> view = this->blockchain->getView();
+    Bigint totalWork = view->getTotalWork();
     return to_string(totalWork);
 }
 
 uint64_t RequestManager::getNetworkHashrate() {
-    auto blockCount = this->blockchain->getBlockCount();
-
-    uint64_t totalWork = 0;
-
-    int blockStart = blockCount < 52 ? 2 : blockCount - 50;
-    int blockEnd = blockCount;
-
-    int start = 0;
-    int end = 0;
-
-    for (int blockId = blockStart; blockId <= blockEnd; blockId++) {
-        auto header = this->blockchain->getBlockHeader(blockId);
-
-        if (blockId == blockStart) {
-            start = header.timestamp;
-        }
-
-        if (blockId == blockEnd) {
-            end = header.timestamp;
-        }
-
-        totalWork += pow(2, header.difficulty);
-    }
-
-    return totalWork / (end - start);
+    std::shared_ptr<const ChainView> view = this->blockchain->getView();
+    uint32_t blockCount = view->getBlockCount();
+    if (blockCount < 3) return 0;
+    uint32_t blockStart = blockCount < 52 ? 2 : blockCount - 50;
+    // work of blockStart..tip over the time since blockStart
+    BlockStats range = view->getChainStats(blockStart, blockCount);
+    int64_t elapsed = range.interval - view->getBlockStats(blockStart).interval;
+    if (elapsed <= 0) return 0;
+    return range.work / elapsed;
 }
 
 json RequestManager::getStats() {
+    std::shared_ptr<const ChainView> view = this->blockchain->getView();
     json info;
-    if (this->blockchain->getBlockCount() == 1) {
+    if (view->getBlockCount() == 1) {
         info["error"] = "Need more data";
         return info;
     }
     info["node_version"] = BUILD_VERSION;
-    int coins = this->blockchain->getBlockCount()*50;
-    info["node_version"] = BUILD_VERSION;
+    int coins = view->getBlockCount()*50;
     info["num_coins"] = coins;
     info["num_wallets"] = 0;
-    int blockId = this->blockchain->getBlockCount();
     info["pending_transactions"]= this->mempool->size();
-    
-    int idx = this->blockchain->getBlockCount();
-    Block a = this->blockchain->getBlock(idx);
-    Block b = this->blockchain->getBlock(idx-1);
-    int timeDelta = a.getTimestamp() - b.getTimestamp();
-    int totalSent = 0;
-    int fees = 0;
+    info["mempool_bytes"]= this->mempool->getUsedBytes();
+    info["mempool_max_bytes"]= this->mempool->getMaxBytes();
+    info["mempool_min_fee"]= this->mempool->getMinFee();
+
+    uint32_t idx = view->getBlockCount();
+    Block a = view->getBlock(idx);
+    BlockStats stats = view->getBlockStats(idx);
     info["transactions"] = json::array();
     for(auto t : a.getTransactions()) {
-        totalSent += t.getAmount();
-        fees += t.getTransactionFee();
         info["transactions"].push_back(t.toJson());
     }
-    int count = a.getTransactions().size();
-    info["transactions_per_second"]= a.getTransactions().size()/(double)timeDelta;
-    info["transaction_volume"]= totalSent;
-    info["avg_transaction_size"]= totalSent/count;
-    info["avg_transaction_fee"]= fees/count;
+    info["transactions_per_second"]= stats.interval > 0 ? stats.transactions / (double) stats.interval : 0;
+    info["transaction_volume"]= stats.volume;
+    info["avg_transaction_size"]= stats.transactions > 0 ? stats.volume / stats.transactions : 0;
+    info["avg_transaction_fee"]= stats.transactions > 0 ? stats.fees / stats.transactions : 0;
     info["difficulty"]= a.getDifficulty();
     info["current_block"]= a.getId();
-    info["last_block_time"]= timeDelta;
+    info["pruned_height"]= view->getPrunedHeight();
+    info["last_block_time"]= stats.interval;
     return info;
 }
+
+/*
+    Fee for a transaction to be mined within targetBlocks. The mempool side
+    counts the pending transactions that outbid each fee bucket: once they
+    fill the target blocks, a new transaction has to pay above that bucket.
+    When recent blocks were close to full the average fee they paid is used
+    as a floor, as the mempool alone understates the competition then.
+*/
+json RequestManager::getFeeEstimate(uint32_t targetBlocks) {
+    std::shared_ptr<const ChainView> view = this->blockchain->getView();
+    targetBlocks = std::max<uint32_t>(1, std::min<uint32_t>(targetBlocks, FEE_ESTIMATE_MAX_TARGET));
+    FeeHistogram histogram = this->mempool->getFeeHistogram();
+    uint64_t capacity = (uint64_t) targetBlocks * (MAX_TRANSACTIONS_PER_BLOCK - 1);
+    uint64_t pending = 0;
+    for (uint64_t count : histogram) pending += count;
+    uint64_t ahead = 0;
+    TransactionAmount mempoolFee = this->mempool->getMinFee();
+    for (int bucket = FEE_HISTOGRAM_BUCKETS - 1; bucket >= 0; bucket--) {
+        ahead += histogram[bucket];
+        if (ahead >= capacity) {
+            mempoolFee = bucket == FEE_HISTOGRAM_BUCKETS - 1 ? UINT64_MAX : std::max(mempoolFee, (TransactionAmount) 1 << (bucket + 1));
+            break;
+        }
+    }
+
+    uint32_t tip = view->getBlockCount();
+    uint32_t from = tip > FEE_ESTIMATE_HISTORY_BLOCKS ? tip - FEE_ESTIMATE_HISTORY_BLOCKS + 1 : 1;
+    uint32_t blocks = tip - from + 1;
+    BlockStats recent = view->getChainStats(from, tip);
+    // every block holds one mining fee transaction that pays no fee
+    uint64_t paying = recent.transactions > blocks ? recent.transactions - blocks : 0;
+    TransactionAmount recentFee = paying > 0 ? recent.fees / paying : 0;
+    double fill = recent.transactions / (double) ((uint64_t) blocks * MAX_TRANSACTIONS_PER_BLOCK);
+
+    TransactionAmount fee = mempoolFee;
+    if (fill >= FEE_ESTIMATE_FULL_BLOCK_RATIO) fee = std::max(fee, recentFee);
+    json result;
+    result["target_blocks"] = targetBlocks;
+    result["fee"] = fee;
+    result["mempool_fee"] = mempoolFee;
+    result["recent_average_fee"] = recentFee;
+    result["recent_block_fill"] = fill;
+    result["pending_transactions"] = pending;
+    return result;
+}
+
+json RequestManager::getChainStats(uint32_t fromBlockId, uint32_t toBlockId) {
+    std::shared_ptr<const ChainView> view = this->blockchain->getView();
+    json result;
+    BlockStats stats;
+    try {
+        stats = view->getChainStats(fromBlockId, toBlockId);
+    } catch(const std::exception &e) {
+        result["error"] = e.what();
+        return result;
+    }
+    uint64_t blocks = toBlockId - fromBlockId + 1;
+    result["from"] = fromBlockId;
+    result["to"] = toBlockId;
+    result["blocks"] = blocks;
+    result["transactions"] = stats.transactions;
+    result["volume"] = stats.volume;
+    result["fees"] = stats.fees;
+    result["work"] = stats.work;
+    result["avg_difficulty"] = stats.difficulty / (double) blocks;
+    result["avg_block_time"] = stats.interval / (double) blocks;
+    result["transactions_per_second"] = stats.interval > 0 ? stats.transactions / (double) stats.interval : 0;
+    return result;
+}
+
+void RequestManager::setMempoolMaxBytes(size_t maxBytes) {
+    this->mempool->setMaxBytes(maxBytes);
+}
+
+void RequestManager::addBlockListener(BlockListener listener) {
+    this->blockchain->addBlockListener(listener);
+}
+
+void RequestManager::enableWatchList(string path) {
+    std::shared_ptr<WatchList> watchList = std::make_shared<WatchList>();
+    watchList->init(path);
+    watchList->load();
+    this->watchList = watchList;
+    this->blockchain->setWatchList(watchList);
+}
+
+void RequestManager::setWatchListener(std::function<void()> listener) {
+    if (!this->watchList) throw std::runtime_error("Watch list is not enabled");
+    this->watchList->setListener(listener);
+}
+
+json RequestManager::addWatchedAddresses(const vector<PublicWalletAddress>& addresses) {
+    json result;
+    if (!this->watchList) {
+        result["error"] = "Watch list is not enabled";
+        return result;
+    }
+    if (addresses.size() > WATCH_MAX_ADDRESSES_PER_REQUEST) {
+        result["error"] = "At most " + to_string(WATCH_MAX_ADDRESSES_PER_REQUEST) + " addresses per request";
+        return result;
+    }
+    // counts addresses already watched too, a full list only takes removals
+    if (this->watchList->size() + addresses.size() > WATCH_MAX_ADDRESSES) {
+        result["error"] = "At most " + to_string(WATCH_MAX_ADDRESSES) + " addresses can be watched";
+        return result;
+    }
+    result["added"] = this->watchList->addAddresses(addresses);
+    result["watched"] = this->watchList->size();
+    result["cursor"] = this->watchList->getCursor();
+    return result;
+}
+
+json RequestManager::removeWatchedAddresses(const vector<PublicWalletAddress>& addresses) {
+    json result;
+    if (!this->watchList) {
+        result["error"] = "Watch list is not enabled";
+        return result;
+    }
+    if (addresses.size() > WATCH_MAX_ADDRESSES_PER_REQUEST) {
+        result["error"] = "At most " + to_string(WATCH_MAX_ADDRESSES_PER_REQUEST) + " addresses per request";
+        return result;
+    }
+    result["removed"] = this->watchList->removeAddresses(addresses);
+    result["watched"] = this->watchList->size();
+    return result;
+}
+
+uint64_t RequestManager::getWatchCursor() const {
+    if (!this->watchList) throw std::runtime_error("Watch list is not enabled");
+    return this->watchList->getCursor();
+}
+
+json RequestManager::getWatchEvents(uint64_t cursor, size_t limit) {
+    json result;
+    if (!this->watchList) {
+        result["error"] = "Watch list is not enabled";
+        return result;
+    }
+    limit = std::max<size_t>(1, std::min<size_t>(limit, WATCH_EVENTS_MAX_LIMIT));
+    json events = json::array();
+    uint64_t next = cursor;
+    for (auto& event : this->watchList->getEvents(cursor, limit)) {
+        json item;
+        item["cursor"] = event.cursor;
+        item["blockId"] = event.blockId;
+        item["txid"] = SHA256toString(event.txid);
+        item["address"] = walletAddressToString(event.address);
+        item["direction"] = event.sent ? "sent" : "received";
+        item["amount"] = event.amount;
+        item["type"] = event.reverted ? "reverted" : "applied";
+        events.push_back(item);
+        next = event.cursor + 1;
+    }
+    result["events"] = events;
+    result["next"] = next;
+    return result;
+}
@@ -10,24 +10,37 @@
 #include "blockchain.hpp"
 #include "mempool.hpp"
 #include "rate_limiter.hpp"
+#include "watch_list.hpp"
+#include "worker_pool.hpp"
 using namespace std;
 
 
 class RequestManager {
     public:
-        RequestManager(HostManager& hosts, string ledgerPath="", string blockPath="", string txdbPath="");
+        RequestManager(HostManager& hosts, string ledgerPath="", string blockPath="", string txdbPath="", StorageBackends backends=StorageBackends());
         ~RequestManager();
         bool acceptRequest(std::string& ip);
         json addTransaction(Transaction& t);
+        json addTransactions(vector<Transaction>& transactions);
+        // false if the job was refused because the workers are busy or stopped
+        bool runInBackground(std::function<void()> job);
         json getProofOfWork();
         json submitProofOfWork(Block & block);
         json getTransactionQueue();
         json getBlock(uint32_t blockId);
+        json getBlockAtTime(uint64_t timestamp);
+        json getBlocksInTimeRange(uint64_t fromTime, uint64_t toTime, uint32_t start);
         json getLedger(PublicWalletAddress w);
+        json getLedger(PublicWalletAddress w, uint32_t blockId);
+        uint32_t getWalletValues(const vector<PublicWalletAddress>& wallets, vector<WalletValue>& values);
         json getStats();
+        json getChainStats(uint32_t fromBlockId, uint32_t toBlockId);
+        json getFeeEstimate(uint32_t targetBlocks);
         json getTransactionsForWallet(PublicWalletAddress addr);
+        json getWalletTransactions(PublicWalletAddress addr, size_t limit, string before, string after);
         json verifyTransaction(Transaction& t);
         json getTransactionStatus(SHA256Hash txid);
+        json getTransaction(SHA256Hash txid);
         json getSupply();
         json getPeers();
         json getPeerStats();
@@ -35,17 +48,42 @@ class RequestManager {
         json addPeer(string address, uint64_t time, string version, string network);
         BlockHeader getBlockHeader(uint32_t blockId);
         std::pair<uint8_t*, size_t> getRawBlockData(uint32_t blockId);
-        std::pair<char*, size_t> getRawTransactionData();
+        std::shared_ptr<const string> getRawTransactionData();
+        vector<SHA256Hash> requestTransactions(const vector<SHA256Hash>& txids);
+        string getMempoolSketch(size_t cells);
+        vector<Transaction> getTransactionsByShortId(const vector<uint64_t>& shortIds);
         string getBlockCount();
         string getTotalWork();
         uint64_t getNetworkHashrate();
+        void saveMempool();
         void exit();
         void deleteDB();
         void enableRateLimiting(bool enabled);
+        void setDurabilityPolicy(DurabilityPolicy policy);
+        DurabilityPolicy getDurabilityPolicy() const;
+        void setPruneDepth(uint32_t depth);
+        uint32_t getPruneDepth() const;
+        uint32_t getPrunedHeight() const;
+        std::shared_ptr<const ChainView> getView() const;
+        void setArchiveDepth(uint32_t depth);
+        void setMempoolMaxBytes(size_t maxBytes);
+        void addBlockListener(BlockListener listener);
+        void enableWatchList(string path=WATCH_LIST_FILE_PATH);
+        void setWatchListener(std::function<void()> listener);
+        json addWatchedAddresses(const vector<PublicWalletAddress>& addresses);
+        json removeWatchedAddresses(const vector<PublicWalletAddress>& addresses);
+        // the cursor the next watch event will get
+        uint64_t getWatchCursor() const;
+        json getWatchEvents(uint64_t cursor, size_t limit);
     protected:
         bool limitRequests;
         HostManager& hosts;
         std::shared_ptr<RateLimiter> rateLimiter;
         std::shared_ptr<BlockChain> blockchain;
         std::shared_ptr<MemPool> mempool;
+        std::shared_ptr<WatchList> watchList;
+        // splits batch balance lookups, the request jobs wait on it so it outlives them
+        std::shared_ptr<WorkerPool> lookups;
+        // last so its threads are joined before anything their jobs touch goes away
+        std::shared_ptr<WorkerPool> workers;
 };
@@ -0,0 +1,64 @@
+#include "seen_txids.hpp"
+using namespace std;
+
+SeenTxids::SeenTxids(size_t capacity) : sequence(0), capacity(std::max<size_t>(capacity, 1)) {
+}
+
+bool SeenTxids::lookup(const SHA256Hash& txid, ExecutionStatus& status) const {
+    std::unique_lock<std::mutex> ul(lock);
+    auto it = this->entries.find(txid);
+    if (it == this->entries.end()) return false;
+    status = it->second.status;
+    return true;
+}
+
+void SeenTxids::record(const SHA256Hash& txid, ExecutionStatus status) {
+    std::unique_lock<std::mutex> ul(lock);
+    this->requested.erase(txid);
+    auto it = this->entries.find(txid);
+    if (it != this->entries.end()) {
+        it->second.status = status;
+        return;
+    }
+    uint64_t seq = this->sequence++;
+    if (this->ring.size() < this->capacity) {
+        this->ring.push_back(std::make_pair(txid, seq));
+    } else {
+        auto& oldest = this->ring[seq % this->capacity];
+        // the oldest may have been forgotten and seen again since, leave that one
+        auto old = this->entries.find(oldest.first);
+        if (old != this->entries.end() && old->second.sequence == oldest.second) this->entries.erase(old);
+        oldest = std::make_pair(txid, seq);
+    }
+    Entry entry;
+    entry.status = status;
+    entry.sequence = seq;
+    this->entries[txid] = entry;
+}
+
+void SeenTxids::forget(const SHA256Hash& txid) {
+    std::unique_lock<std::mutex> ul(lock);
+    this->entries.erase(txid);
+}
+
+bool SeenTxids::request(const SHA256Hash& txid, uint64_t nowMs) {
+    std::unique_lock<std::mutex> ul(lock);
+    while (!this->requestDeadlines.empty() && this->requestDeadlines.front().first <= nowMs) {
+        auto it = this->requested.find(this->requestDeadlines.front().second);
+        if (it != this->requested.end() && it->second <= nowMs) this->requested.erase(it);
+        this->requestDeadlines.pop_front();
+    }
+    if (this->entries.count(txid) > 0) return false;
+    auto it = this->requested.find(txid);
+    if (it != this->requested.end() && it->second > nowMs) return false;
+    if (this->requested.size() >= this->capacity) return false;
+    uint64_t deadline = nowMs + SEEN_TXIDS_REQUEST_MS;
+    this->requested[txid] = deadline;
+    this->requestDeadlines.push_back(std::make_pair(deadline, txid));
+    return true;
+}
+
+size_t SeenTxids::size() const {
+    std::unique_lock<std::mutex> ul(lock);
+    return this->entries.size();
+}
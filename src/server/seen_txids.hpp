@@ -0,0 +1,43 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "../core/common.hpp"
+#include "executor.hpp"
+using namespace std;
+
+#define SEEN_TXIDS_CAPACITY 100000
+// how long a txid handed out for fetching is not handed out again
+#define SEEN_TXIDS_REQUEST_MS 10000
+
+/*
+    Bounded memory of the transactions this node has already judged and the
+    verdict it reached, so copies arriving from other peers are answered
+    without decoding or verifying them again. The oldest entries fall out
+    first. Txids announced by peers are handed out for fetching once per
+    window, so a transaction announced by several peers is fetched from one.
+*/
+class SeenTxids {
+    public:
+        SeenTxids(size_t capacity = SEEN_TXIDS_CAPACITY);
+        bool lookup(const SHA256Hash& txid, ExecutionStatus& status) const;
+        void record(const SHA256Hash& txid, ExecutionStatus status);
+        void forget(const SHA256Hash& txid);
+        // true if the caller should fetch txid
+        bool request(const SHA256Hash& txid, uint64_t nowMs);
+        size_t size() const;
+    protected:
+        struct Entry {
+            ExecutionStatus status;
+            uint64_t sequence;
+        };
+        std::unordered_map<SHA256Hash, Entry, SHA256Hasher> entries;
+        // entry sequence numbers in insertion order, the slot for sequence s is s % capacity
+        std::vector<std::pair<SHA256Hash, uint64_t>> ring;
+        uint64_t sequence;
+        std::unordered_map<SHA256Hash, uint64_t, SHA256Hasher> requested;
+        std::deque<std::pair<uint64_t, SHA256Hash>> requestDeadlines;
+        size_t capacity;
+        mutable std::mutex lock;
+};
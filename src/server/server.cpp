@@ -18,8 +18,15 @@
 #include "../core/config.hpp"
 #include "../core/logger.hpp"
 #include "request_manager.hpp"
+#include "pufferfish_cache.hpp"
+#include "long_poll.hpp"
 #include "server.hpp"
 
+#define WATCH_EVENTS_DEFAULT_LIMIT 100
+#define LONG_POLL_DEFAULT_TIMEOUT_MS 30000
+#define LONG_POLL_MAX_TIMEOUT_MS 60000
+#define WAIT_TX_MAX_CONFIRMATIONS 100
+
 using namespace std;
 
 
@@ -39,6 +46,11 @@ void rateLimit(RequestManager& manager, uWS::HttpResponse<false>* ptr) {
     if (!manager.acceptRequest(remoteAddress)) ptr->end("Too many requests " + remoteAddress);
 }
 
+bool isLocalRequest(uWS::HttpResponse<false>* ptr) {
+    auto remoteAddress = string(ptr->getRemoteAddressAsText());
+    return remoteAddress == "127.0.0.1" || remoteAddress == "::1" || remoteAddress == "::ffff:127.0.0.1";
+}
+
 namespace {
     std::function<void(int)> shutdown_handler;
     void signal_handler(int signal) { 
@@ -67,6 +79,16 @@ namespace {
 void PandaniteServer::run(json config) {
     srand(time(0));
 
+    // termination signals are taken by a thread of their own rather than a
+    // handler, so shutting down may lock and write files like other code.
+    // blocked before any thread starts so that every thread inherits it
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGQUIT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+
     std::filesystem::path data{ "data" };
 
     if (!std::filesystem::exists(data)) {
@@ -81,10 +103,17 @@ void PandaniteServer::run(json config) {
 
     
     Logger::logStatus("Starting Server Version: ");
+    StorageBackends storage;
+    storage.ledger = storageBackendFromString(config["ledgerStorage"]);
+    storage.blocks = storageBackendFromString(config["blockStorage"]);
+    storage.txdb = storageBackendFromString(config["txdbStorage"]);
+    setPufferfishCacheBackend(storageBackendFromString(config["pufferfishStorage"]));
+    Logger::logStatus("Storage: ledger=" + storageBackendAsString(storage.ledger) + " blocks=" + storageBackendAsString(storage.blocks) + " txdb=" + storageBackendAsString(storage.txdb));
+
     HostManager hosts(config);
 
     
-    RequestManager manager(hosts);
+    RequestManager manager(hosts, "", "", "", storage);
 
     // start downloading headers from peers
     hosts.syncHeadersWithPeers();
@@ -95,17 +124,58 @@ void PandaniteServer::run(json config) {
 
     shutdown_handler = [&](int signal) {
         Logger::logStatus("Shutting down server.");
+        // a crash may have left the pending set half updated, the last periodic save is kept instead
+        if (signal != SIGSEGV) manager.saveMempool();
         manager.exit();
         Logger::logStatus("FINISHED");
     };
 
-    signal(SIGINT, signal_handler);
-    signal(SIGQUIT, signal_handler);
-    signal(SIGTERM, signal_handler);
     signal(SIGSEGV, signal_handler);
+    std::thread([stopSignals]() {
+        int received;
+        if (sigwait(&stopSignals, &received) != 0) return;
+        Logger::logStatus("Received signal " + std::to_string(received));
+        shutdown_handler(received);
+        exit(0);
+    }).detach();
 
 
     if (config["rateLimiter"] == false) manager.enableRateLimiting(false);
+
+    // pruning constrains the durability policy, so it is applied first
+    if (config["pruneDepth"] > 0) {
+        manager.setPruneDepth(config["pruneDepth"]);
+        Logger::logStatus("Pruning blocks older than the last " + to_string(manager.getPruneDepth()));
+    }
+    if (config["archiveDepth"] > 0) {
+        manager.setArchiveDepth(config["archiveDepth"]);
+        Logger::logStatus("Archiving blocks older than the last " + to_string((int)config["archiveDepth"]));
+    }
+
+    if (config["mempoolMB"] > 0) {
+        manager.setMempoolMaxBytes((size_t) config["mempoolMB"] * 1024 * 1024);
+    }
+
+    DurabilityPolicy durability;
+    durability.mode = durabilityModeFromString(config["durability"]);
+    durability.groupCommitBlocks = config["groupCommitBlocks"];
+    durability.groupCommitMs = config["groupCommitMs"];
+    manager.setDurabilityPolicy(durability);
+    Logger::logStatus("Durability mode: " + durabilityModeAsString(manager.getDurabilityPolicy().mode));
+
+    manager.enableWatchList();
+    LongPollQueue longPolls(uWS::Loop::get());
+    manager.setWatchListener([&longPolls]() {
+        longPolls.wake();
+    });
+    TxWaitQueue txWaits(uWS::Loop::get());
+    manager.addBlockListener([&txWaits](Block& block, bool added) {
+        if (added) {
+            txWaits.blockAdded(block);
+        } else {
+            txWaits.blockRemoved(block);
+        }
+    });
     
     Logger::logStatus("RequestManager ready...");
 
@@ -165,6 +235,7 @@ void PandaniteServer::run(json config) {
         response["name"] = string(config["name"]);
         response["version"] = BUILD_VERSION;
         response["networkName"] = string(config["networkName"]);
+        response["prunedHeight"] = manager.getPrunedHeight();
         res->writeHeader("Content-Type", "text/html; charset=utf-8")->end(response.dump());
     };
 
@@ -210,6 +281,7 @@ void PandaniteServer::run(json config) {
         sendCorsHeaders(res);
         json result;
         try {
+            std::shared_ptr<const ChainView> view = manager.getView();
             if (req->getQuery("blockId").length() == 0) {
                 json err;
                 err["error"] = "No query parameters specified";
@@ -217,11 +289,14 @@ void PandaniteServer::run(json config) {
                 return;
             }
             int blockId= std::stoi(string(req->getQuery("blockId")));
-            int count = std::stoi(manager.getBlockCount());
+            int count = view->getBlockCount();
             if (blockId<= 0 || blockId > count) {
                 result["error"] = "Invalid Block";
+            } else if (blockId <= (int)view->getPrunedHeight()) {
+                result["error"] = "Block has been pruned";
+                result["prunedHeight"] = view->getPrunedHeight();
             } else {
-                result = manager.getBlock(blockId);
+                result = view->getBlock(blockId).toJson();
             }
             res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(result.dump());
         } catch(const std::exception &e) {
@@ -234,6 +309,91 @@ void PandaniteServer::run(json config) {
         }
     };
 
+    auto blockAtTimeHandler = [&manager](auto *res, auto *req) {
+        rateLimit(manager, res);
+        sendCorsHeaders(res);
+        try {
+            if (req->getQuery("timestamp").length() == 0) {
+                json err;
+                err["error"] = "No query parameters specified";
+                res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(err.dump());
+                return;
+            }
+            uint64_t timestamp = std::stoull(string(req->getQuery("timestamp")));
+            json result = manager.getBlockAtTime(timestamp);
+            res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(result.dump());
+        } catch(const std::exception &e) {
+            Logger::logError("/block_at_time", e.what());
+            res->end("");
+        } catch(...) {
+            Logger::logError("/block_at_time", "unknown");
+            res->end("");
+        }
+    };
+
+    auto blocksHandler = [&manager](auto *res, auto *req) {
+        rateLimit(manager, res);
+        sendCorsHeaders(res);
+        try {
+            if (req->getQuery("from_time").length() == 0 || req->getQuery("to_time").length() == 0) {
+                json err;
+                err["error"] = "No query parameters specified";
+                res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(err.dump());
+                return;
+            }
+            uint64_t fromTime = std::stoull(string(req->getQuery("from_time")));
+            uint64_t toTime = std::stoull(string(req->getQuery("to_time")));
+            string start = string(req->getQuery("start"));
+            json result = manager.getBlocksInTimeRange(fromTime, toTime, start.length() > 0 ? std::stoul(start) : 0);
+            res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(result.dump());
+        } catch(const std::exception &e) {
+            Logger::logError("/blocks", e.what());
+            res->end("");
+        } catch(...) {
+            Logger::logError("/blocks", "unknown");
+            res->end("");
+        }
+    };
+
+    auto chainStatsHandler = [&manager](auto *res, auto *req) {
+        rateLimit(manager, res);
+        sendCorsHeaders(res);
+        try {
+            if (req->getQuery("from").length() == 0 || req->getQuery("to").length() == 0) {
+                json err;
+                err["error"] = "No query parameters specified";
+                res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(err.dump());
+                return;
+            }
+            uint32_t from = std::stoul(string(req->getQuery("from")));
+            uint32_t to = std::stoul(string(req->getQuery("to")));
+            json result = manager.getChainStats(from, to);
+            res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(result.dump());
+        } catch(const std::exception &e) {
+            Logger::logError("/chain_stats", e.what());
+            res->end("");
+        } catch(...) {
+            Logger::logError("/chain_stats", "unknown");
+            res->end("");
+        }
+    };
+
+    auto feeEstimateHandler = [&manager](auto *res, auto *req) {
+        rateLimit(manager, res);
+        sendCorsHeaders(res);
+        try {
+            string target = string(req->getQuery("target_blocks"));
+            json result = manager.getFeeEstimate(target.length() > 0 ? std::stoul(target) : 1);
+            res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(result.dump());
+        } catch(const std::exception &e) {
+            Logger::logError("/fee_estimate", e.what());
+            res->end("");
+        } catch(...) {
+            Logger::logError("/fee_estimate", "unknown");
+            res->end("");
+        }
+    };
+
     auto mineStatusHandler = [&manager](auto *res, auto *req) {
         rateLimit(manager, res);
         sendCorsHeaders(res);
@@ -274,7 +434,8 @@ void PandaniteServer::run(json config) {
                 return;
             }
             PublicWalletAddress w = stringToWalletAddress(string(req->getQuery("wallet")));
-            json ledger = manager.getLedger(w);
+            string height = string(req->getQuery("height"));
+            json ledger = height.length() > 0 ? manager.getLedger(w, std::stoul(height)) : manager.getLedger(w);
             res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(ledger.dump());
         } catch(const std::exception &e) {
             Logger::logError("/ledger", e.what());
@@ -294,7 +455,16 @@ void PandaniteServer::run(json config) {
                 return;
             }
             PublicWalletAddress w = stringToWalletAddress(string(req->getQuery("wallet")));
-            json ret = manager.getTransactionsForWallet(w);
+            string limit = string(req->getQuery("limit"));
+            string before = string(req->getQuery("before"));
+            string after = string(req->getQuery("after"));
+            json ret;
+            if (limit.length() == 0 && before.length() == 0 && after.length() == 0) {
+                // unpaginated form kept for older clients, returns the full history
+                ret = manager.getTransactionsForWallet(w);
+            } else {
+                ret = manager.getWalletTransactions(w, limit.length() > 0 ? std::stoul(limit) : 0, before, after);
+            }
             res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(ret.dump());
         } catch(const std::exception &e) {
             Logger::logError("/wallet", e.what());
@@ -303,6 +473,32 @@ void PandaniteServer::run(json config) {
         }
     };
 
+    auto transactionHandler = [&manager](auto *res, auto *req) {
+        rateLimit(manager, res);
+        sendCorsHeaders(res);
+        try {
+            if (req->getQuery("txid").length() == 0) {
+                json err;
+                err["error"] = "No query parameters specified";
+                res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(err.dump());
+                return;
+            }
+            SHA256Hash txid = stringToSHA256(string(req->getQuery("txid")));
+            json ret = manager.getTransaction(txid);
+            res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(ret.dump());
+        } catch(const std::exception &e) {
+            json response;
+            response["error"] = string(e.what());
+            res->end(response.dump());
+            Logger::logError("/transaction", e.what());
+        } catch(...) {
+            json response;
+            response["error"] = "unknown";
+            res->end(response.dump());
+            Logger::logError("/transaction", "unknown");
+        }
+    };
+
     // TODO: remove this once all nodes and clients migrated
     auto ledgerHandlerDeprecated = [&manager](auto *res, auto *req) {
         rateLimit(manager, res);
@@ -473,11 +669,9 @@ void PandaniteServer::run(json config) {
         sendCorsHeaders(res);
         try {
             res->writeHeader("Content-Type", "application/octet-stream");
-            std::pair<char*, size_t> buffer = manager.getRawTransactionData();
-            std::string_view str(buffer.first, buffer.second);
-            res->write(str);
-            delete buffer.first;
-            res->end("");
+            // a shared snapshot, no mempool lock is held while it is written out
+            std::shared_ptr<const string> buffer = manager.getRawTransactionData();
+            res->end(std::string_view(*buffer));
         } catch(const std::exception &e) {
             Logger::logError("/gettx", e.what());
         } catch(...) {
@@ -520,15 +714,26 @@ void PandaniteServer::run(json config) {
         rateLimit(manager, res);
         sendCorsHeaders(res);
         try {
+            // one view for the whole response so every block comes from the same chain
+            std::shared_ptr<const ChainView> view = manager.getView();
             int start = std::stoi(string(req->getParameter(0)));
             int end = std::stoi(string(req->getParameter(1)));
             if ((end-start) > BLOCKS_PER_FETCH) {
                 Logger::logError("/sync", "invalid range requested");
                 res->end("");
+                return;
+            }
+            uint32_t prunedHeight = view->getPrunedHeight();
+            if (start <= (int)prunedHeight) {
+                json err;
+                err["error"] = "Blocks up to " + to_string(prunedHeight) + " have been pruned";
+                err["prunedHeight"] = prunedHeight;
+                res->writeStatus("410 Gone")->writeHeader("Content-Type", "application/json; charset=utf-8")->end(err.dump());
+                return;
             }
             res->writeHeader("Content-Type", "application/octet-stream");
             for (int i = start; i <=end; i++) {
-                std::pair<uint8_t*, size_t> buffer = manager.getRawBlockData(i);
+                std::pair<uint8_t*, size_t> buffer = view->getRaw(i);
                 std::string_view str((char*)buffer.first, buffer.second);
                 res->write(str);
                 delete buffer.first;
@@ -548,6 +753,7 @@ void PandaniteServer::run(json config) {
         rateLimit(manager, res);
         sendCorsHeaders(res);
         try {
+            std::shared_ptr<const ChainView> view = manager.getView();
             int start = std::stoi(string(req->getParameter(0)));
             int end = std::stoi(string(req->getParameter(1)));
             if ((end-start) > BLOCK_HEADERS_PER_FETCH) {
@@ -556,7 +762,7 @@ void PandaniteServer::run(json config) {
             }
             res->writeHeader("Content-Type", "application/octet-stream");
             for (int i = start; i <=end; i++) {
-                BlockHeader b = manager.getBlockHeader(i);
+                BlockHeader b = view->getBlockHeader(i);
                 char bhBytes[BLOCKHEADER_BUFFER_SIZE];
                 blockHeaderToBuffer(b, bhBytes);
                 std::string_view str(bhBytes, BLOCKHEADER_BUFFER_SIZE);
@@ -578,12 +784,16 @@ void PandaniteServer::run(json config) {
         sendCorsHeaders(res);
         json result;
         try {
+            std::shared_ptr<const ChainView> view = manager.getView();
             int blockId= std::stoi(string(req->getParameter(0)));
-            int count = std::stoi(manager.getBlockCount());
+            int count = view->getBlockCount();
             if (blockId<= 0 || blockId > count) {
                 result["error"] = "Invalid Block";
+            } else if (blockId <= (int)view->getPrunedHeight()) {
+                result["error"] = "Block has been pruned";
+                result["prunedHeight"] = view->getPrunedHeight();
             } else {
-                result = manager.getBlock(blockId);
+                result = view->getBlock(blockId).toJson();
             }
             res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(result.dump());
         } catch(const std::exception &e) {
@@ -625,6 +835,7 @@ void PandaniteServer::run(json config) {
         rateLimit(manager, res);
         sendCorsHeaders(res);
         try {
+            std::shared_ptr<const ChainView> view = manager.getView();
             if (req->getQuery("start").length() == 0 || req->getQuery("end").length() == 0) {
                 json err;
                 err["error"] = "No query parameters specified";
@@ -636,10 +847,19 @@ void PandaniteServer::run(json config) {
             if ((end-start) > BLOCKS_PER_FETCH) {
                 Logger::logError("/v2/sync", "invalid range requested");
                 res->end("");
+                return;
+            }
+            uint32_t prunedHeight = view->getPrunedHeight();
+            if (start <= (int)prunedHeight) {
+                json err;
+                err["error"] = "Blocks up to " + to_string(prunedHeight) + " have been pruned";
+                err["prunedHeight"] = prunedHeight;
+                res->writeStatus("410 Gone")->writeHeader("Content-Type", "application/json; charset=utf-8")->end(err.dump());
+                return;
             }
             res->writeHeader("Content-Type", "application/octet-stream");
             for (int i = start; i <=end; i++) {
-                std::pair<uint8_t*, size_t> buffer = manager.getRawBlockData(i);
+                std::pair<uint8_t*, size_t> buffer = view->getRaw(i);
                 std::string_view str((char*)buffer.first, buffer.second);
                 res->write(str);
                 delete buffer.first;
@@ -659,6 +879,7 @@ void PandaniteServer::run(json config) {
         rateLimit(manager, res);
         sendCorsHeaders(res);
         try {
+            std::shared_ptr<const ChainView> view = manager.getView();
             if (req->getQuery("start").length() == 0 || req->getQuery("end").length() == 0) {
                 json err;
                 err["error"] = "No query parameters specified";
@@ -673,7 +894,7 @@ void PandaniteServer::run(json config) {
             }
             res->writeHeader("Content-Type", "application/octet-stream");
             for (int i = start; i <=end; i++) {
-                BlockHeader b = manager.getBlockHeader(i);
+                BlockHeader b = view->getBlockHeader(i);
                 char bhBytes[BLOCKHEADER_BUFFER_SIZE];
                 blockHeaderToBuffer(b, bhBytes);
                 std::string_view str(bhBytes, BLOCKHEADER_BUFFER_SIZE);
@@ -690,14 +911,16 @@ void PandaniteServer::run(json config) {
         });
     };
 
+    // the batch is admitted off the event loop, the response is written back on it
     auto addTransactionHandler = [&manager](auto *res, auto *req) {
         rateLimit(manager, res);
         sendCorsHeaders(res);
-        res->onAborted([res]() {
-            res->end("ABORTED");
+        std::shared_ptr<bool> aborted = std::make_shared<bool>(false);
+        res->onAborted([aborted]() {
+            *aborted = true;
         });
         std::string buffer;
-        res->onData([res, buffer = std::move(buffer), &manager](std::string_view data, bool last) mutable {
+        res->onData([res, buffer = std::move(buffer), aborted, &manager](std::string_view data, bool last) mutable {
             buffer.append(data.data(), data.length());
             checkBuffer(buffer, res);
             if (last) {
@@ -710,13 +933,30 @@ void PandaniteServer::run(json config) {
                     } else {
                         uint32_t numTransactions = buffer.length() / TRANSACTIONINFO_BUFFER_SIZE;
                         const char* buf = buffer.c_str();
-                        json response = json::array();
-                        for (int i = 0; i < numTransactions; i++) {
-                            TransactionInfo t = transactionInfoFromBuffer(buffer.c_str());
-                            Transaction tx(t);
-                            response.push_back(manager.addTransaction(tx));
+                        vector<Transaction> transactions;
+                        transactions.reserve(numTransactions);
+                        for (uint32_t i = 0; i < numTransactions; i++) {
+                            TransactionInfo t = transactionInfoFromBuffer(buf + i * TRANSACTIONINFO_BUFFER_SIZE);
+                            transactions.push_back(Transaction(t));
+                        }
+                        uWS::Loop* loop = uWS::Loop::get();
+                        bool queued = manager.runInBackground([res, loop, aborted, transactions = std::move(transactions), &manager]() mutable {
+                            json response;
+                            try {
+                                response = manager.addTransactions(transactions);
+                            } catch(const std::exception &e) {
+                                response["error"] = string(e.what());
+                                Logger::logError("/add_transaction", e.what());
+                            }
+                            loop->defer([res, aborted, response = std::move(response)]() {
+                                if (!*aborted) res->end(response.dump());
+                            });
+                        });
+                        if (!queued) {
+                            json response;
+                            response["error"] = "Server busy";
+                            res->end(response.dump());
                         }
-                        res->end(response.dump());
                     }
                 }  catch(const std::exception &e) {
                     Logger::logError("/add_transaction", e.what());
@@ -727,6 +967,326 @@ void PandaniteServer::run(json config) {
         });
     };
 
+    // our mempool as a reconciliation sketch, see MemPool::reconcile
+    auto mempoolSketchHandler = [&manager](auto *res, auto *req) {
+        rateLimit(manager, res);
+        sendCorsHeaders(res);
+        try {
+            string cellsArg = string(req->getQuery("cells"));
+            size_t cells = cellsArg.length() > 0 ? std::stoul(cellsArg) : MEMPOOL_SKETCH_MIN_CELLS;
+            string sketch = manager.getMempoolSketch(cells);
+            res->writeHeader("Content-Type", "application/octet-stream");
+            res->end(sketch);
+        } catch(const std::exception &e) {
+            json response;
+            response["error"] = string(e.what());
+            res->end(response.dump());
+            Logger::logError("/mempool_sketch", e.what());
+        } catch(...) {
+            json response;
+            response["error"] = "unknown";
+            res->end(response.dump());
+            Logger::logError("/mempool_sketch", "unknown");
+        }
+    };
+
+    // the pending transactions matching a list of short txids
+    auto mempoolFetchHandler = [&manager](auto *res, auto *req) {
+        rateLimit(manager, res);
+        sendCorsHeaders(res);
+        res->onAborted([res]() {
+            res->end("ABORTED");
+        });
+        std::string buffer;
+        res->onData([res, buffer = std::move(buffer), &manager](std::string_view data, bool last) mutable {
+            buffer.append(data.data(), data.length());
+            checkBuffer(buffer, res);
+            if (last) {
+                try {
+                    vector<uint64_t> shortIds(buffer.size() / sizeof(uint64_t));
+                    const char* ptr = buffer.data();
+                    for (auto& id : shortIds) id = readNetworkUint64(ptr);
+                    vector<Transaction> transactions = manager.getTransactionsByShortId(shortIds);
+                    string body(transactions.size() * TRANSACTIONINFO_BUFFER_SIZE, '\0');
+                    for (size_t i = 0; i < transactions.size(); i++) {
+                        TransactionInfo info = transactions[i].serialize();
+                        transactionInfoToBuffer(info, &body[i * TRANSACTIONINFO_BUFFER_SIZE]);
+                    }
+                    res->writeHeader("Content-Type", "application/octet-stream");
+                    res->end(body);
+                } catch(const std::exception &e) {
+                    Logger::logError("/mempool_fetch", e.what());
+                } catch(...) {
+                    Logger::logError("/mempool_fetch", "unknown");
+                }
+            }
+        });
+    };
+
+    // a peer announces txids, the answer is the ones it should send us
+    auto txInventoryHandler = [&manager](auto *res, auto *req) {
+        rateLimit(manager, res);
+        sendCorsHeaders(res);
+        res->onAborted([res]() {
+            res->end("ABORTED");
+        });
+        std::string buffer;
+        res->onData([res, buffer = std::move(buffer), &manager](std::string_view data, bool last) mutable {
+            buffer.append(data.data(), data.length());
+            checkBuffer(buffer, res);
+            if (last) {
+                try {
+                    vector<SHA256Hash> txids(buffer.size() / sizeof(SHA256Hash));
+                    for (size_t i = 0; i < txids.size(); i++) {
+                        memcpy(txids[i].data(), buffer.data() + i * sizeof(SHA256Hash), sizeof(SHA256Hash));
+                    }
+                    vector<SHA256Hash> wanted = manager.requestTransactions(txids);
+                    res->writeHeader("Content-Type", "application/octet-stream");
+                    res->end(std::string_view((const char*) wanted.data(), wanted.size() * sizeof(SHA256Hash)));
+                } catch(const std::exception &e) {
+                    Logger::logError("/tx_inventory", e.what());
+                } catch(...) {
+                    Logger::logError("/tx_inventory", "unknown");
+                }
+            }
+        });
+    };
+
+    // one request looks up a whole batch of wallets and is rate limited once,
+    // the lookups and the response body are built off the event loop
+    auto ledgerBatchHandler = [&manager](auto *res, auto *req) {
+        rateLimit(manager, res);
+        sendCorsHeaders(res);
+        std::shared_ptr<bool> aborted = std::make_shared<bool>(false);
+        res->onAborted([aborted]() {
+            *aborted = true;
+        });
+        bool binary = req->getHeader("content-type") == "application/octet-stream";
+        std::string buffer;
+        res->onData([res, buffer = std::move(buffer), aborted, binary, &manager](std::string_view data, bool last) mutable {
+            buffer.append(data.data(), data.length());
+            checkBuffer(buffer, res);
+            if (last) {
+                try {
+                    vector<PublicWalletAddress> wallets;
+                    if (binary) {
+                        if (buffer.size() % 25 != 0) {
+                            json response;
+                            response["error"] = "Malformed wallet list";
+                            res->end(response.dump());
+                            return;
+                        }
+                        wallets.resize(buffer.size() / 25);
+                        for (size_t i = 0; i < wallets.size(); i++) {
+                            memcpy(wallets[i].data(), buffer.data() + i * 25, 25);
+                        }
+                    } else {
+                        json parsed = json::parse(buffer);
+                        if (parsed.is_object()) parsed = parsed["wallets"];
+                        for (auto& item : parsed) {
+                            wallets.push_back(stringToWalletAddress(item));
+                        }
+                    }
+                    uWS::Loop* loop = uWS::Loop::get();
+                    bool queued = manager.runInBackground([res, loop, aborted, binary, wallets = std::move(wallets), &manager]() {
+                        std::string body;
+                        std::string contentType;
+                        try {
+                            vector<WalletValue> values;
+                            uint32_t blockCount = manager.getWalletValues(wallets, values);
+                            if (binary) {
+                                contentType = "application/octet-stream";
+                                body.resize(4 + values.size() * 9);
+                                char* ptr = &body[0];
+                                writeNetworkUint32(ptr, blockCount);
+                                for (size_t i = 0; i < values.size(); i++) {
+                                    *ptr++ = values[i].found ? 1 : 0;
+                                    writeNetworkUint64(ptr, values[i].balance);
+                                }
+                            } else {
+                                contentType = "application/json; charset=utf-8";
+                                body = "{\"height\":" + to_string(blockCount) + ",\"balances\":[";
+                                for (size_t i = 0; i < values.size(); i++) {
+                                    if (i > 0) body += ",";
+                                    body += values[i].found ? to_string(values[i].balance) : "null";
+                                }
+                                body += "]}";
+                            }
+                        } catch(const std::exception &e) {
+                            json response;
+                            response["error"] = string(e.what());
+                            contentType = "";
+                            body = response.dump();
+                            Logger::logError("/ledger_batch", e.what());
+                        }
+                        loop->defer([res, aborted, contentType = std::move(contentType), body = std::move(body)]() {
+                            if (*aborted) return;
+                            if (contentType.length() > 0) res->writeHeader("Content-Type", contentType);
+                            res->end(body);
+                        });
+                    });
+                    if (!queued) {
+                        json response;
+                        response["error"] = "Server busy";
+                        res->end(response.dump());
+                    }
+                } catch(const std::exception &e) {
+                    json response;
+                    response["error"] = string(e.what());
+                    res->end(response.dump());
+                    Logger::logError("/ledger_batch", e.what());
+                } catch(...) {
+                    json response;
+                    response["error"] = "unknown";
+                    res->end(response.dump());
+                    Logger::logError("/ledger_batch", "unknown");
+                }
+            }
+        });
+    };
+
+    // the watch list is shared by every client of the node, only the
+    // operator may change it unless --watch-remote opens it up
+    bool watchRemote = config["watchRemote"];
+    auto watchAddressesHandler = [&manager, watchRemote](bool add) {
+        return [&manager, add, watchRemote](auto *res, auto *req) {
+            rateLimit(manager, res);
+            sendCorsHeaders(res);
+            if (!watchRemote && !isLocalRequest(res)) {
+                json response;
+                response["error"] = "The watch list can only be changed from localhost";
+                res->end(response.dump());
+                return;
+            }
+            res->onAborted([res]() {
+                res->end("ABORTED");
+            });
+            std::string buffer;
+            res->onData([res, buffer = std::move(buffer), add, &manager](std::string_view data, bool last) mutable {
+                buffer.append(data.data(), data.length());
+                checkBuffer(buffer, res);
+                if (last) {
+                    try {
+                        json parsed = json::parse(buffer);
+                        if (parsed.is_object()) parsed = parsed["addresses"];
+                        vector<PublicWalletAddress> addresses;
+                        for (auto& item : parsed) {
+                            addresses.push_back(stringToWalletAddress(item));
+                        }
+                        json result = add ? manager.addWatchedAddresses(addresses) : manager.removeWatchedAddresses(addresses);
+                        res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(result.dump());
+                    } catch(const std::exception &e) {
+                        json response;
+                        response["error"] = string(e.what());
+                        res->end(response.dump());
+                        Logger::logError("/watch", e.what());
+                    } catch(...) {
+                        json response;
+                        response["error"] = "unknown";
+                        res->end(response.dump());
+                        Logger::logError("/watch", "unknown");
+                    }
+                }
+            });
+        };
+    };
+
+    // held open until an event at or after the cursor exists or the timeout passes
+    auto watchEventsHandler = [&manager, &longPolls](auto *res, auto *req) {
+        rateLimit(manager, res);
+        sendCorsHeaders(res);
+        try {
+            string cursorArg = string(req->getQuery("cursor"));
+            string limitArg = string(req->getQuery("limit"));
+            string timeoutArg = string(req->getQuery("timeout"));
+            uint64_t cursor = cursorArg.length() > 0 ? std::stoull(cursorArg) : 0;
+            size_t limit = limitArg.length() > 0 ? std::stoul(limitArg) : WATCH_EVENTS_DEFAULT_LIMIT;
+            uint64_t timeout = timeoutArg.length() > 0 ? std::stoull(timeoutArg) : LONG_POLL_DEFAULT_TIMEOUT_MS;
+            timeout = std::min<uint64_t>(timeout, LONG_POLL_MAX_TIMEOUT_MS);
+            std::shared_ptr<bool> aborted = std::make_shared<bool>(false);
+            res->onAborted([aborted]() {
+                *aborted = true;
+            });
+            longPolls.park(timeout, [res, aborted, cursor, limit, &manager](bool timedOut) {
+                if (*aborted) return true;
+                json result;
+                try {
+                    // the log is only read once it has grown past the cursor
+                    if (!timedOut && manager.getWatchCursor() <= cursor) return false;
+                    result = manager.getWatchEvents(cursor, limit);
+                } catch(const std::exception &e) {
+                    result["error"] = string(e.what());
+                    Logger::logError("/watch/events", e.what());
+                }
+                res->cork([res, &result]() {
+                    res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(result.dump());
+                });
+                return true;
+            });
+        } catch(const std::exception &e) {
+            json response;
+            response["error"] = string(e.what());
+            res->end(response.dump());
+            Logger::logError("/watch/events", e.what());
+        } catch(...) {
+            json response;
+            response["error"] = "unknown";
+            res->end(response.dump());
+            Logger::logError("/watch/events", "unknown");
+        }
+    };
+
+    // held open until the transaction has the confirmations asked for or the timeout passes
+    auto waitTxHandler = [&manager, &txWaits](auto *res, auto *req) {
+        rateLimit(manager, res);
+        sendCorsHeaders(res);
+        try {
+            string txidArg = string(req->getQuery("txid"));
+            string confirmationsArg = string(req->getQuery("confirmations"));
+            string timeoutArg = string(req->getQuery("timeout"));
+            if (txidArg.length() == 0) {
+                json err;
+                err["error"] = "No txid specified";
+                res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(err.dump());
+                return;
+            }
+            SHA256Hash txid = stringToSHA256(txidArg);
+            uint32_t confirmations = confirmationsArg.length() > 0 ? std::stoul(confirmationsArg) : 1;
+            confirmations = std::max<uint32_t>(1, std::min<uint32_t>(confirmations, WAIT_TX_MAX_CONFIRMATIONS));
+            uint64_t timeout = timeoutArg.length() > 0 ? std::stoull(timeoutArg) : LONG_POLL_DEFAULT_TIMEOUT_MS;
+            timeout = std::min<uint64_t>(timeout, LONG_POLL_MAX_TIMEOUT_MS);
+
+            json status = manager.getTransactionStatus(txid);
+            status["txid"] = txidArg;
+            if (status["confirmations"] >= confirmations || timeout == 0) {
+                res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(status.dump());
+                return;
+            }
+            uint32_t blockId = status["status"] == "IN_CHAIN" ? (uint32_t) status["blockId"] : 0;
+            std::shared_ptr<bool> aborted = std::make_shared<bool>(false);
+            res->onAborted([aborted]() {
+                *aborted = true;
+            });
+            txWaits.park(txid, blockId, confirmations, timeout, aborted, [res, txid, txidArg, &manager]() {
+                json result = manager.getTransactionStatus(txid);
+                result["txid"] = txidArg;
+                res->cork([res, &result]() {
+                    res->writeHeader("Content-Type", "application/json; charset=utf-8")->end(result.dump());
+                });
+            });
+        } catch(const std::exception &e) {
+            json response;
+            response["error"] = string(e.what());
+            res->end(response.dump());
+            Logger::logError("/wait_tx", e.what());
+        } catch(...) {
+            json response;
+            response["error"] = "unknown";
+            res->end(response.dump());
+            Logger::logError("/wait_tx", "unknown");
+        }
+    };
+
     auto addTransactionJSONHandler = [&manager](auto *res, auto *req) {
         rateLimit(manager, res);
         sendCorsHeaders(res);
@@ -740,23 +1300,19 @@ void PandaniteServer::run(json config) {
             if (last) {
                 try {
                     json parsed = json::parse(string(buffer));
-                    json response = json::array();
+                    vector<Transaction> transactions;
                     if (parsed.is_array()) {
                         for (auto& item : parsed) {
-                            Transaction tx(item);
-                            json result;
-                            result["txid"] = SHA256toString(tx.hashContents());
-                            result["status"] = manager.addTransaction(tx)["status"];
-                            response.push_back(result);
+                            transactions.push_back(Transaction(item));
                             // only add a maximum of 100 transactions per request
-                            if (response.size() > 100) break;
+                            if (transactions.size() > 100) break;
                         }
                     } else {
-                        Transaction tx(parsed);
-                        json result;
-                        result["txid"] = SHA256toString(tx.hashContents());
-                        result["status"] = manager.addTransaction(tx)["status"];
-                        response.push_back(result);
+                        transactions.push_back(Transaction(parsed));
+                    }
+                    json response = manager.addTransactions(transactions);
+                    for (size_t i = 0; i < transactions.size(); i++) {
+                        response[i]["txid"] = SHA256toString(transactions[i].hashContents());
                     }
                     res->end(response.dump());
                 }  catch(const std::exception &e) {
@@ -849,11 +1405,16 @@ void PandaniteServer::run(json config) {
         .get("/block_count", blockCountHandler)
         .get("/logs", logsHandler)
         .get("/stats", statsHandler)
+        .get("/chain_stats", chainStatsHandler)
+        .get("/fee_estimate", feeEstimateHandler)
         .get("/block", blockHandler)
+        .get("/block_at_time", blockAtTimeHandler)
+        .get("/blocks", blocksHandler)
         .get("/tx_json", txJsonHandler)
         .get("/mine_status", mineStatusHandler)
         .get("/ledger", ledgerHandler)
         .get("/wallet_transactions", walletHandler)
+        .get("/transaction", transactionHandler)
         .get("/gettx/:blockId", getTxHandler) // DEPRECATED
         .get("/mine_status/:b", mineStatusHandlerDeprecated) // DEPRECATED
         .get("/ledger/:user", ledgerHandlerDeprecated) // DEPRECATED
@@ -872,7 +1433,15 @@ void PandaniteServer::run(json config) {
         .get("/create_wallet", createWalletHandler)
         .post("/create_transaction", createTransactionHandler)
         .post("/add_transaction", addTransactionHandler)
+        .post("/tx_inventory", txInventoryHandler)
+        .get("/mempool_sketch", mempoolSketchHandler)
+        .post("/mempool_fetch", mempoolFetchHandler)
         .post("/add_transaction_json", addTransactionJSONHandler)
+        .post("/ledger_batch", ledgerBatchHandler)
+        .post("/watch/add", watchAddressesHandler(true))
+        .post("/watch/remove", watchAddressesHandler(false))
+        .get("/watch/events", watchEventsHandler)
+        .get("/wait_tx", waitTxHandler)
         .post("/verify_transaction", verifyTransactionHandler)
         .options("/name", corsHandler)
         .options("/total_work", corsHandler)
@@ -881,6 +1450,7 @@ void PandaniteServer::run(json config) {
         .options("/logs", corsHandler)
         .options("/stats", corsHandler)
         .options("/wallet_transactions", corsHandler)
+        .options("/transaction", corsHandler)
         .options("/block", corsHandler)
         .options("/tx_json", corsHandler)
         .options("/mine_status", corsHandler)
@@ -897,6 +1467,15 @@ void PandaniteServer::run(json config) {
         .options("/add_transaction", corsHandler)
         .options("/add_transaction_json", corsHandler)
         .options("/verify_transaction", corsHandler)
+        .options("/watch/add", corsHandler)
+        .options("/watch/remove", corsHandler)
+        .options("/watch/events", corsHandler)
+        .options("/wait_tx", corsHandler)
+        .options("/chain_stats", corsHandler)
+        .options("/fee_estimate", corsHandler)
+        .options("/block_at_time", corsHandler)
+        .options("/blocks", corsHandler)
+        .options("/ledger_batch", corsHandler)
         
         
         .listen((int)config["port"], [&hosts](auto *token) {
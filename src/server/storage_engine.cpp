@@ -0,0 +1,382 @@
+#include <map>
+#include <set>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <stdexcept>
+#include "storage_engine.hpp"
+using namespace std;
+
+StorageBackend storageBackendFromString(string backend) {
+    if (backend == "leveldb") return STORAGE_LEVELDB;
+    if (backend == "memory") return STORAGE_MEMORY;
+    throw std::runtime_error("Unknown storage backend: " + backend);
+}
+
+string storageBackendAsString(StorageBackend backend) {
+    switch (backend) {
+        case STORAGE_LEVELDB: return "leveldb";
+        case STORAGE_MEMORY: return "memory";
+    }
+    return "unknown";
+}
+
+class LevelDBStorageEngine : public StorageEngine {
+    public:
+        LevelDBStorageEngine(leveldb::DB* db) : db(db) {}
+        ~LevelDBStorageEngine() {
+            delete db;
+        }
+        leveldb::Status get(const leveldb::ReadOptions& options, const leveldb::Slice& key, string* value) {
+            return db->Get(options, key, value);
+        }
+        leveldb::Status put(const leveldb::WriteOptions& options, const leveldb::Slice& key, const leveldb::Slice& value) {
+            return db->Put(options, key, value);
+        }
+        leveldb::Status remove(const leveldb::WriteOptions& options, const leveldb::Slice& key) {
+            return db->Delete(options, key);
+        }
+        leveldb::Status write(const leveldb::WriteOptions& options, leveldb::WriteBatch* batch) {
+            return db->Write(options, batch);
+        }
+        leveldb::Iterator* newIterator(const leveldb::ReadOptions& options) {
+            return db->NewIterator(options);
+        }
+        const leveldb::Snapshot* getSnapshot() {
+            return db->GetSnapshot();
+        }
+        void releaseSnapshot(const leveldb::Snapshot* snapshot) {
+            db->ReleaseSnapshot(snapshot);
+        }
+    protected:
+        leveldb::DB* db;
+};
+
+/*
+    Sorted in-memory table with multi-version values. While no snapshot or
+    iterator is open a write simply replaces the key. Otherwise writes append
+    a version stamped with a sequence number so readers keep seeing the state
+    as of their own sequence, and deleted keys stay as tombstones so open
+    iterators never point at erased nodes. Versions nobody can see any more
+    are trimmed when the oldest reader goes away.
+*/
+struct MemoryVersion {
+    uint64_t sequence;
+    bool deleted;
+    string value;
+};
+
+class MemoryTable {
+    public:
+        MemoryTable() : sequence(0) {}
+        std::mutex lock;
+        map<string, vector<MemoryVersion>> data;
+        multiset<uint64_t> readers;
+        set<string> dirty;
+        uint64_t sequence;
+
+        static const MemoryVersion* visible(const vector<MemoryVersion>& versions, uint64_t sequence) {
+            for (auto it = versions.rbegin(); it != versions.rend(); it++) {
+                if (it->sequence <= sequence) return it->deleted ? NULL : &*it;
+            }
+            return NULL;
+        }
+
+        void apply(const string& key, bool deleted, const string& value, uint64_t seq) {
+            auto it = this->data.find(key);
+            if (this->readers.empty()) {
+                if (deleted) {
+                    if (it != this->data.end()) this->data.erase(it);
+                } else {
+                    this->data[key] = vector<MemoryVersion>{{seq, false, value}};
+                }
+                return;
+            }
+            if (it == this->data.end()) {
+                if (deleted) return;
+                it = this->data.emplace(key, vector<MemoryVersion>()).first;
+            }
+            vector<MemoryVersion>& versions = it->second;
+            // the latest version can be overwritten if no reader is old enough to need it
+            if (!versions.empty() && versions.back().sequence > *this->readers.rbegin()) {
+                versions.back() = {seq, deleted, value};
+            } else {
+                versions.push_back({seq, deleted, value});
+            }
+            this->dirty.insert(key);
+        }
+
+        void addReader(uint64_t seq) {
+            this->readers.insert(seq);
+        }
+
+        void removeReader(uint64_t seq) {
+            auto it = this->readers.find(seq);
+            if (it == this->readers.end()) return;
+            bool wasOldest = it == this->readers.begin();
+            this->readers.erase(it);
+            if (wasOldest) this->trim();
+        }
+
+        void trim() {
+            uint64_t oldest = this->readers.empty() ? this->sequence : *this->readers.begin();
+            for (auto key = this->dirty.begin(); key != this->dirty.end();) {
+                auto it = this->data.find(*key);
+                if (it == this->data.end()) {
+                    key = this->dirty.erase(key);
+                    continue;
+                }
+                vector<MemoryVersion>& versions = it->second;
+                size_t keep = 0;
+                for (size_t i = 0; i < versions.size(); i++) {
+                    if (versions[i].sequence <= oldest) keep = i;
+                }
+                versions.erase(versions.begin(), versions.begin() + keep);
+                bool settled = versions.size() == 1 && versions[0].sequence <= oldest;
+                if (settled && versions[0].deleted && this->readers.empty()) {
+                    this->data.erase(it);
+                } else if (!settled || versions[0].deleted) {
+                    key++;
+                    continue;
+                }
+                key = this->dirty.erase(key);
+            }
+        }
+};
+
+class MemorySnapshot : public leveldb::Snapshot {
+    public:
+        MemorySnapshot(uint64_t sequence) : sequence(sequence) {}
+        ~MemorySnapshot() {}
+        uint64_t sequence;
+};
+
+class MemoryIterator : public leveldb::Iterator {
+    public:
+        // created under the table lock, with sequence already registered as a reader
+        MemoryIterator(std::shared_ptr<MemoryTable> table, uint64_t sequence) : table(table), sequence(sequence), valid(false) {
+            this->pos = table->data.end();
+        }
+        ~MemoryIterator() {
+            std::unique_lock<std::mutex> ul(table->lock);
+            table->removeReader(this->sequence);
+        }
+        bool Valid() const {
+            return this->valid;
+        }
+        void SeekToFirst() {
+            std::unique_lock<std::mutex> ul(table->lock);
+            this->pos = table->data.begin();
+            this->settleForward();
+        }
+        void SeekToLast() {
+            std::unique_lock<std::mutex> ul(table->lock);
+            this->pos = table->data.end();
+            if (this->pos == table->data.begin()) {
+                this->valid = false;
+                return;
+            }
+            this->pos--;
+            this->settleBackward();
+        }
+        void Seek(const leveldb::Slice& target) {
+            std::unique_lock<std::mutex> ul(table->lock);
+            this->pos = table->data.lower_bound(target.ToString());
+            this->settleForward();
+        }
+        void Next() {
+            std::unique_lock<std::mutex> ul(table->lock);
+            this->pos++;
+            this->settleForward();
+        }
+        void Prev() {
+            std::unique_lock<std::mutex> ul(table->lock);
+            if (this->pos == table->data.begin()) {
+                this->valid = false;
+                return;
+            }
+            this->pos--;
+            this->settleBackward();
+        }
+        leveldb::Slice key() const {
+            return leveldb::Slice(this->currentKey);
+        }
+        leveldb::Slice value() const {
+            return leveldb::Slice(this->currentValue);
+        }
+        leveldb::Status status() const {
+            return leveldb::Status::OK();
+        }
+    protected:
+        // values are copied out because later writes may reallocate the version list
+        void load(const MemoryVersion* version) {
+            this->valid = true;
+            this->currentKey = this->pos->first;
+            this->currentValue = version->value;
+        }
+        void settleForward() {
+            for (; this->pos != table->data.end(); this->pos++) {
+                const MemoryVersion* version = MemoryTable::visible(this->pos->second, this->sequence);
+                if (version) return this->load(version);
+            }
+            this->valid = false;
+        }
+        void settleBackward() {
+            while (true) {
+                const MemoryVersion* version = MemoryTable::visible(this->pos->second, this->sequence);
+                if (version) return this->load(version);
+                if (this->pos == table->data.begin()) break;
+                this->pos--;
+            }
+            this->valid = false;
+        }
+        std::shared_ptr<MemoryTable> table;
+        uint64_t sequence;
+        map<string, vector<MemoryVersion>>::iterator pos;
+        bool valid;
+        string currentKey;
+        string currentValue;
+};
+
+class MemoryBatchHandler : public leveldb::WriteBatch::Handler {
+    public:
+        MemoryBatchHandler(MemoryTable& table, uint64_t sequence) : table(table), sequence(sequence) {}
+        void Put(const leveldb::Slice& key, const leveldb::Slice& value) {
+            table.apply(key.ToString(), false, value.ToString(), sequence);
+        }
+        void Delete(const leveldb::Slice& key) {
+            table.apply(key.ToString(), true, "", sequence);
+        }
+    protected:
+        MemoryTable& table;
+        uint64_t sequence;
+};
+
+class MemoryStorageEngine : public StorageEngine {
+    public:
+        MemoryStorageEngine(std::shared_ptr<MemoryTable> table) : table(table) {}
+        leveldb::Status get(const leveldb::ReadOptions& options, const leveldb::Slice& key, string* value) {
+            std::unique_lock<std::mutex> ul(table->lock);
+            auto it = table->data.find(key.ToString());
+            const MemoryVersion* version = NULL;
+            if (it != table->data.end()) version = MemoryTable::visible(it->second, this->readSequence(options));
+            if (!version) return leveldb::Status::NotFound("Key not found");
+            *value = version->value;
+            return leveldb::Status::OK();
+        }
+        leveldb::Status put(const leveldb::WriteOptions& options, const leveldb::Slice& key, const leveldb::Slice& value) {
+            std::unique_lock<std::mutex> ul(table->lock);
+            table->apply(key.ToString(), false, value.ToString(), ++table->sequence);
+            return leveldb::Status::OK();
+        }
+        leveldb::Status remove(const leveldb::WriteOptions& options, const leveldb::Slice& key) {
+            std::unique_lock<std::mutex> ul(table->lock);
+            table->apply(key.ToString(), true, "", ++table->sequence);
+            return leveldb::Status::OK();
+        }
+        leveldb::Status write(const leveldb::WriteOptions& options, leveldb::WriteBatch* batch) {
+            std::unique_lock<std::mutex> ul(table->lock);
+            // the whole batch shares one sequence number so readers see all of it or none
+            MemoryBatchHandler handler(*table, ++table->sequence);
+            return batch->Iterate(&handler);
+        }
+        leveldb::Iterator* newIterator(const leveldb::ReadOptions& options) {
+            // a write between reading the sequence and registering the reader
+            // could otherwise overwrite the version the iterator is meant to see
+            std::unique_lock<std::mutex> ul(table->lock);
+            uint64_t sequence = this->readSequence(options);
+            table->addReader(sequence);
+            return new MemoryIterator(table, sequence);
+        }
+        const leveldb::Snapshot* getSnapshot() {
+            std::unique_lock<std::mutex> ul(table->lock);
+            table->addReader(table->sequence);
+            return new MemorySnapshot(table->sequence);
+        }
+        void releaseSnapshot(const leveldb::Snapshot* snapshot) {
+            const MemorySnapshot* s = static_cast<const MemorySnapshot*>(snapshot);
+            {
+                std::unique_lock<std::mutex> ul(table->lock);
+                table->removeReader(s->sequence);
+            }
+            delete s;
+        }
+    protected:
+        uint64_t readSequence(const leveldb::ReadOptions& options) const {
+            if (options.snapshot) return static_cast<const MemorySnapshot*>(options.snapshot)->sequence;
+            return table->sequence;
+        }
+        std::shared_ptr<MemoryTable> table;
+};
+
+// memory tables outlive their engine so a store reopened by path in the same process finds its data
+std::mutex memoryTablesLock;
+map<string, std::shared_ptr<MemoryTable>> memoryTables;
+
+leveldb::Status StorageEngine::open(StorageBackend backend, const string& path, StorageEngine** engine) {
+    if (backend == STORAGE_MEMORY) {
+        std::unique_lock<std::mutex> ul(memoryTablesLock);
+        std::shared_ptr<MemoryTable>& table = memoryTables[path];
+        if (!table) table = std::make_shared<MemoryTable>();
+        *engine = new MemoryStorageEngine(table);
+        return leveldb::Status::OK();
+    }
+    leveldb::Options options;
+    options.create_if_missing = true;
+    leveldb::DB* db = NULL;
+    leveldb::Status status = leveldb::DB::Open(options, path, &db);
+    if (status.ok()) *engine = new LevelDBStorageEngine(db);
+    return status;
+}
+
+leveldb::Status StorageEngine::destroy(StorageBackend backend, const string& path) {
+    if (backend == STORAGE_MEMORY) {
+        std::unique_lock<std::mutex> ul(memoryTablesLock);
+        memoryTables.erase(path);
+        return leveldb::Status::OK();
+    }
+    leveldb::Options options;
+    return leveldb::DestroyDB(path, options);
+}
+
+SnapshotStorageEngine::SnapshotStorageEngine(StorageEngine* source) : source(source) {
+    this->snapshot = source->getSnapshot();
+}
+
+SnapshotStorageEngine::~SnapshotStorageEngine() {
+    this->source->releaseSnapshot(this->snapshot);
+}
+
+leveldb::ReadOptions SnapshotStorageEngine::pinned(const leveldb::ReadOptions& options) const {
+    leveldb::ReadOptions ret = options;
+    ret.snapshot = this->snapshot;
+    return ret;
+}
+
+leveldb::Status SnapshotStorageEngine::get(const leveldb::ReadOptions& options, const leveldb::Slice& key, string* value) {
+    return this->source->get(this->pinned(options), key, value);
+}
+
+leveldb::Status SnapshotStorageEngine::put(const leveldb::WriteOptions& options, const leveldb::Slice& key, const leveldb::Slice& value) {
+    return leveldb::Status::NotSupported("Snapshot storage is read only");
+}
+
+leveldb::Status SnapshotStorageEngine::remove(const leveldb::WriteOptions& options, const leveldb::Slice& key) {
+    return leveldb::Status::NotSupported("Snapshot storage is read only");
+}
+
+leveldb::Status SnapshotStorageEngine::write(const leveldb::WriteOptions& options, leveldb::WriteBatch* batch) {
+    return leveldb::Status::NotSupported("Snapshot storage is read only");
+}
+
+leveldb::Iterator* SnapshotStorageEngine::newIterator(const leveldb::ReadOptions& options) {
+    return this->source->newIterator(this->pinned(options));
+}
+
+// every read is already pinned, a nested snapshot would be the same view
+const leveldb::Snapshot* SnapshotStorageEngine::getSnapshot() {
+    return NULL;
+}
+
+void SnapshotStorageEngine::releaseSnapshot(const leveldb::Snapshot* snapshot) {
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <string>
+#include "leveldb/db.h"
+#include "leveldb/write_batch.h"
+using namespace std;
+
+enum StorageBackend {
+    STORAGE_LEVELDB,
+    STORAGE_MEMORY
+};
+
+StorageBackend storageBackendFromString(string backend);
+string storageBackendAsString(StorageBackend backend);
+
+struct StorageBackends {
+    StorageBackend ledger = STORAGE_LEVELDB;
+    StorageBackend blocks = STORAGE_LEVELDB;
+    StorageBackend txdb = STORAGE_LEVELDB;
+};
+
+/*
+    Key value engine behind every store. Keys are ordered bytewise and the
+    leveldb vocabulary types (Slice, Status, WriteBatch, Iterator, Snapshot)
+    are shared by all engines so stores can switch backends without changing
+    their key layout or error handling.
+*/
+class StorageEngine {
+    public:
+        virtual ~StorageEngine() {}
+        virtual leveldb::Status get(const leveldb::ReadOptions& options, const leveldb::Slice& key, string* value) = 0;
+        virtual leveldb::Status put(const leveldb::WriteOptions& options, const leveldb::Slice& key, const leveldb::Slice& value) = 0;
+        virtual leveldb::Status remove(const leveldb::WriteOptions& options, const leveldb::Slice& key) = 0;
+        virtual leveldb::Status write(const leveldb::WriteOptions& options, leveldb::WriteBatch* batch) = 0;
+        virtual leveldb::Iterator* newIterator(const leveldb::ReadOptions& options) = 0;
+        virtual const leveldb::Snapshot* getSnapshot() = 0;
+        virtual void releaseSnapshot(const leveldb::Snapshot* snapshot) = 0;
+
+        static leveldb::Status open(StorageBackend backend, const string& path, StorageEngine** engine);
+        static leveldb::Status destroy(StorageBackend backend, const string& path);
+};
+
+/*
+    Read only engine pinned to a snapshot of another engine: reads never see
+    writes made to the source after it was created. The source must outlive it.
+*/
+class SnapshotStorageEngine : public StorageEngine {
+    public:
+        SnapshotStorageEngine(StorageEngine* source);
+        ~SnapshotStorageEngine();
+        leveldb::Status get(const leveldb::ReadOptions& options, const leveldb::Slice& key, string* value);
+        leveldb::Status put(const leveldb::WriteOptions& options, const leveldb::Slice& key, const leveldb::Slice& value);
+        leveldb::Status remove(const leveldb::WriteOptions& options, const leveldb::Slice& key);
+        leveldb::Status write(const leveldb::WriteOptions& options, leveldb::WriteBatch* batch);
+        leveldb::Iterator* newIterator(const leveldb::ReadOptions& options);
+        const leveldb::Snapshot* getSnapshot();
+        void releaseSnapshot(const leveldb::Snapshot* snapshot);
+    protected:
+        leveldb::ReadOptions pinned(const leveldb::ReadOptions& options) const;
+        StorageEngine* source;
+        const leveldb::Snapshot* snapshot;
+};
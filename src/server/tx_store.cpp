@@ -1,49 +1,143 @@
 #include "tx_store.hpp"
+#include "../core/logger.hpp"
+#include <cstdio>
+#include <cstring>
+#include <memory>
 #include <thread>
 
 
-TransactionStore::TransactionStore() {
+TransactionStore::TransactionStore() : filterEpoch(0), source(NULL), sourceFilterEpoch(0) {
+}
+
+string TransactionStore::filterPath() const {
+    return this->path + ".filter";
+}
+
+void TransactionStore::init(string path, StorageBackend backend) {
+    DataStore::init(path, backend);
+    std::unique_lock<std::mutex> ul(filterLock);
+    // an in-memory txdb has nothing on disk for a saved filter to describe
+    if (backend != STORAGE_MEMORY && this->filter.load(this->filterPath())) {
+        // the saved filter is only valid until the next write, a crash
+        // before closeDB() must force a rebuild from the txdb itself
+        std::remove(this->filterPath().c_str());
+    } else {
+        this->rebuildFilter();
+    }
+}
+
+void TransactionStore::openReadView(const TransactionStore& source) {
+    // read the epoch before pinning so a removal in between is not missed
+    uint64_t epoch = source.filterEpoch;
+    DataStore::openReadView(source);
+    this->source = &source;
+    this->sourceFilterEpoch = epoch;
+}
+
+void TransactionStore::closeDB() {
+    if (this->db && this->backend != STORAGE_MEMORY && !this->source) {
+        std::unique_lock<std::mutex> ul(filterLock);
+        this->filter.save(this->filterPath());
+    }
+    DataStore::closeDB();
+}
+
+void TransactionStore::deleteDB() {
+    std::remove(this->filterPath().c_str());
+    DataStore::deleteDB();
+}
+
+void TransactionStore::clear() {
+    DataStore::clear();
+    std::unique_lock<std::mutex> ul(filterLock);
+    this->filterEpoch++;
+    this->filter.reset(0);
+}
+
+void TransactionStore::rebuildFilter() {
+    size_t count = 0;
+    std::unique_ptr<leveldb::Iterator> it(db->newIterator(leveldb::ReadOptions()));
+    for (it->SeekToFirst(); it->Valid(); it->Next()) count++;
+    // size for 50% load so the filter has room to grow before the next rebuild
+    this->filterEpoch++;
+    this->filter.reset(count * 2);
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        SHA256Hash txid;
+        if (it->key().size() != txid.size()) continue;
+        memcpy(txid.data(), it->key().data(), txid.size());
+        this->filter.insert(txid);
+    }
+    if (count > 0) Logger::logStatus("Rebuilt transaction filter with " + to_string(count) + " entries");
+}
+
+bool TransactionStore::mayContain(const SHA256Hash& txid) const {
+    if (this->source) {
+        bool contains = this->source->mayContain(txid);
+        return contains || this->source->filterEpoch != this->sourceFilterEpoch;
+    }
+    std::unique_lock<std::mutex> ul(filterLock);
+    return this->filter.contains(txid);
 }
 
 bool TransactionStore::hasTransaction(const Transaction &t) {
     SHA256Hash txHash = t.hashContents();
+    if (!this->mayContain(txHash)) return false;
     leveldb::Slice key = leveldb::Slice((const char*) txHash.data(), txHash.size());
     string value;
-    leveldb::Status status = db->Get(leveldb::ReadOptions(),key, &value);
+    leveldb::Status status = db->get(leveldb::ReadOptions(),key, &value);
     return (status.ok());
 }
 
 uint32_t TransactionStore::blockForTransaction(Transaction &t) {
     SHA256Hash txHash = t.hashContents();
-    leveldb::Slice key = leveldb::Slice((const char*) txHash.data(), txHash.size());
-    string value;
-    leveldb::Status status = db->Get(leveldb::ReadOptions(),key, &value);
-    if (!status.ok()) return 0; //throw std::runtime_error("Could not find specified transaction");
-    uint32_t val = *((uint32_t*)value.c_str());
-    return val;
+    return this->blockForTransactionId(txHash);
 }
 
 uint32_t TransactionStore::blockForTransactionId(SHA256Hash txHash) const{
+    return this->locateTransaction(txHash).blockId;
+}
+
+TransactionLocation TransactionStore::locateTransaction(SHA256Hash txHash) const{
+    TransactionLocation loc;
+    loc.blockId = 0;
+    loc.index = UNKNOWN_TX_INDEX;
+    if (!this->mayContain(txHash)) return loc;
     leveldb::Slice key = leveldb::Slice((const char*) txHash.data(), txHash.size());
     string value;
-    leveldb::Status status = db->Get(leveldb::ReadOptions(),key, &value);
-    if (!status.ok()) return 0; //throw std::runtime_error("Could not find specified transaction");
-    uint32_t val = *((uint32_t*)value.c_str());
-    return val;
+    leveldb::Status status = db->get(leveldb::ReadOptions(),key, &value);
+    if (!status.ok() || value.size() < sizeof(uint32_t)) return loc;
+    memcpy(&loc.blockId, value.c_str(), sizeof(uint32_t));
+    if (value.size() >= sizeof(TransactionLocation)) {
+        memcpy(&loc.index, value.c_str() + sizeof(uint32_t), sizeof(uint32_t));
+    }
+    return loc;
 }
 
-void TransactionStore::insertTransaction(Transaction& t, uint32_t blockId) {
+void TransactionStore::insertTransaction(Transaction& t, uint32_t blockId, uint32_t index) {
     SHA256Hash txHash = t.hashContents();
     leveldb::Slice key = leveldb::Slice((const char*) txHash.data(), txHash.size());
-    uint32_t dummy = blockId;
-    leveldb::Slice slice = leveldb::Slice((const char*)&dummy, sizeof(uint32_t));
-    leveldb::Status status = db->Put(leveldb::WriteOptions(), key, slice);
+    uint32_t loc[2] = {blockId, index};
+    leveldb::Slice slice = leveldb::Slice((const char*)loc, sizeof(loc));
+    leveldb::Status status = db->put(leveldb::WriteOptions(), key, slice);
     if(!status.ok()) throw std::runtime_error("Could not write transaction hash to tx db : " + status.ToString());
+    // always insert, even on a positive probe: skipping a false positive would
+    // lose this txid once the colliding one is removed
+    std::unique_lock<std::mutex> ul(filterLock);
+    if (!this->filter.insert(txHash) || this->filter.isFull()) this->rebuildFilter();
 }
 
 void TransactionStore::removeTransaction(Transaction& t) {
     SHA256Hash txHash = t.hashContents();
     leveldb::Slice key = leveldb::Slice((const char*) txHash.data(), txHash.size());
-    leveldb::Status status = db->Delete(leveldb::WriteOptions(), key);
+    string value;
+    // only known members may be removed from the filter, otherwise another
+    // txid sharing the fingerprint would start reading as absent
+    bool exists = db->get(leveldb::ReadOptions(), key, &value).ok();
+    leveldb::Status status = db->remove(leveldb::WriteOptions(), key);
     if(!status.ok()) throw std::runtime_error("Could not remove transaction hash from tx db : " + status.ToString());
+    if (exists) {
+        std::unique_lock<std::mutex> ul(filterLock);
+        this->filterEpoch++;
+        this->filter.remove(txHash);
+    }
 }
@@ -1,17 +1,44 @@
 #pragma once
 #include <string>
+#include <mutex>
+#include <atomic>
 #include "leveldb/db.h"
 #include "../core/transaction.hpp"
 #include "data_store.hpp"
+#include "cuckoo_filter.hpp"
 using namespace std;
 
+// records written before the index was stored only carry a block id
+#define UNKNOWN_TX_INDEX UINT32_MAX
+
+struct TransactionLocation {
+    uint32_t blockId;
+    uint32_t index;
+};
 
 class TransactionStore : public DataStore {
     public:
         TransactionStore();
+        void init(string path, StorageBackend backend = STORAGE_LEVELDB);
+        void openReadView(const TransactionStore& source);
+        void closeDB();
+        void deleteDB();
+        void clear();
         bool hasTransaction(const Transaction &t);
         uint32_t blockForTransaction(Transaction &t);
         uint32_t blockForTransactionId(SHA256Hash txid) const;
-        void insertTransaction(Transaction& t, uint32_t blockId);
+        TransactionLocation locateTransaction(SHA256Hash txid) const;
+        void insertTransaction(Transaction& t, uint32_t blockId, uint32_t index);
         void removeTransaction(Transaction & t);
+    protected:
+        bool mayContain(const SHA256Hash& txid) const;
+        void rebuildFilter();
+        string filterPath() const;
+        CuckooFilter filter;
+        mutable std::mutex filterLock;
+        // bumped before the filter can lose a member, read views only trust
+        // their source's filter while it is unchanged since they were opened
+        std::atomic<uint64_t> filterEpoch;
+        const TransactionStore* source;
+        uint64_t sourceFilterEpoch;
 };
@@ -0,0 +1,254 @@
+#include <memory>
+#include "leveldb/write_batch.h"
+#include "watch_list.hpp"
+using namespace std;
+
+#define WATCH_ADDRESS_PREFIX "ADDR"
+#define WATCH_EVENT_PREFIX "EVENT"
+#define WATCH_EVENT_COUNT_KEY "EVENT_COUNT"
+#define WATCH_HEIGHT_KEY "HEIGHT"
+
+struct WatchAddressKey {
+    char prefix[4];
+    uint8_t addr[25];
+};
+
+// event keys hold the cursor big endian so the log iterates in order
+struct WatchEventKey {
+    char prefix[5];
+    uint8_t cursor[8];
+};
+
+static WatchAddressKey watchAddressKey(const PublicWalletAddress& address) {
+    WatchAddressKey key;
+    memcpy(key.prefix, WATCH_ADDRESS_PREFIX, sizeof(key.prefix));
+    memcpy(key.addr, address.data(), 25);
+    return key;
+}
+
+static WatchEventKey watchEventKey(uint64_t cursor) {
+    WatchEventKey key;
+    memcpy(key.prefix, WATCH_EVENT_PREFIX, sizeof(key.prefix));
+    for (int i = 7; i >= 0; i--) {
+        key.cursor[i] = cursor & 0xFF;
+        cursor >>= 8;
+    }
+    return key;
+}
+
+WatchList::WatchList() : height(0), highestRegistration(0), nextCursor(0) {
+}
+
+void WatchList::load() {
+    std::unique_lock<std::mutex> ul(lock);
+    this->addresses.clear();
+    this->highestRegistration = 0;
+    string prefix = WATCH_ADDRESS_PREFIX;
+    std::unique_ptr<leveldb::Iterator> it(db->newIterator(leveldb::ReadOptions()));
+    for (it->Seek(leveldb::Slice(prefix)); it->Valid() && it->key().starts_with(leveldb::Slice(prefix)); it->Next()) {
+        if (it->key().size() != sizeof(WatchAddressKey)) continue;
+        PublicWalletAddress address;
+        memcpy(address.data(), it->key().data() + sizeof(WatchAddressKey::prefix), 25);
+        // addresses saved before heights were kept count as watched from the start
+        uint32_t registered = 0;
+        if (it->value().size() == sizeof(uint32_t)) memcpy(&registered, it->value().data(), sizeof(uint32_t));
+        this->addresses[address] = registered;
+        this->highestRegistration = std::max(this->highestRegistration, registered);
+    }
+    string value;
+    leveldb::Status status = db->get(leveldb::ReadOptions(), leveldb::Slice(WATCH_EVENT_COUNT_KEY), &value);
+    this->nextCursor = 0;
+    if (status.ok() && value.size() == sizeof(uint64_t)) memcpy(&this->nextCursor, value.c_str(), sizeof(uint64_t));
+    status = db->get(leveldb::ReadOptions(), leveldb::Slice(WATCH_HEIGHT_KEY), &value);
+    this->height = 0;
+    if (status.ok() && value.size() == sizeof(uint32_t)) memcpy(&this->height, value.c_str(), sizeof(uint32_t));
+}
+
+void WatchList::setHeight(uint32_t height) {
+    std::unique_lock<std::mutex> ul(lock);
+    this->height = height;
+    // the chain came back below where addresses were added, they must see the
+    // blocks that now replace the missing ones
+    if (this->highestRegistration > height) {
+        leveldb::WriteBatch batch;
+        for (auto& entry : this->addresses) {
+            if (entry.second > height) this->setRegistered(batch, entry.first, height);
+        }
+        batch.Put(leveldb::Slice(WATCH_HEIGHT_KEY), leveldb::Slice((const char*) &height, sizeof(uint32_t)));
+        leveldb::Status status = db->write(leveldb::WriteOptions(), &batch);
+        if (!status.ok()) throw std::runtime_error("Could not write watched addresses : " + status.ToString());
+        this->highestRegistration = height;
+    }
+}
+
+uint32_t WatchList::getHeight() const {
+    std::unique_lock<std::mutex> ul(lock);
+    return this->height;
+}
+
+size_t WatchList::addAddresses(const vector<PublicWalletAddress>& addresses) {
+    std::unique_lock<std::mutex> ul(lock);
+    leveldb::WriteBatch batch;
+    size_t added = 0;
+    for (auto& address : addresses) {
+        if (this->addresses.count(address) > 0) continue;
+        this->setRegistered(batch, address, this->height);
+        added++;
+    }
+    this->highestRegistration = std::max(this->highestRegistration, this->height);
+    leveldb::Status status = db->write(leveldb::WriteOptions(), &batch);
+    if (!status.ok()) throw std::runtime_error("Could not write watched addresses : " + status.ToString());
+    return added;
+}
+
+size_t WatchList::removeAddresses(const vector<PublicWalletAddress>& addresses) {
+    std::unique_lock<std::mutex> ul(lock);
+    leveldb::WriteBatch batch;
+    size_t removed = 0;
+    for (auto& address : addresses) {
+        if (this->addresses.erase(address) == 0) continue;
+        WatchAddressKey key = watchAddressKey(address);
+        batch.Delete(leveldb::Slice((const char*) &key, sizeof(key)));
+        removed++;
+    }
+    leveldb::Status status = db->write(leveldb::WriteOptions(), &batch);
+    if (!status.ok()) throw std::runtime_error("Could not remove watched addresses : " + status.ToString());
+    return removed;
+}
+
+bool WatchList::isWatched(const PublicWalletAddress& address) const {
+    std::unique_lock<std::mutex> ul(lock);
+    return this->addresses.count(address) > 0;
+}
+
+size_t WatchList::size() const {
+    std::unique_lock<std::mutex> ul(lock);
+    return this->addresses.size();
+}
+
+void WatchList::setRegistered(leveldb::WriteBatch& batch, const PublicWalletAddress& address, uint32_t height) {
+    this->addresses[address] = height;
+    WatchAddressKey key = watchAddressKey(address);
+    batch.Put(leveldb::Slice((const char*) &key, sizeof(key)), leveldb::Slice((const char*) &height, sizeof(uint32_t)));
+}
+
+void WatchList::blockAdded(Block& block) {
+    vector<WatchEvent> events;
+    {
+        std::unique_lock<std::mutex> ul(lock);
+        this->height = block.getId();
+        if (this->addresses.empty()) return;
+        for (auto& t : block.getTransactions()) {
+            WatchEvent event;
+            event.blockId = block.getId();
+            event.reverted = false;
+            event.amount = t.getAmount();
+            if (!t.isFee() && this->addresses.count(t.fromWallet()) > 0) {
+                event.txid = t.hashContents();
+                event.address = t.fromWallet();
+                event.sent = true;
+                events.push_back(event);
+            }
+            if (this->addresses.count(t.toWallet()) > 0) {
+                event.txid = t.hashContents();
+                event.address = t.toWallet();
+                event.sent = false;
+                events.push_back(event);
+            }
+        }
+    }
+    this->appendEvents(events, block.getId());
+}
+
+void WatchList::blockRemoved(Block& block) {
+    vector<WatchEvent> events;
+    {
+        std::unique_lock<std::mutex> ul(lock);
+        uint32_t blockId = block.getId();
+        this->height = blockId - 1;
+        if (this->addresses.empty()) return;
+        auto appliedFor = [this, blockId](const PublicWalletAddress& address) {
+            auto it = this->addresses.find(address);
+            return it != this->addresses.end() && it->second < blockId;
+        };
+        // undo in the reverse of the order the block applied them
+        vector<Transaction>& transactions = block.getTransactions();
+        for (auto t = transactions.rbegin(); t != transactions.rend(); t++) {
+            WatchEvent event;
+            event.blockId = blockId;
+            event.reverted = true;
+            event.amount = t->getAmount();
+            if (appliedFor(t->toWallet())) {
+                event.txid = t->hashContents();
+                event.address = t->toWallet();
+                event.sent = false;
+                events.push_back(event);
+            }
+            if (!t->isFee() && appliedFor(t->fromWallet())) {
+                event.txid = t->hashContents();
+                event.address = t->fromWallet();
+                event.sent = true;
+                events.push_back(event);
+            }
+        }
+        // addresses added above the new tip see whatever replaces the popped
+        // blocks applied, so they must see it reverted as well
+        if (blockId <= this->highestRegistration) {
+            leveldb::WriteBatch batch;
+            for (auto& entry : this->addresses) {
+                if (entry.second >= blockId) this->setRegistered(batch, entry.first, this->height);
+            }
+            leveldb::Status status = db->write(leveldb::WriteOptions(), &batch);
+            if (!status.ok()) throw std::runtime_error("Could not write watched addresses : " + status.ToString());
+            this->highestRegistration = this->height;
+        }
+    }
+    this->appendEvents(events, block.getId() - 1);
+}
+
+void WatchList::appendEvents(vector<WatchEvent>& events, uint32_t height) {
+    std::function<void()> notify;
+    {
+        std::unique_lock<std::mutex> ul(lock);
+        leveldb::WriteBatch batch;
+        // the height goes with the events so a restart knows which blocks it logged
+        batch.Put(leveldb::Slice(WATCH_HEIGHT_KEY), leveldb::Slice((const char*) &height, sizeof(uint32_t)));
+        uint64_t cursor = this->nextCursor;
+        for (auto& event : events) {
+            event.cursor = cursor++;
+            WatchEventKey key = watchEventKey(event.cursor);
+            batch.Put(leveldb::Slice((const char*) &key, sizeof(key)), leveldb::Slice((const char*) &event, sizeof(WatchEvent)));
+        }
+        batch.Put(leveldb::Slice(WATCH_EVENT_COUNT_KEY), leveldb::Slice((const char*) &cursor, sizeof(uint64_t)));
+        leveldb::Status status = db->write(leveldb::WriteOptions(), &batch);
+        if (!status.ok()) throw std::runtime_error("Could not write watch events : " + status.ToString());
+        this->nextCursor = cursor;
+        if (!events.empty()) notify = this->listener;
+    }
+    if (notify) notify();
+}
+
+uint64_t WatchList::getCursor() const {
+    std::unique_lock<std::mutex> ul(lock);
+    return this->nextCursor;
+}
+
+vector<WatchEvent> WatchList::getEvents(uint64_t cursor, size_t limit) const {
+    vector<WatchEvent> events;
+    WatchEventKey startKey = watchEventKey(cursor);
+    string prefix = WATCH_EVENT_PREFIX;
+    std::unique_ptr<leveldb::Iterator> it(db->newIterator(leveldb::ReadOptions()));
+    for (it->Seek(leveldb::Slice((const char*) &startKey, sizeof(startKey))); it->Valid() && events.size() < limit; it->Next()) {
+        if (it->key().size() != sizeof(WatchEventKey) || !it->key().starts_with(leveldb::Slice(prefix))) break;
+        if (it->value().size() != sizeof(WatchEvent)) continue;
+        WatchEvent event;
+        memcpy(&event, it->value().data(), sizeof(WatchEvent));
+        events.push_back(event);
+    }
+    return events;
+}
+
+void WatchList::setListener(std::function<void()> listener) {
+    std::unique_lock<std::mutex> ul(lock);
+    this->listener = listener;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <mutex>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include "../core/common.hpp"
+#include "../core/block.hpp"
+#include "data_store.hpp"
+using namespace std;
+
+// a transaction touching a watched address, or the undoing of one by a reorg
+struct WatchEvent {
+    uint64_t cursor;
+    uint32_t blockId;
+    SHA256Hash txid;
+    PublicWalletAddress address;
+    bool sent;
+    bool reverted;
+    TransactionAmount amount;
+};
+
+/*
+    Registry of watched addresses and the append only log of events for them.
+    The registry is kept in memory as a hash map so block commits only pay a
+    lookup per transaction side. Events are numbered in commit order and the
+    number doubles as the cursor clients resume from. Each address keeps the
+    chain height it was added at, so popping a block it never saw applied
+    logs no revert for it.
+*/
+class WatchList : public DataStore {
+    public:
+        WatchList();
+        void load();
+        // the height of the chain the list was loaded against, blocks keep it current after that
+        void setHeight(uint32_t height);
+        // the height blocks were applied up to, load restores the last one that logged events
+        uint32_t getHeight() const;
+        size_t addAddresses(const vector<PublicWalletAddress>& addresses);
+        size_t removeAddresses(const vector<PublicWalletAddress>& addresses);
+        bool isWatched(const PublicWalletAddress& address) const;
+        size_t size() const;
+        void blockAdded(Block& block);
+        void blockRemoved(Block& block);
+        uint64_t getCursor() const;
+        vector<WatchEvent> getEvents(uint64_t cursor, size_t limit) const;
+        void setListener(std::function<void()> listener);
+    protected:
+        void appendEvents(vector<WatchEvent>& events, uint32_t height);
+        void setRegistered(leveldb::WriteBatch& batch, const PublicWalletAddress& address, uint32_t height);
+        std::unordered_map<PublicWalletAddress, uint32_t, WalletAddressHasher> addresses;
+        uint32_t height;
+        // no address was added above this height, pops below it need no clamping
+        uint32_t highestRegistration;
+        uint64_t nextCursor;
+        std::function<void()> listener;
+        mutable std::mutex lock;
+};
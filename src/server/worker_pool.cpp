@@ -0,0 +1,56 @@
+#include "worker_pool.hpp"
+using namespace std;
+
+WorkerPool::WorkerPool(size_t threads, size_t queueLimit) : queueLimit(queueLimit), stopped(false) {
+    for (size_t i = 0; i < std::max<size_t>(threads, 1); i++) {
+        this->threads.push_back(std::thread(&WorkerPool::work, this));
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    this->stop();
+}
+
+bool WorkerPool::submit(std::function<void()> job) {
+    std::unique_lock<std::mutex> ul(lock);
+    if (this->stopped || this->jobs.size() >= this->queueLimit) return false;
+    this->jobs.push_back(std::move(job));
+    this->ready.notify_one();
+    return true;
+}
+
+void WorkerPool::stop() {
+    {
+        std::unique_lock<std::mutex> ul(lock);
+        if (this->stopped) return;
+        this->stopped = true;
+        this->jobs.clear();
+    }
+    this->ready.notify_all();
+    for (auto& thread : this->threads) thread.join();
+}
+
+size_t WorkerPool::threadCount() const {
+    return this->threads.size();
+}
+
+size_t WorkerPool::queued() const {
+    std::unique_lock<std::mutex> ul(lock);
+    return this->jobs.size();
+}
+
+void WorkerPool::work() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> ul(lock);
+            this->ready.wait(ul, [this]() {
+                return this->stopped || !this->jobs.empty();
+            });
+            if (this->stopped) break;
+            job = std::move(this->jobs.front());
+            this->jobs.pop_front();
+        }
+        job();
+    }
+}
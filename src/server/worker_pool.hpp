@@ -0,0 +1,34 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+/*
+    A fixed set of threads running queued jobs. Jobs are refused once the
+    queue holds queueLimit of them. stop() drops the jobs still queued and
+    joins the threads after the running ones return, so once it returns no
+    job touches anything its owner is about to tear down.
+*/
+class WorkerPool {
+    public:
+        WorkerPool(size_t threads, size_t queueLimit = SIZE_MAX);
+        ~WorkerPool();
+        // false if the job was refused, it is not run then
+        bool submit(std::function<void()> job);
+        void stop();
+        size_t threadCount() const;
+        size_t queued() const;
+    protected:
+        void work();
+        std::deque<std::function<void()>> jobs;
+        std::vector<std::thread> threads;
+        size_t queueLimit;
+        bool stopped;
+        mutable std::mutex lock;
+        std::condition_variable ready;
+};
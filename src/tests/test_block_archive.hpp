@@ -0,0 +1,58 @@
+#include "../core/user.hpp"
+#include "../server/block_archive.hpp"
+#include <cstring>
+using namespace std;
+
+TEST(test_archive_roundtrips_transactions) {
+    User miner;
+    User receiver;
+    vector<TransactionInfo> transactions;
+    transactions.push_back(miner.mine().serialize());
+    for(int i = 0; i < 50; i++) {
+        Transaction t = miner.send(receiver, i * 1000 + 7);
+        t.setTimestamp(1644789258 - i * 3);
+        transactions.push_back(t.serialize());
+    }
+    MemoryArchiveDictionary dictionary;
+    string data = encodeArchivedTransactions(transactions, dictionary);
+    // miner, receiver and the empty fee sender, the miner's key and the empty fee key
+    ASSERT_EQUAL(dictionary.size(), 5);
+    ASSERT_TRUE(data.size() < transactions.size() * sizeof(TransactionInfo) / 2);
+
+    vector<TransactionInfo> decoded = decodeArchivedTransactions(data, dictionary);
+    ASSERT_EQUAL(decoded.size(), transactions.size());
+    for(int i = 0; i < transactions.size(); i++) {
+        char original[TRANSACTIONINFO_BUFFER_SIZE];
+        char restored[TRANSACTIONINFO_BUFFER_SIZE];
+        transactionInfoToBuffer(transactions[i], original);
+        transactionInfoToBuffer(decoded[i], restored);
+        ASSERT_TRUE(memcmp(original, restored, TRANSACTIONINFO_BUFFER_SIZE) == 0);
+        ASSERT_TRUE(transactions[i].from == decoded[i].from);
+        ASSERT_TRUE(Transaction(transactions[i]).hashContents() == Transaction(decoded[i]).hashContents());
+    }
+}
+
+TEST(test_archive_rejects_corrupt_data) {
+    User miner;
+    vector<TransactionInfo> transactions;
+    transactions.push_back(miner.mine().serialize());
+    MemoryArchiveDictionary dictionary;
+    string data = encodeArchivedTransactions(transactions, dictionary);
+
+    bool threw = false;
+    try {
+        decodeArchivedTransactions(data.substr(0, data.size() - 4), dictionary);
+    } catch(...) {
+        threw = true;
+    }
+    ASSERT_TRUE(threw);
+
+    threw = false;
+    try {
+        MemoryArchiveDictionary empty;
+        decodeArchivedTransactions(data, empty);
+    } catch(...) {
+        threw = true;
+    }
+    ASSERT_TRUE(threw);
+}
@@ -42,6 +42,197 @@ TEST(test_blockstore_stores_block) {
     blocks.deleteDB();
 }
 
+TEST(test_blockstore_reads_single_transaction) {
+    BlockStore blocks;
+    blocks.init("./test-data/tmpdb");
+    Block a;
+    a.setId(2);
+    User miner;
+    User receiver;
+    a.addTransaction(miner.mine());
+    for(int i = 0; i < 5; i++) {
+        Transaction t = miner.send(receiver, i + 1);
+        t.setTimestamp(i);
+        a.addTransaction(t);
+    }
+    blocks.setBlock(a);
+    for(int i = 0; i < a.getTransactions().size(); i++) {
+        Transaction t = blocks.getTransaction(2, i);
+        ASSERT_TRUE(t == a.getTransactions()[i]);
+        ASSERT_TRUE(t.hashContents() == a.getTransactions()[i].hashContents());
+    }
+    bool threw = false;
+    try {
+        blocks.getTransaction(2, a.getTransactions().size());
+    } catch(...) {
+        threw = true;
+    }
+    ASSERT_TRUE(threw);
+    blocks.closeDB();
+    blocks.deleteDB();
+}
+
+TEST(test_blockstore_pages_wallet_history) {
+    BlockStore blocks;
+    blocks.init("./test-data/tmpdb");
+    User miner;
+    User receiver;
+    vector<Block> chain;
+    for(int id = 1; id <= 3; id++) {
+        Block b;
+        b.setId(id);
+        b.addTransaction(miner.mine());
+        for(int i = 0; i < 3; i++) {
+            Transaction t = miner.send(receiver, 1);
+            t.setTimestamp(id * 10 + i);
+            b.addTransaction(t);
+        }
+        blocks.setBlock(b);
+        chain.push_back(b);
+    }
+    blocks.setBlockCount(3);
+    PublicWalletAddress to = receiver.getAddress();
+
+    // newest first, ordered by block then position
+    vector<WalletTransactionRef> all = blocks.getWalletTransactionsBefore(to, UINT32_MAX, UINT32_MAX, 100);
+    ASSERT_EQUAL(all.size(), 9);
+    for(int i = 0; i < 9; i++) {
+        ASSERT_EQUAL(all[i].blockId, 3 - i / 3);
+        ASSERT_EQUAL(all[i].index, 3 - i % 3);
+        ASSERT_TRUE(all[i].txid == chain[all[i].blockId - 1].getTransactions()[all[i].index].hashContents());
+    }
+
+    vector<WalletTransactionRef> page = blocks.getWalletTransactionsBefore(to, UINT32_MAX, UINT32_MAX, 4);
+    ASSERT_EQUAL(page.size(), 4);
+    page = blocks.getWalletTransactionsBefore(to, page.back().blockId, page.back().index, 4);
+    ASSERT_EQUAL(page.size(), 4);
+    ASSERT_EQUAL(page[0].blockId, all[4].blockId);
+    ASSERT_EQUAL(page[0].index, all[4].index);
+    page = blocks.getWalletTransactionsBefore(to, page.back().blockId, page.back().index, 4);
+    ASSERT_EQUAL(page.size(), 1);
+
+    // after returns the entries nearest the cursor, still newest first
+    page = blocks.getWalletTransactionsAfter(to, 1, 2, 2);
+    ASSERT_EQUAL(page.size(), 2);
+    ASSERT_EQUAL(page[0].blockId, 2);
+    ASSERT_EQUAL(page[0].index, 1);
+    ASSERT_EQUAL(page[1].blockId, 1);
+    ASSERT_EQUAL(page[1].index, 3);
+
+    // a missing index is rebuilt from the stored blocks
+    for(auto& b : chain) blocks.removeBlockWalletTransactions(b);
+    ASSERT_EQUAL(blocks.getTransactionsForWallet(to).size(), 0);
+    blocks.upgradeWalletIndex();
+    ASSERT_EQUAL(blocks.getTransactionsForWallet(to).size(), 9);
+    PublicWalletAddress from = miner.getAddress();
+    ASSERT_EQUAL(blocks.getTransactionsForWallet(from).size(), 12);
+    blocks.closeDB();
+    blocks.deleteDB();
+}
+
+TEST(test_blockstore_prunes_old_blocks) {
+    BlockStore blocks;
+    blocks.init("./test-data/tmpdb");
+    User miner;
+    User receiver;
+    PublicWalletAddress to = receiver.getAddress();
+    blocks.setBalanceHistoryHeight(0);
+    TransactionAmount received = 0;
+    for(int id = 1; id <= 5; id++) {
+        Block b;
+        b.setId(id);
+        b.addTransaction(miner.mine());
+        Transaction t = miner.send(receiver, id);
+        t.setTimestamp(id);
+        b.addTransaction(t);
+        received += id;
+        map<PublicWalletAddress, BalanceChange> changes;
+        changes[to].delta = id;
+        changes[to].balance = received;
+        blocks.setBlock(b, changes);
+    }
+    blocks.setBlockCount(5);
+    ASSERT_EQUAL(blocks.getPrunedHeight(), 0);
+
+    // pruning proceeds in bounded batches
+    ASSERT_EQUAL(blocks.pruneBlocks(3, 2), 2);
+    ASSERT_EQUAL(blocks.pruneBlocks(3, 2), 3);
+    ASSERT_EQUAL(blocks.pruneBlocks(3, 2), 3);
+    ASSERT_EQUAL(blocks.getPrunedHeight(), 3);
+
+    // headers survive, bodies and wallet entries do not
+    ASSERT_EQUAL(blocks.getBlockHeader(1).numTransactions, 2);
+    bool threw = false;
+    try {
+        blocks.getTransaction(3, 1);
+    } catch(...) {
+        threw = true;
+    }
+    ASSERT_TRUE(threw);
+    ASSERT_EQUAL(blocks.getTransaction(4, 1).getAmount(), 4);
+    vector<WalletTransactionRef> history = blocks.getWalletTransactionsBefore(to, UINT32_MAX, UINT32_MAX, 100);
+    ASSERT_EQUAL(history.size(), 2);
+    ASSERT_EQUAL(history[0].blockId, 5);
+    ASSERT_EQUAL(history[1].blockId, 4);
+
+    // balance history goes with them, the pruned height is still answered
+    ASSERT_EQUAL(blocks.getBalanceHistoryHeight(), 3);
+    TransactionAmount balance;
+    ASSERT_TRUE(blocks.getBalanceAt(to, 3, balance));
+    ASSERT_EQUAL(balance, 6);
+    ASSERT_TRUE(blocks.getBalanceAt(to, 4, balance));
+    ASSERT_EQUAL(balance, 10);
+    // the entry of block 2 is gone, block 4 is the nearest change left
+    ASSERT_TRUE(blocks.getBalanceAt(to, 2, balance));
+    ASSERT_EQUAL(balance, 6);
+    blocks.closeDB();
+    blocks.deleteDB();
+}
+
+TEST(test_blockstore_archives_old_blocks) {
+    BlockStore blocks;
+    blocks.init("./test-data/tmpdb");
+    User miner;
+    User receiver;
+    vector<Block> chain;
+    for(int id = 1; id <= 4; id++) {
+        Block b;
+        b.setId(id);
+        b.addTransaction(miner.mine());
+        for(int i = 0; i < 3; i++) {
+            Transaction t = miner.send(receiver, id * 10 + i);
+            t.setTimestamp(id * 10 + i);
+            b.addTransaction(t);
+        }
+        blocks.setBlock(b);
+        chain.push_back(b);
+    }
+    blocks.setBlockCount(4);
+    std::pair<uint8_t*, size_t> rawBefore = blocks.getRawData(2);
+
+    ASSERT_EQUAL(blocks.archiveBlocks(3, 2), 2);
+    ASSERT_EQUAL(blocks.archiveBlocks(3, 2), 3);
+    ASSERT_EQUAL(blocks.getArchivedHeight(), 3);
+
+    // archived blocks read back exactly as before
+    for(int id = 1; id <= 4; id++) {
+        ASSERT_TRUE(blocks.getBlock(id) == chain[id - 1]);
+    }
+    std::pair<uint8_t*, size_t> rawAfter = blocks.getRawData(2);
+    ASSERT_EQUAL(rawBefore.second, rawAfter.second);
+    ASSERT_TRUE(memcmp(rawBefore.first, rawAfter.first, rawBefore.second) == 0);
+    free(rawBefore.first);
+    free(rawAfter.first);
+    ASSERT_TRUE(blocks.getTransaction(2, 3) == chain[1].getTransactions()[3]);
+
+    // the dictionary persists across reopen
+    blocks.closeDB();
+    blocks.init("./test-data/tmpdb");
+    ASSERT_TRUE(blocks.getBlock(1) == chain[0]);
+    blocks.closeDB();
+    blocks.deleteDB();
+}
+
 TEST(test_blockstore_stores_multiple) {
     BlockStore blocks;
     blocks.init("./test-data/tmpdb");
@@ -119,3 +310,123 @@ TEST(test_blockstore_stores_bigint) {
     blocks.closeDB();
     blocks.deleteDB();
 }
+
+TEST(test_blockstore_tracks_dirty_marker) {
+    BlockStore blocks;
+    blocks.init("./test-data/tmpdb");
+    ASSERT_FALSE(blocks.isDirty());
+    blocks.setDirty(true);
+    blocks.setBlockCount(7, false);
+    blocks.closeDB();
+
+    // marker and unsynced count survive a reopen
+    blocks.init("./test-data/tmpdb");
+    ASSERT_TRUE(blocks.isDirty());
+    ASSERT_EQUAL(blocks.getBlockCount(), 7);
+    blocks.setDirty(false);
+    ASSERT_FALSE(blocks.isDirty());
+    blocks.closeDB();
+    blocks.deleteDB();
+}
+
+TEST(test_blockstore_indexes_block_times) {
+    BlockStore blocks;
+    blocks.init("./test-data/tmpdb");
+    User miner;
+    // timestamps step backwards at blocks 3 and 5
+    uint64_t timestamps[5] = {100, 300, 200, 400, 350};
+    for (uint32_t id = 1; id <= 5; id++) {
+        Block b;
+        b.setId(id);
+        b.setTimestamp(timestamps[id - 1]);
+        b.addTransaction(miner.mine());
+        blocks.setBlock(b);
+    }
+    blocks.setBlockCount(5);
+    ASSERT_EQUAL(blocks.getBlockAtTime(50, 5), 1);
+    ASSERT_EQUAL(blocks.getBlockAtTime(100, 5), 1);
+    ASSERT_EQUAL(blocks.getBlockAtTime(150, 5), 2);
+    ASSERT_EQUAL(blocks.getBlockAtTime(300, 5), 2);
+    ASSERT_EQUAL(blocks.getBlockAtTime(301, 5), 4);
+    ASSERT_EQUAL(blocks.getBlockAtTime(400, 5), 4);
+    ASSERT_EQUAL(blocks.getBlockAtTime(401, 5), 0);
+    ASSERT_EQUAL(blocks.getBlockAtTime(301, 3), 0);
+
+    // pop block 5 and replace block 4 with an older one
+    blocks.removeBlockTime(5);
+    Block replacement;
+    replacement.setId(4);
+    replacement.setTimestamp(250);
+    replacement.addTransaction(miner.mine());
+    blocks.setBlock(replacement);
+    blocks.setBlockCount(4);
+    ASSERT_EQUAL(blocks.getBlockAtTime(250, 5), 2);
+    ASSERT_EQUAL(blocks.getBlockAtTime(301, 5), 0);
+
+    // a store without the index rebuilds it from the headers
+    blocks.upgradeTimeIndex();
+    ASSERT_EQUAL(blocks.getBlockAtTime(301, 5), 0);
+    ASSERT_EQUAL(blocks.getBlockAtTime(150, 5), 2);
+    blocks.closeDB();
+    blocks.deleteDB();
+}
+
+TEST(test_blockstore_aggregates_block_stats) {
+    BlockStore blocks;
+    blocks.init("./test-data/tmpdb");
+    User miner;
+    User receiver;
+    for (uint32_t id = 1; id <= 4; id++) {
+        Block b;
+        b.setId(id);
+        b.setTimestamp(1000 + id * 60);
+        b.setDifficulty(16 + id);
+        b.addTransaction(miner.mine());
+        // block 2 only holds the mining fee
+        for (uint32_t i = 0; i < id && id != 2; i++) {
+            Transaction t = miner.send(receiver, 10);
+            t.setTimestamp(i);
+            b.addTransaction(t);
+        }
+        blocks.setBlock(b);
+    }
+    blocks.setBlockCount(4);
+
+    BlockStats two = blocks.getBlockStats(2);
+    ASSERT_EQUAL(two.transactions, 1);
+    ASSERT_EQUAL(two.volume, PDN(50));
+    ASSERT_EQUAL(two.interval, 60);
+    ASSERT_EQUAL(blocks.getBlockStats(1).interval, 0);
+
+    BlockStats range = blocks.getChainStats(2, 4);
+    ASSERT_EQUAL(range.transactions, 1 + 4 + 5);
+    ASSERT_EQUAL(range.volume, PDN(150) + 70);
+    ASSERT_EQUAL(range.difficulty, 18 + 19 + 20);
+    ASSERT_EQUAL(range.work, (1 << 18) + (1 << 19) + (1 << 20));
+    ASSERT_EQUAL(range.interval, 180);
+
+    // records written before stats were kept are rebuilt from the blocks,
+    // also once the time index has been upgraded
+    blocks.upgradeTimeIndex();
+    blocks.removeBlockStats(3);
+    blocks.upgradeBlockStats();
+    range = blocks.getChainStats(2, 4);
+    ASSERT_EQUAL(range.transactions, 1 + 4 + 5);
+    ASSERT_EQUAL(range.volume, PDN(150) + 70);
+
+    // a block stored on top of missing records backfills them
+    blocks.removeBlockStats(3);
+    blocks.removeBlockStats(4);
+    Block five;
+    five.setId(5);
+    five.setTimestamp(1300);
+    five.setDifficulty(21);
+    five.addTransaction(miner.mine());
+    blocks.setBlock(five);
+    range = blocks.getChainStats(2, 5);
+    ASSERT_EQUAL(range.transactions, 1 + 4 + 5 + 1);
+    ASSERT_EQUAL(range.volume, PDN(200) + 70);
+    ASSERT_EQUAL(range.interval, 240);
+    blocks.closeDB();
+    blocks.deleteDB();
+}
@@ -0,0 +1,145 @@
+#include "../core/crypto.hpp"
+#include "../core/user.hpp"
+#include "../server/chain_view.hpp"
+#include "../server/executor.hpp"
+using namespace std;
+
+Block chainViewTestBlock(uint32_t id, User& miner, User& receiver) {
+    Block b;
+    b.setId(id);
+    b.addTransaction(miner.mine());
+    Transaction t = miner.send(receiver, id);
+    t.setTimestamp(id);
+    b.addTransaction(t);
+    return b;
+}
+
+TEST(test_chain_view_pins_stores) {
+    BlockStore blocks;
+    Ledger ledger;
+    TransactionStore txdb;
+    blocks.init("./test-data/tmpdb");
+    ledger.init("./test-data/tmpledger");
+    txdb.init("./test-data/tmptxdb");
+    User miner;
+    User receiver;
+    PublicWalletAddress to = receiver.getAddress();
+
+    Block first = chainViewTestBlock(1, miner, receiver);
+    blocks.setBlock(first);
+    txdb.insertTransaction(first.getTransactions()[1], 1, 1);
+    ledger.createWallet(to);
+    ledger.deposit(to, 1);
+    ChainTip tip;
+    tip.blockCount = 1;
+    tip.lastHash = first.getHash();
+    std::shared_ptr<ChainView> view = ChainView::pin(blocks, ledger, txdb, tip);
+
+    // the next block lands after the view was pinned
+    Block second = chainViewTestBlock(2, miner, receiver);
+    blocks.setBlock(second);
+    txdb.insertTransaction(second.getTransactions()[1], 2, 1);
+    ledger.deposit(to, 2);
+    txdb.removeTransaction(first.getTransactions()[1]);
+
+    ASSERT_EQUAL(view->getBlockCount(), 1);
+    ASSERT_TRUE(view->getLastHash() == first.getHash());
+    ASSERT_EQUAL(view->getWalletValue(to), 1);
+    ASSERT_EQUAL(view->getTransactionsForWallet(to).size(), 1);
+    ASSERT_EQUAL(view->findTransactionLocation(first.getTransactions()[1].hashContents()).blockId, 1);
+    ASSERT_EQUAL(view->findTransactionLocation(second.getTransactions()[1].hashContents()).blockId, 0);
+    bool threw = false;
+    try {
+        view->getBlock(2);
+    } catch(...) {
+        threw = true;
+    }
+    ASSERT_TRUE(threw);
+
+    ChainTip next = tip;
+    next.blockCount = 2;
+    ChainView live(blocks, ledger, txdb, next);
+    ASSERT_EQUAL(live.getWalletValue(to), 3);
+    ASSERT_EQUAL(live.getTransactionsForWallet(to).size(), 2);
+    ASSERT_EQUAL(live.findTransactionLocation(first.getTransactions()[1].hashContents()).blockId, 0);
+
+    view.reset();
+    blocks.closeDB();
+    blocks.deleteDB();
+    ledger.closeDB();
+    ledger.deleteDB();
+    txdb.closeDB();
+    txdb.deleteDB();
+}
+
+TEST(test_chain_view_balance_at_height) {
+    BlockStore blocks;
+    Ledger ledger;
+    TransactionStore txdb;
+    blocks.init("./test-data/tmpdb");
+    ledger.init("./test-data/tmpledger");
+    txdb.init("./test-data/tmptxdb");
+    User miner;
+    User receiver;
+    User idle;
+    PublicWalletAddress from = miner.getAddress();
+    PublicWalletAddress to = receiver.getAddress();
+
+    // the receiver is paid in blocks 2 and 4, the miner changes every block
+    for (uint32_t id = 2; id <= 4; id++) {
+        Block block;
+        block.setId(id);
+        block.addTransaction(miner.mine());
+        if (id != 3) {
+            Transaction t = miner.send(receiver, id);
+            t.setTimestamp(id);
+            block.addTransaction(t);
+        }
+        map<PublicWalletAddress, BalanceChange> changes;
+        for (auto it : Executor::BlockDeltas(block)) {
+            if (!ledger.hasWallet(it.first)) ledger.createWallet(it.first);
+            ledger.setWalletValue(it.first, ledger.getWalletValue(it.first) + it.second);
+            BalanceChange change;
+            change.delta = it.second;
+            change.balance = ledger.getWalletValue(it.first);
+            changes[it.first] = change;
+        }
+        // the block and its balance changes go in one write
+        blocks.setBlock(block, changes);
+    }
+    ASSERT_EQUAL(ledger.getWalletValue(from), PDN(150) - 6);
+
+    ChainTip tip;
+    tip.blockCount = 4;
+    ChainView view(blocks, ledger, txdb, tip);
+    ASSERT_EQUAL(view.getWalletValueAt(from, 1), 0);
+    ASSERT_EQUAL(view.getWalletValueAt(from, 2), PDN(50) - 2);
+    ASSERT_EQUAL(view.getWalletValueAt(from, 3), PDN(100) - 2);
+    ASSERT_EQUAL(view.getWalletValueAt(to, 1), 0);
+    ASSERT_EQUAL(view.getWalletValueAt(to, 2), 2);
+    ASSERT_EQUAL(view.getWalletValueAt(to, 3), 2);
+    ASSERT_EQUAL(view.getWalletValueAt(to, 4), 6);
+    ASSERT_EQUAL(view.getWalletValueAt(idle.getAddress(), 4), 0);
+
+    // popping the tip drops its changes, the ledger is rolled back alongside
+    Block last = blocks.getBlock(4);
+    blocks.removeBalanceChanges(last);
+    ledger.setWalletValue(to, 2);
+    tip.blockCount = 3;
+    ChainView popped(blocks, ledger, txdb, tip);
+    ASSERT_EQUAL(popped.getWalletValueAt(to, 3), 2);
+    bool threw = false;
+    try {
+        popped.getWalletValueAt(to, 4);
+    } catch(...) {
+        threw = true;
+    }
+    ASSERT_TRUE(threw);
+
+    blocks.closeDB();
+    blocks.deleteDB();
+    ledger.closeDB();
+    ledger.deleteDB();
+    txdb.closeDB();
+    txdb.deleteDB();
+}
@@ -0,0 +1,58 @@
+#include "../core/crypto.hpp"
+#include "../server/cuckoo_filter.hpp"
+using namespace std;
+
+SHA256Hash filterTestKey(int i) {
+    string s = "txid-" + to_string(i);
+    return SHA256(s);
+}
+
+TEST(test_cuckoo_filter_insert_remove) {
+    CuckooFilter filter;
+    for (int i = 0; i < 3000; i++) {
+        ASSERT_TRUE(filter.insert(filterTestKey(i)));
+    }
+    ASSERT_EQUAL(filter.size(), 3000);
+    for (int i = 0; i < 3000; i++) {
+        ASSERT_TRUE(filter.contains(filterTestKey(i)));
+    }
+    int falsePositives = 0;
+    for (int i = 3000; i < 13000; i++) {
+        if (filter.contains(filterTestKey(i))) falsePositives++;
+    }
+    ASSERT_TRUE(falsePositives < 20);
+
+    for (int i = 0; i < 1500; i++) {
+        ASSERT_TRUE(filter.remove(filterTestKey(i)));
+    }
+    ASSERT_EQUAL(filter.size(), 1500);
+    for (int i = 1500; i < 3000; i++) {
+        ASSERT_TRUE(filter.contains(filterTestKey(i)));
+    }
+}
+
+TEST(test_cuckoo_filter_reports_full_without_losing_keys) {
+    CuckooFilter filter;
+    int inserted = 0;
+    while (!filter.isFull()) {
+        filter.insert(filterTestKey(inserted));
+        inserted++;
+    }
+    for (int i = 0; i < inserted; i++) {
+        ASSERT_TRUE(filter.contains(filterTestKey(i)));
+    }
+}
+
+TEST(test_cuckoo_filter_save_load) {
+    CuckooFilter filter;
+    for (int i = 0; i < 500; i++) filter.insert(filterTestKey(i));
+    ASSERT_TRUE(filter.save("./test-data/filter"));
+
+    CuckooFilter loaded;
+    ASSERT_TRUE(loaded.load("./test-data/filter"));
+    ASSERT_EQUAL(loaded.size(), 500);
+    for (int i = 0; i < 500; i++) {
+        ASSERT_TRUE(loaded.contains(filterTestKey(i)));
+    }
+    ASSERT_FALSE(loaded.load("./test-data/missing-filter"));
+}
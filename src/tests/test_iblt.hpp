@@ -0,0 +1,86 @@
+#include <algorithm>
+#include "../server/iblt.hpp"
+using namespace std;
+
+TEST(test_iblt_decodes_difference) {
+    // the peer has 0..9999, we have 30..10019, so 30 keys differ each way
+    IBLT remote(96);
+    IBLT local(96);
+    for (uint64_t key = 0; key < 10000; key++) remote.insert(key * 7919);
+    for (uint64_t key = 30; key < 10030; key++) local.insert(key * 7919);
+
+    // the peer's table goes over the wire
+    string buffer = remote.serialize();
+    ASSERT_EQUAL(buffer.size(), 96 * IBLT_CELL_BUFFER_SIZE);
+    IBLT received = IBLT::deserialize(buffer.data(), buffer.size());
+    received.subtract(local);
+
+    vector<uint64_t> missing;
+    vector<uint64_t> extra;
+    ASSERT_TRUE(received.decode(missing, extra));
+    ASSERT_EQUAL(missing.size(), 30);
+    ASSERT_EQUAL(extra.size(), 30);
+    std::sort(missing.begin(), missing.end());
+    std::sort(extra.begin(), extra.end());
+    for (uint64_t i = 0; i < 30; i++) {
+        ASSERT_EQUAL(missing[i], i * 7919);
+        ASSERT_EQUAL(extra[i], (10000 + i) * 7919);
+    }
+}
+
+TEST(test_iblt_reports_undecodable) {
+    IBLT remote(30);
+    IBLT local(30);
+    for (uint64_t key = 1; key <= 200; key++) remote.insert(key);
+    local.insert(1);
+    remote.subtract(local);
+    vector<uint64_t> missing;
+    vector<uint64_t> extra;
+    ASSERT_FALSE(remote.decode(missing, extra));
+
+    // deleting everything that was inserted leaves nothing to decode
+    IBLT empty(30);
+    for (uint64_t key = 1; key <= 200; key++) empty.insert(key);
+    for (uint64_t key = 1; key <= 200; key++) empty.erase(key);
+    missing.clear();
+    extra.clear();
+    ASSERT_TRUE(empty.decode(missing, extra));
+    ASSERT_EQUAL(missing.size(), 0);
+}
+
+TEST(test_iblt_rejects_crafted_table) {
+    // a lone pure cell whose key hashes to other, empty cells would peel
+    // back and forth between +1 and -1 without ever emptying the table
+    IBLT honest(30);
+    honest.insert(12345);
+    string buffer = honest.serialize();
+    string crafted(buffer.size(), '\0');
+    for (size_t i = 0; i < buffer.size(); i += IBLT_CELL_BUFFER_SIZE) {
+        if (buffer.compare(i, IBLT_CELL_BUFFER_SIZE, string(IBLT_CELL_BUFFER_SIZE, '\0')) != 0) {
+            crafted.replace(i, IBLT_CELL_BUFFER_SIZE, buffer, i, IBLT_CELL_BUFFER_SIZE);
+            break;
+        }
+    }
+    IBLT table = IBLT::deserialize(crafted.data(), crafted.size());
+    vector<uint64_t> missing;
+    vector<uint64_t> extra;
+    ASSERT_FALSE(table.decode(missing, extra));
+}
+
+TEST(test_iblt_rejects_malformed_buffer) {
+    string buffer = IBLT(30).serialize();
+    bool rejectedEmpty = false;
+    try {
+        IBLT::deserialize(buffer.data(), 0);
+    } catch (const std::runtime_error& e) {
+        rejectedEmpty = true;
+    }
+    ASSERT_TRUE(rejectedEmpty);
+    bool rejectedPartial = false;
+    try {
+        IBLT::deserialize(buffer.data(), IBLT_CELL_BUFFER_SIZE * 2);
+    } catch (const std::runtime_error& e) {
+        rejectedPartial = true;
+    }
+    ASSERT_TRUE(rejectedPartial);
+}
@@ -14,4 +14,28 @@ TEST(test_ledger_stores_wallets) {
     ASSERT_EQUAL(ledger.getWalletValue(wallet), PDN(50.0));
     ledger.closeDB();
     ledger.deleteDB();
-}
\ No newline at end of file
+}
+TEST(test_ledger_batch_lookup) {
+    Ledger ledger;
+    ledger.init("./test-data/tmpdb");
+    vector<PublicWalletAddress> wallets;
+    for (int i = 0; i < 40; i++) {
+        PublicWalletAddress wallet = walletAddressFromPublicKey(generateKeyPair().first);
+        wallets.push_back(wallet);
+        // every other wallet exists
+        if (i % 2 == 0) {
+            ledger.createWallet(wallet);
+            ledger.deposit(wallet, i + 1);
+        }
+    }
+    std::sort(wallets.begin(), wallets.end());
+    wallets.push_back(wallets.back());
+    vector<WalletValue> values(wallets.size());
+    ledger.getWalletValues(wallets.data(), wallets.size(), values.data());
+    for (size_t i = 0; i < wallets.size(); i++) {
+        ASSERT_EQUAL(values[i].found, ledger.hasWallet(wallets[i]));
+        if (values[i].found) ASSERT_EQUAL(values[i].balance, ledger.getWalletValue(wallets[i]));
+    }
+    ledger.closeDB();
+    ledger.deleteDB();
+}
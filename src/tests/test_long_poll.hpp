@@ -0,0 +1,121 @@
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include "../core/user.hpp"
+#include "../server/long_poll.hpp"
+using namespace std;
+
+// stands in for the event loop, deferred jobs run when the test says so
+class TxWaitTestLoop {
+    public:
+        TxWaitQueue::Defer defer() {
+            return [this](std::function<void()> job) {
+                std::unique_lock<std::mutex> ul(lock);
+                jobs.push_back(job);
+            };
+        }
+        void run() {
+            vector<std::function<void()>> ready;
+            {
+                std::unique_lock<std::mutex> ul(lock);
+                ready.swap(jobs);
+            }
+            for (auto& job : ready) job();
+        }
+    protected:
+        std::mutex lock;
+        vector<std::function<void()>> jobs;
+};
+
+Block txWaitTestBlock(uint32_t id, User& miner, Transaction t) {
+    Block b;
+    b.setId(id);
+    b.addTransaction(miner.mine());
+    b.addTransaction(t);
+    return b;
+}
+
+TEST(test_tx_wait_queue_sees_block_landing_before_park) {
+    TxWaitTestLoop loop;
+    TxWaitQueue queue(loop.defer());
+    User miner;
+    User receiver;
+    Transaction t = miner.send(receiver, 1);
+    Block block = txWaitTestBlock(5, miner, t);
+
+    // the handler looked the transaction up just before the block landed,
+    // so it parks after the block event was posted but before it ran
+    queue.blockAdded(block);
+    int replies = 0;
+    queue.park(t.hashContents(), 0, 1, 60000, std::make_shared<bool>(false), [&replies]() {
+        replies++;
+    });
+    ASSERT_EQUAL(queue.size(), 1);
+    loop.run();
+    ASSERT_EQUAL(replies, 1);
+    ASSERT_EQUAL(queue.size(), 0);
+}
+
+TEST(test_tx_wait_queue_follows_reorg) {
+    TxWaitTestLoop loop;
+    TxWaitQueue queue(loop.defer());
+    User miner;
+    User receiver;
+    Transaction t = miner.send(receiver, 1);
+    Transaction other = miner.send(receiver, 2);
+    int replies = 0;
+    queue.park(t.hashContents(), 0, 2, 60000, std::make_shared<bool>(false), [&replies]() {
+        replies++;
+    });
+    Block first = txWaitTestBlock(5, miner, t);
+    queue.blockAdded(first);
+    loop.run();
+    ASSERT_EQUAL(replies, 0);
+
+    // block 5 is swapped for one holding the transaction again, both events
+    // are posted before the loop gets to either
+    Block replacement = txWaitTestBlock(5, miner, t);
+    queue.blockRemoved(first);
+    queue.blockAdded(replacement);
+    loop.run();
+    ASSERT_EQUAL(replies, 0);
+    Block next = txWaitTestBlock(6, miner, other);
+    queue.blockAdded(next);
+    loop.run();
+    ASSERT_EQUAL(replies, 1);
+    ASSERT_EQUAL(queue.size(), 0);
+}
+
+TEST(test_long_poll_ticks_only_expired_waiters) {
+    TxWaitTestLoop loop;
+    LongPollQueue queue(loop.defer());
+    int shortRuns = 0;
+    int longRuns = 0;
+    bool shortTimedOut = false;
+    queue.park(0, [&](bool timedOut) {
+        shortRuns++;
+        shortTimedOut = timedOut;
+        return timedOut;
+    });
+    queue.park(60000, [&](bool timedOut) {
+        longRuns++;
+        return false;
+    });
+    ASSERT_EQUAL(queue.size(), 2);
+    ASSERT_EQUAL(longRuns, 1);
+
+    // a tick answers the waiter that is due and leaves the other alone
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    loop.run();
+    ASSERT_TRUE(shortTimedOut);
+    ASSERT_EQUAL(shortRuns, 2);
+    ASSERT_EQUAL(longRuns, 1);
+    ASSERT_EQUAL(queue.size(), 1);
+
+    // an event reruns whoever is still parked
+    queue.wake();
+    queue.wake();
+    loop.run();
+    ASSERT_EQUAL(longRuns, 2);
+    ASSERT_EQUAL(queue.size(), 1);
+}
@@ -0,0 +1,464 @@
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "../core/user.hpp"
+#include "../server/blockchain.hpp"
+#include "../server/mempool.hpp"
+using namespace std;
+
+/*
+    Answers HTTP requests on a local port with whatever the handler returns
+    for the request target, so code that talks to peers can be run against
+    one. One request per connection, 404 if the handler returns no status.
+*/
+class StandInPeer {
+    public:
+        typedef std::function<int(const string& target, const string& body, string& response)> Handler;
+        StandInPeer(Handler handler) : handler(handler), stopped(false) {
+            listener = socket(AF_INET, SOCK_STREAM, 0);
+            int yes = 1;
+            setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = 0;
+            if (::bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 16) != 0) {
+                throw std::runtime_error("Could not start stand-in peer");
+            }
+            socklen_t length = sizeof(addr);
+            getsockname(listener, (sockaddr*)&addr, &length);
+            port = ntohs(addr.sin_port);
+            server = std::thread([this]() { this->serve(); });
+        }
+        ~StandInPeer() {
+            stopped = true;
+            server.join();
+            close(listener);
+        }
+        string url() const {
+            return "http://127.0.0.1:" + to_string(port);
+        }
+    protected:
+        void serve() {
+            while (!stopped) {
+                pollfd waiting = {listener, POLLIN, 0};
+                if (poll(&waiting, 1, 50) <= 0) continue;
+                int connection = accept(listener, nullptr, nullptr);
+                if (connection < 0) continue;
+                answer(connection);
+                close(connection);
+            }
+        }
+        void answer(int connection) {
+            string request;
+            char buffer[4096];
+            size_t headerEnd;
+            while ((headerEnd = request.find("\r\n\r\n")) == string::npos) {
+                ssize_t n = recv(connection, buffer, sizeof(buffer), 0);
+                if (n <= 0) return;
+                request.append(buffer, n);
+            }
+            string headers = request.substr(0, headerEnd);
+            string body = request.substr(headerEnd + 4);
+            size_t contentLength = 0;
+            for (string name : {"Content-Length:", "content-length:"}) {
+                size_t at = headers.find(name);
+                if (at != string::npos) contentLength = std::stoul(headers.substr(at + name.size()));
+            }
+            if (headers.find("100-continue") != string::npos) {
+                string proceed = "HTTP/1.1 100 Continue\r\n\r\n";
+                send(connection, proceed.data(), proceed.size(), MSG_NOSIGNAL);
+            }
+            while (body.size() < contentLength) {
+                ssize_t n = recv(connection, buffer, sizeof(buffer), 0);
+                if (n <= 0) return;
+                body.append(buffer, n);
+            }
+            size_t targetStart = headers.find(' ') + 1;
+            string target = headers.substr(targetStart, headers.find(' ', targetStart) - targetStart);
+            string response;
+            int status = handler(target, body, response);
+            if (status == 0) status = 404;
+            string reply = "HTTP/1.1 " + to_string(status) + " Stand-in\r\nContent-Length: " + to_string(response.size()) + "\r\nConnection: close\r\n\r\n" + response;
+            send(connection, reply.data(), reply.size(), MSG_NOSIGNAL);
+        }
+        Handler handler;
+        std::atomic<bool> stopped;
+        int listener;
+        int port;
+        std::thread server;
+};
+
+// a chain loaded from a one block store rather than genesis.json, tests fund wallets straight in its ledger
+std::unique_ptr<BlockChain> mempoolTestChain(HostManager& hosts, const string& name) {
+    string blockPath = "./test-data/" + name + "-blocks";
+    BlockStore blocks;
+    blocks.init(blockPath);
+    User miner;
+    Block first;
+    first.setId(1);
+    first.addTransaction(miner.mine());
+    blocks.setBlock(first);
+    blocks.setBlockCount(1);
+    blocks.setTotalWork(1);
+    blocks.closeDB();
+    string ledgerPath = "./test-data/" + name + "-ledger";
+    Ledger ledger;
+    ledger.init(ledgerPath);
+    ledger.createWallet(miner.getAddress());
+    ledger.setWalletValue(miner.getAddress(), PDN(50));
+    ledger.closeDB();
+    return std::make_unique<BlockChain>(hosts, ledgerPath, blockPath, "./test-data/" + name + "-txdb");
+}
+
+void mempoolTestFund(BlockChain& chain, User& user, TransactionAmount balance) {
+    chain.getLedger().createWallet(user.getAddress());
+    chain.getLedger().setWalletValue(user.getAddress(), balance);
+}
+
+Transaction mempoolTestTransaction(User& from, TransactionAmount amount, TransactionAmount fee, uint64_t timestamp = getCurrentTime()) {
+    User to;
+    Transaction t(from.getAddress(), to.getAddress(), amount, from.getPublicKey(), fee, timestamp);
+    from.signTransaction(t);
+    return t;
+}
+
+// reaches into the mempool's indexes to check that they agree with each other
+class MemPoolProbe : public MemPool {
+    public:
+        MemPoolProbe(HostManager& h, BlockChain& b) : MemPool(h, b) {}
+        static size_t entryBytes() {
+            return PENDING_TRANSACTION_BYTES;
+        }
+        // what the cleanup thread does once the clock reads now
+        void expireThrough(uint64_t now) {
+            std::unique_lock<std::mutex> lock(mempool_mutex);
+            while (expiryMinute < now / 60) expireSlot(expiryMinute++, now);
+        }
+        void checkInvariants() const {
+            std::unique_lock<std::mutex> lock(mempool_mutex);
+            ASSERT_EQUAL(usedBytes, pendingByTxid.size() * PENDING_TRANSACTION_BYTES);
+            ASSERT_EQUAL(senderHeads.size(), senders.size());
+            ASSERT_EQUAL(senderTails.size(), senders.size());
+            size_t queued = 0;
+            FeeHistogram histogram;
+            histogram.fill(0);
+            for (const auto& sender : senders) {
+                const SenderQueue& queue = sender.second;
+                ASSERT_FALSE(queue.pending.empty());
+                TransactionAmount outgoing = 0;
+                for (const auto& slot : queue.pending) {
+                    const PendingTransaction& pending = pendingByTxid.at(slot.second);
+                    ASSERT_TRUE(pending.slot == slot.first);
+                    ASSERT_TRUE(pending.tx.fromWallet() == sender.first);
+                    outgoing += pending.tx.getAmount() + pending.tx.getFee();
+                    histogram[feeHistogramBucket(pending.tx.getFee())]++;
+                    queued++;
+                }
+                ASSERT_EQUAL(queue.outgoing, outgoing);
+                SHA256Hash head = queue.pending.begin()->second;
+                SHA256Hash tail = queue.pending.rbegin()->second;
+                ASSERT_EQUAL(senderHeads.count(FeeKey(pendingByTxid.at(head).tx.getFee(), head)), 1);
+                ASSERT_EQUAL(senderTails.count(FeeKey(pendingByTxid.at(tail).tx.getFee(), tail)), 1);
+            }
+            ASSERT_EQUAL(queued, pendingByTxid.size());
+            ASSERT_TRUE(histogram == feeHistogram);
+            size_t wheeled = 0;
+            for (const auto& slot : expiryWheel) {
+                for (size_t i = 0; i < slot.size(); i++) {
+                    ASSERT_EQUAL(pendingByTxid.at(slot[i]).wheelIndex, i);
+                    wheeled++;
+                }
+            }
+            ASSERT_EQUAL(wheeled, pendingByTxid.size());
+        }
+};
+
+TEST(test_mempool_reconciles_with_peer) {
+    HostManager hosts;
+    std::unique_ptr<BlockChain> chain = mempoolTestChain(hosts, "reconcile");
+    MemPool local(hosts, *chain);
+    MemPool remote(hosts, *chain);
+    vector<User> users(40);
+    vector<Transaction> shared;
+    vector<Transaction> remoteOnly;
+    vector<Transaction> localOnly;
+    for (size_t i = 0; i < users.size(); i++) {
+        mempoolTestFund(*chain, users[i], PDN(10));
+        Transaction t = mempoolTestTransaction(users[i], 1, 1 + i);
+        if (i < 20) shared.push_back(t);
+        else if (i < 30) remoteOnly.push_back(t);
+        else localOnly.push_back(t);
+    }
+    for (auto& status : remote.addTransactions(shared)) ASSERT_EQUAL(status, SUCCESS);
+    for (auto& status : remote.addTransactions(remoteOnly)) ASSERT_EQUAL(status, SUCCESS);
+    for (auto& status : local.addTransactions(shared)) ASSERT_EQUAL(status, SUCCESS);
+    for (auto& status : local.addTransactions(localOnly)) ASSERT_EQUAL(status, SUCCESS);
+
+    // the peer side of /mempool_sketch and /mempool_fetch
+    size_t sketchRequests = 0;
+    vector<uint64_t> fetched;
+    StandInPeer peer([&](const string& target, const string& body, string& response) {
+        if (target.rfind("/mempool_sketch?cells=", 0) == 0) {
+            sketchRequests++;
+            uint32_t count;
+            IBLT sketch = remote.getSketch(std::stoul(target.substr(target.find('=') + 1)), count);
+            response = string(sizeof(uint32_t), '\0');
+            char* ptr = &response[0];
+            writeNetworkUint32(ptr, count);
+            response += sketch.serialize();
+            return 200;
+        }
+        if (target == "/mempool_fetch") {
+            const char* ptr = body.data();
+            for (size_t i = 0; i < body.size() / sizeof(uint64_t); i++) fetched.push_back(readNetworkUint64(ptr));
+            vector<Transaction> found = remote.getTransactionsByShortId(fetched);
+            response = string(found.size() * TRANSACTIONINFO_BUFFER_SIZE, '\0');
+            for (size_t i = 0; i < found.size(); i++) {
+                TransactionInfo info = found[i].serialize();
+                transactionInfoToBuffer(info, &response[i * TRANSACTIONINFO_BUFFER_SIZE]);
+            }
+            return 200;
+        }
+        return 0;
+    });
+
+    ASSERT_TRUE(local.reconcile(peer.url()));
+    ASSERT_EQUAL(sketchRequests, 1);
+    // only what the peer had and we did not was fetched
+    ASSERT_EQUAL(fetched.size(), remoteOnly.size());
+    ASSERT_EQUAL(local.size(), 40);
+    for (auto& t : remoteOnly) ASSERT_TRUE(local.hasTransaction(t));
+    chain->deleteDB();
+}
+
+TEST(test_mempool_reconcile_gives_up_on_short_sketch) {
+    HostManager hosts;
+    std::unique_ptr<BlockChain> chain = mempoolTestChain(hosts, "reconcile-short");
+    MemPool local(hosts, *chain);
+    User user;
+    mempoolTestFund(*chain, user, PDN(10));
+    local.addTransaction(mempoolTestTransaction(user, 1, 1));
+
+    // a peer that always answers with a smaller sketch than was asked for
+    size_t sketchRequests = 0;
+    bool countOnly = false;
+    StandInPeer peer([&](const string& target, const string& body, string& response) {
+        if (target.rfind("/mempool_sketch", 0) != 0) return 0;
+        sketchRequests++;
+        IBLT sketch(MEMPOOL_SKETCH_MIN_CELLS / 2);
+        for (uint64_t key = 1; key <= 1000; key++) sketch.insert(key);
+        response = string(sizeof(uint32_t), '\0');
+        char* ptr = &response[0];
+        writeNetworkUint32(ptr, 1000);
+        if (!countOnly) response += sketch.serialize();
+        return 200;
+    });
+    ASSERT_FALSE(local.reconcile(peer.url()));
+    ASSERT_EQUAL(sketchRequests, 1);
+
+    // nor does a reply holding only the count get read past its end
+    countOnly = true;
+    ASSERT_FALSE(local.reconcile(peer.url()));
+    ASSERT_EQUAL(sketchRequests, 2);
+    chain->deleteDB();
+}
+
+TEST(test_mempool_orders_and_evicts_by_fee) {
+    HostManager hosts;
+    std::unique_ptr<BlockChain> chain = mempoolTestChain(hosts, "mempool-fees");
+    MemPoolProbe pool(hosts, *chain);
+    User a;
+    User b;
+    User c;
+    User d;
+    mempoolTestFund(*chain, a, 100);
+    mempoolTestFund(*chain, b, 100);
+    mempoolTestFund(*chain, c, 100);
+    mempoolTestFund(*chain, d, 100);
+
+    // a's transactions share a nonce, so they run in arrival order
+    Transaction a1 = mempoolTestTransaction(a, 10, 5);
+    Transaction a2 = mempoolTestTransaction(a, 10, 1);
+    Transaction a3 = mempoolTestTransaction(a, 10, 9);
+    Transaction b1 = mempoolTestTransaction(b, 10, 3);
+    Transaction c1 = mempoolTestTransaction(c, 10, 7);
+    for (auto& t : {a1, a2, a3, b1, c1}) {
+        ASSERT_EQUAL(pool.addTransaction(t), SUCCESS);
+        pool.checkInvariants();
+    }
+    ASSERT_EQUAL(pool.addTransaction(a1), ALREADY_IN_QUEUE);
+    // a has 100 and 45 of it pending already
+    ASSERT_EQUAL(pool.addTransaction(mempoolTestTransaction(a, 60, 3)), BALANCE_TOO_LOW);
+    ASSERT_EQUAL(pool.getUsedBytes(), 5 * MemPoolProbe::entryBytes());
+
+    // best head first, a sender's next transaction only after its previous one
+    vector<Transaction> selected = pool.getTransactions();
+    vector<Transaction> expected = {c1, a1, b1, a2, a3};
+    ASSERT_EQUAL(selected.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); i++) ASSERT_TRUE(selected[i].hashContents() == expected[i].hashContents());
+
+    // the fee histogram buckets by powers of two
+    FeeHistogram histogram = pool.getFeeHistogram();
+    ASSERT_EQUAL(histogram[0], 1);
+    ASSERT_EQUAL(histogram[1], 1);
+    ASSERT_EQUAL(histogram[2], 2);
+    ASSERT_EQUAL(histogram[3], 1);
+
+    // shrinking the budget drops the cheapest tail, a's cheap middle one stays
+    pool.setMaxBytes(4 * MemPoolProbe::entryBytes());
+    ASSERT_EQUAL(pool.size(), 4);
+    ASSERT_FALSE(pool.hasTransaction(b1));
+    ASSERT_TRUE(pool.hasTransaction(a2));
+    pool.checkInvariants();
+    ASSERT_EQUAL(pool.getFeeHistogram()[1], 0);
+
+    // when full, a newcomer has to outbid the cheapest tail
+    ASSERT_EQUAL(pool.addTransaction(mempoolTestTransaction(d, 10, 2)), TRANSACTION_FEE_TOO_LOW);
+    Transaction d1 = mempoolTestTransaction(d, 10, 8);
+    ASSERT_EQUAL(pool.addTransaction(d1), SUCCESS);
+    ASSERT_FALSE(pool.hasTransaction(c1));
+    ASSERT_EQUAL(pool.getMinFee(), 8);
+    pool.checkInvariants();
+    chain->deleteDB();
+}
+
+TEST(test_mempool_expires_on_the_wheel) {
+    HostManager hosts;
+    std::unique_ptr<BlockChain> chain = mempoolTestChain(hosts, "mempool-expiry");
+    MemPoolProbe pool(hosts, *chain);
+    User a;
+    User b;
+    mempoolTestFund(*chain, a, 100);
+    mempoolTestFund(*chain, b, 100);
+    uint64_t now = getCurrentTime();
+    // a's head runs out in half a minute, everything else in an hour
+    Transaction stale = mempoolTestTransaction(a, 10, 1, now - Transaction::TRANSACTION_EXPIRY + 30);
+    Transaction fresh = mempoolTestTransaction(a, 10, 2, now);
+    Transaction other = mempoolTestTransaction(b, 10, 3, now);
+    for (auto& t : {stale, fresh, other}) ASSERT_EQUAL(pool.addTransaction(t), SUCCESS);
+    pool.checkInvariants();
+
+    pool.expireThrough(now);
+    ASSERT_EQUAL(pool.size(), 3);
+    pool.expireThrough(now + 120);
+    ASSERT_EQUAL(pool.size(), 2);
+    ASSERT_FALSE(pool.hasTransaction(stale));
+    pool.checkInvariants();
+    vector<Transaction> selected = pool.getTransactions();
+    ASSERT_TRUE(selected[0].hashContents() == other.hashContents());
+    ASSERT_TRUE(selected[1].hashContents() == fresh.hashContents());
+
+    // a full turn of the wheel later the rest is gone too
+    pool.expireThrough(now + Transaction::TRANSACTION_EXPIRY + 120);
+    ASSERT_EQUAL(pool.size(), 0);
+    ASSERT_EQUAL(pool.getUsedBytes(), 0);
+    pool.checkInvariants();
+    chain->deleteDB();
+}
+
+TEST(test_mempool_revalidates_on_blocks_and_reorgs) {
+    HostManager hosts;
+    std::unique_ptr<BlockChain> chain = mempoolTestChain(hosts, "mempool-reorg");
+    MemPoolProbe pool(hosts, *chain);
+    User miner;
+    User a;
+    User b;
+    mempoolTestFund(*chain, a, 100);
+    mempoolTestFund(*chain, b, 100);
+    Transaction a1 = mempoolTestTransaction(a, 40, 1);
+    Transaction a2 = mempoolTestTransaction(a, 40, 2);
+    Transaction b1 = mempoolTestTransaction(b, 90, 1);
+    for (auto& t : {a1, a2, b1}) ASSERT_EQUAL(pool.addTransaction(t), SUCCESS);
+
+    // a1 is mined, what a has left still covers a2
+    Block first;
+    first.setId(2);
+    first.addTransaction(miner.mine());
+    first.addTransaction(a1);
+    chain->getLedger().setWalletValue(a.getAddress(), 59);
+    pool.finishBlock(first);
+    ASSERT_EQUAL(pool.size(), 2);
+    ASSERT_FALSE(pool.hasTransaction(a1));
+    ASSERT_EQUAL(pool.addTransaction(a1), EXPIRED_TRANSACTION);
+    pool.checkInvariants();
+
+    // a spends elsewhere and can no longer cover a2
+    Block second;
+    second.setId(3);
+    second.addTransaction(miner.mine());
+    Transaction spent = mempoolTestTransaction(a, 30, 1);
+    second.addTransaction(spent);
+    chain->getLedger().setWalletValue(a.getAddress(), 28);
+    pool.finishBlock(second);
+    ASSERT_EQUAL(pool.size(), 1);
+    ASSERT_FALSE(pool.hasTransaction(a2));
+    pool.checkInvariants();
+
+    // popping a block that paid b takes b's money away again
+    Block payment;
+    payment.setId(3);
+    payment.addTransaction(miner.mine());
+    payment.addTransaction(Transaction(miner.getAddress(), b.getAddress(), 50, miner.getPublicKey(), 1));
+    chain->getLedger().setWalletValue(b.getAddress(), 50);
+    pool.revertBlock(payment);
+    ASSERT_EQUAL(pool.size(), 0);
+    pool.checkInvariants();
+
+    // once both blocks are popped, a1 is pending again
+    chain->getLedger().setWalletValue(a.getAddress(), 100);
+    pool.revertBlock(second);
+    pool.revertBlock(first);
+    ASSERT_EQUAL(pool.addTransaction(a1), SUCCESS);
+    ASSERT_EQUAL(pool.addTransaction(a2), SUCCESS);
+    pool.checkInvariants();
+    chain->deleteDB();
+}
+
+TEST(test_mempool_saves_and_restores) {
+    HostManager hosts;
+    std::unique_ptr<BlockChain> chain = mempoolTestChain(hosts, "mempool-save");
+    string path = "./test-data/mempool-save.dat";
+    std::filesystem::remove(path);
+    User a;
+    User b;
+    mempoolTestFund(*chain, a, 100);
+    mempoolTestFund(*chain, b, 100);
+    Transaction a1 = mempoolTestTransaction(a, 10, 1);
+    Transaction a2 = mempoolTestTransaction(a, 10, 4);
+    Transaction b1 = mempoolTestTransaction(b, 10, 2);
+    vector<Transaction> expected;
+    {
+        MemPoolProbe pool(hosts, *chain);
+        ASSERT_EQUAL(pool.enablePersistence(path), 0);
+        for (auto& t : {a1, a2, b1}) ASSERT_EQUAL(pool.addTransaction(t), SUCCESS);
+        expected = pool.getTransactions();
+        pool.save();
+    }
+
+    // a's queue comes back in arrival order, not by fee
+    MemPoolProbe restored(hosts, *chain);
+    ASSERT_EQUAL(restored.enablePersistence(path), 3);
+    restored.checkInvariants();
+    vector<Transaction> selected = restored.getTransactions();
+    ASSERT_EQUAL(selected.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); i++) ASSERT_TRUE(selected[i].hashContents() == expected[i].hashContents());
+    ASSERT_TRUE(selected[1].hashContents() == a1.hashContents());
+
+    // a file cut short is ignored rather than half loaded
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+    MemPoolProbe truncated(hosts, *chain);
+    ASSERT_EQUAL(truncated.enablePersistence(path), 0);
+    ASSERT_EQUAL(truncated.size(), 0);
+    std::filesystem::remove(path);
+    chain->deleteDB();
+}
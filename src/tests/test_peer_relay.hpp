@@ -0,0 +1,27 @@
+#include <future>
+#include "../server/peer_relay.hpp"
+using namespace std;
+
+TEST(test_peer_relay_backs_off_failed_peer) {
+    PeerRelay relay(2);
+    // nothing listens on port 1, the post fails without a timeout
+    string host = "http://127.0.0.1:1";
+    std::shared_ptr<const string> body = std::make_shared<const string>("body");
+    std::promise<bool> result;
+    bool accepted = relay.post(host, "/add_transaction", body, [&result](bool delivered, long status, const string& response) {
+        result.set_value(delivered);
+    });
+    ASSERT_TRUE(accepted);
+    ASSERT_FALSE(result.get_future().get());
+    ASSERT_TRUE(relay.isBackingOff(host));
+    ASSERT_FALSE(relay.isBackingOff("http://127.0.0.1:2"));
+
+    // refused while backing off, the callback is never run
+    bool called = false;
+    accepted = relay.post(host, "/add_transaction", body, [&called](bool delivered, long status, const string& response) {
+        called = true;
+    });
+    ASSERT_FALSE(accepted);
+    ASSERT_FALSE(called);
+    ASSERT_EQUAL(relay.queued(), 0);
+}
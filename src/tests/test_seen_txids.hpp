@@ -0,0 +1,48 @@
+#include "../server/seen_txids.hpp"
+using namespace std;
+
+SHA256Hash seenTestTxid(uint8_t n) {
+    SHA256Hash txid = NULL_SHA256_HASH;
+    txid[0] = n;
+    return txid;
+}
+
+TEST(test_seen_txids_bounded) {
+    SeenTxids seen(3);
+    ExecutionStatus status;
+    seen.record(seenTestTxid(1), SUCCESS);
+    seen.record(seenTestTxid(2), INVALID_SIGNATURE);
+    ASSERT_TRUE(seen.lookup(seenTestTxid(2), status));
+    ASSERT_TRUE(status == INVALID_SIGNATURE);
+    ASSERT_FALSE(seen.lookup(seenTestTxid(3), status));
+
+    // 1 is forgotten and seen again, it is newer than 2 now
+    seen.forget(seenTestTxid(1));
+    seen.record(seenTestTxid(1), SUCCESS);
+    // 3 takes the slot 1 first had, that must not push out the newer 1
+    seen.record(seenTestTxid(3), SUCCESS);
+    ASSERT_EQUAL(seen.size(), 3);
+    ASSERT_TRUE(seen.lookup(seenTestTxid(1), status));
+    seen.record(seenTestTxid(4), SUCCESS);
+    ASSERT_FALSE(seen.lookup(seenTestTxid(2), status));
+    ASSERT_TRUE(seen.lookup(seenTestTxid(1), status));
+    seen.record(seenTestTxid(5), SUCCESS);
+    ASSERT_FALSE(seen.lookup(seenTestTxid(1), status));
+    ASSERT_EQUAL(seen.size(), 3);
+
+    // updating a verdict keeps the entry's age
+    seen.record(seenTestTxid(3), EXPIRED_TRANSACTION);
+    ASSERT_TRUE(seen.lookup(seenTestTxid(3), status));
+    ASSERT_TRUE(status == EXPIRED_TRANSACTION);
+    ASSERT_EQUAL(seen.size(), 3);
+}
+
+TEST(test_seen_txids_requests_once) {
+    SeenTxids seen;
+    ASSERT_TRUE(seen.request(seenTestTxid(1), 0));
+    ASSERT_FALSE(seen.request(seenTestTxid(1), 100));
+    // not delivered in time, ask someone else
+    ASSERT_TRUE(seen.request(seenTestTxid(1), SEEN_TXIDS_REQUEST_MS + 1));
+    seen.record(seenTestTxid(1), SUCCESS);
+    ASSERT_FALSE(seen.request(seenTestTxid(1), 3 * SEEN_TXIDS_REQUEST_MS));
+}
@@ -0,0 +1,182 @@
+#include <memory>
+#include "../server/storage_engine.hpp"
+#include "../server/block_store.hpp"
+#include "../server/blockchain.hpp"
+#include "../core/host_manager.hpp"
+#include "../core/user.hpp"
+using namespace std;
+
+void checkStorageEngineBasics(StorageBackend backend) {
+    string path = "./test-data/tmp-engine-" + storageBackendAsString(backend);
+    StorageEngine::destroy(backend, path);
+    StorageEngine* raw = NULL;
+    ASSERT_TRUE(StorageEngine::open(backend, path, &raw).ok());
+    std::unique_ptr<StorageEngine> engine(raw);
+
+    string value;
+    ASSERT_TRUE(engine->get(leveldb::ReadOptions(), "b", &value).IsNotFound());
+    ASSERT_TRUE(engine->put(leveldb::WriteOptions(), "b", "2").ok());
+    ASSERT_TRUE(engine->put(leveldb::WriteOptions(), "a", "1").ok());
+    ASSERT_TRUE(engine->get(leveldb::ReadOptions(), "b", &value).ok());
+    ASSERT_EQUAL(value, "2");
+
+    leveldb::WriteBatch batch;
+    batch.Put("d", "4");
+    batch.Put("c", "3");
+    batch.Delete("a");
+    ASSERT_TRUE(engine->write(leveldb::WriteOptions(), &batch).ok());
+    ASSERT_TRUE(engine->get(leveldb::ReadOptions(), "a", &value).IsNotFound());
+
+    // keys come back in bytewise order in both directions
+    std::unique_ptr<leveldb::Iterator> it(engine->newIterator(leveldb::ReadOptions()));
+    string forward;
+    for (it->SeekToFirst(); it->Valid(); it->Next()) forward += it->key().ToString() + it->value().ToString();
+    ASSERT_EQUAL(forward, "b2c3d4");
+    string backward;
+    for (it->SeekToLast(); it->Valid(); it->Prev()) backward += it->key().ToString();
+    ASSERT_EQUAL(backward, "dcb");
+    it->Seek("bb");
+    ASSERT_TRUE(it->Valid());
+    ASSERT_EQUAL(it->key().ToString(), "c");
+    it.reset();
+
+    ASSERT_TRUE(engine->remove(leveldb::WriteOptions(), "c").ok());
+    ASSERT_TRUE(engine->get(leveldb::ReadOptions(), "c", &value).IsNotFound());
+    engine.reset();
+
+    // reopening by path sees the same data
+    ASSERT_TRUE(StorageEngine::open(backend, path, &raw).ok());
+    engine.reset(raw);
+    ASSERT_TRUE(engine->get(leveldb::ReadOptions(), "d", &value).ok());
+    ASSERT_EQUAL(value, "4");
+    engine.reset();
+    StorageEngine::destroy(backend, path);
+}
+
+void checkStorageEngineSnapshots(StorageBackend backend) {
+    string path = "./test-data/tmp-engine-snapshot-" + storageBackendAsString(backend);
+    StorageEngine::destroy(backend, path);
+    StorageEngine* raw = NULL;
+    ASSERT_TRUE(StorageEngine::open(backend, path, &raw).ok());
+    std::unique_ptr<StorageEngine> engine(raw);
+
+    engine->put(leveldb::WriteOptions(), "a", "1");
+    engine->put(leveldb::WriteOptions(), "b", "1");
+    leveldb::ReadOptions snapshotRead;
+    snapshotRead.snapshot = engine->getSnapshot();
+
+    engine->put(leveldb::WriteOptions(), "a", "2");
+    engine->remove(leveldb::WriteOptions(), "b");
+    engine->put(leveldb::WriteOptions(), "c", "2");
+
+    string value;
+    ASSERT_TRUE(engine->get(snapshotRead, "a", &value).ok());
+    ASSERT_EQUAL(value, "1");
+    ASSERT_TRUE(engine->get(snapshotRead, "b", &value).ok());
+    ASSERT_TRUE(engine->get(snapshotRead, "c", &value).IsNotFound());
+    ASSERT_TRUE(engine->get(leveldb::ReadOptions(), "b", &value).IsNotFound());
+
+    std::unique_ptr<leveldb::Iterator> it(engine->newIterator(snapshotRead));
+    string seen;
+    for (it->SeekToFirst(); it->Valid(); it->Next()) seen += it->key().ToString() + it->value().ToString();
+    ASSERT_EQUAL(seen, "a1b1");
+    it.reset();
+
+    engine->releaseSnapshot(snapshotRead.snapshot);
+    ASSERT_TRUE(engine->get(leveldb::ReadOptions(), "a", &value).ok());
+    ASSERT_EQUAL(value, "2");
+    it.reset(engine->newIterator(leveldb::ReadOptions()));
+    seen = "";
+    for (it->SeekToFirst(); it->Valid(); it->Next()) seen += it->key().ToString() + it->value().ToString();
+    ASSERT_EQUAL(seen, "a2c2");
+    it.reset();
+    engine.reset();
+    StorageEngine::destroy(backend, path);
+}
+
+TEST(test_storage_engine_basics) {
+    checkStorageEngineBasics(STORAGE_LEVELDB);
+    checkStorageEngineBasics(STORAGE_MEMORY);
+}
+
+TEST(test_storage_engine_snapshots) {
+    checkStorageEngineSnapshots(STORAGE_LEVELDB);
+    checkStorageEngineSnapshots(STORAGE_MEMORY);
+}
+
+TEST(test_memory_engine_iterator_survives_writes) {
+    StorageEngine* raw = NULL;
+    StorageEngine::destroy(STORAGE_MEMORY, "iterator-writes");
+    ASSERT_TRUE(StorageEngine::open(STORAGE_MEMORY, "iterator-writes", &raw).ok());
+    std::unique_ptr<StorageEngine> engine(raw);
+    for (int i = 0; i < 10; i++) engine->put(leveldb::WriteOptions(), "key" + to_string(i), to_string(i));
+
+    // clearing while iterating must neither skip keys nor expose the deletes
+    std::unique_ptr<leveldb::Iterator> it(engine->newIterator(leveldb::ReadOptions()));
+    int count = 0;
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        engine->remove(leveldb::WriteOptions(), it->key());
+        engine->put(leveldb::WriteOptions(), "zz" + it->key().ToString(), "new");
+        count++;
+    }
+    ASSERT_EQUAL(count, 10);
+    it.reset();
+
+    it.reset(engine->newIterator(leveldb::ReadOptions()));
+    count = 0;
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        ASSERT_TRUE(it->key().starts_with("zz"));
+        count++;
+    }
+    ASSERT_EQUAL(count, 10);
+    it.reset();
+    engine.reset();
+    StorageEngine::destroy(STORAGE_MEMORY, "iterator-writes");
+}
+
+TEST(test_blockstore_on_memory_engine) {
+    BlockStore blocks;
+    blocks.init("memory-blocks", STORAGE_MEMORY);
+    ASSERT_FALSE(blocks.hasBlockCount());
+    blocks.setBlockCount(7);
+    blocks.closeDB();
+    blocks.init("memory-blocks", STORAGE_MEMORY);
+    ASSERT_EQUAL(blocks.getBlockCount(), 7);
+    blocks.deleteDB();
+    blocks.closeDB();
+    blocks.init("memory-blocks", STORAGE_MEMORY);
+    ASSERT_FALSE(blocks.hasBlockCount());
+    blocks.deleteDB();
+    blocks.closeDB();
+}
+
+TEST(test_memory_ledger_rebuilt_from_block_store) {
+    string blockPath = "./test-data/tmp-memory-ledger-blocks";
+    User miner;
+    User receiver;
+    Block first;
+    first.setId(1);
+    first.addTransaction(miner.mine());
+    Transaction paid = miner.send(receiver, PDN(5));
+    first.addTransaction(paid);
+    BlockStore blocks;
+    blocks.init(blockPath);
+    blocks.clear();
+    blocks.setBlock(first);
+    blocks.setBlockCount(1);
+    blocks.setTotalWork(1);
+    blocks.closeDB();
+
+    // a restart hands the chain fresh in memory stores next to the saved blocks
+    StorageEngine::destroy(STORAGE_MEMORY, "memory-ledger");
+    StorageEngine::destroy(STORAGE_MEMORY, "memory-txdb");
+    StorageBackends backends;
+    backends.ledger = STORAGE_MEMORY;
+    backends.txdb = STORAGE_MEMORY;
+    HostManager hosts;
+    BlockChain chain(hosts, "memory-ledger", blockPath, "memory-txdb", backends);
+    ASSERT_EQUAL(chain.getBlockCount(), 1);
+    ASSERT_EQUAL(chain.getWalletValue(receiver.getAddress()), PDN(5));
+    ASSERT_EQUAL(chain.findBlockForTransaction(paid), 1);
+    chain.deleteDB();
+}
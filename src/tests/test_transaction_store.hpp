@@ -1,4 +1,5 @@
 #include "../core/transaction.hpp"
+#include "../core/user.hpp"
 #include "../server/tx_store.hpp"
 using namespace std;
 
@@ -9,7 +10,7 @@ TEST(test_txdb_stores_transaction) {
     txdb.init("./test-data/tmpdb");
     Transaction t = miner.mine();
     ASSERT_EQUAL(txdb.hasTransaction(t), false);
-    txdb.insertTransaction(t, 1);
+    txdb.insertTransaction(t, 1, 0);
     ASSERT_EQUAL(txdb.hasTransaction(t), true);
     ASSERT_EQUAL(txdb.blockForTransaction(t), 1);
     txdb.removeTransaction(t);
@@ -18,9 +19,40 @@ TEST(test_txdb_stores_transaction) {
 
     Transaction t2 = miner.send(other, 333);
     ASSERT_EQUAL(txdb.hasTransaction(t2), false);
-    txdb.insertTransaction(t2, 3);
+    txdb.insertTransaction(t2, 3, 7);
     ASSERT_EQUAL(txdb.hasTransaction(t2), true);
     ASSERT_EQUAL(txdb.blockForTransaction(t2), 3);
+    TransactionLocation loc = txdb.locateTransaction(t2.hashContents());
+    ASSERT_EQUAL(loc.blockId, 3);
+    ASSERT_EQUAL(loc.index, 7);
     txdb.removeTransaction(t2);
     ASSERT_EQUAL(txdb.hasTransaction(t2), false);
-}
\ No newline at end of file
+    txdb.closeDB();
+    txdb.deleteDB();
+}
+TEST(test_txdb_filter_survives_reopen) {
+    TransactionStore txdb;
+    User miner;
+    User other;
+    txdb.init("./test-data/tmpdb");
+    vector<Transaction> sent;
+    for (int i = 0; i < 20; i++) {
+        Transaction t = miner.send(other, i + 1);
+        t.setTimestamp(i);
+        txdb.insertTransaction(t, i + 1, i);
+        sent.push_back(t);
+    }
+    txdb.closeDB();
+
+    // clean close persists the filter
+    txdb.init("./test-data/tmpdb");
+    for (int i = 0; i < 20; i++) {
+        ASSERT_EQUAL(txdb.hasTransaction(sent[i]), true);
+        ASSERT_EQUAL(txdb.blockForTransaction(sent[i]), i + 1);
+        ASSERT_EQUAL(txdb.locateTransaction(sent[i].hashContents()).index, i);
+    }
+    Transaction missing = miner.send(other, 999);
+    ASSERT_EQUAL(txdb.hasTransaction(missing), false);
+    txdb.closeDB();
+    txdb.deleteDB();
+}
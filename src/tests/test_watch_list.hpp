@@ -0,0 +1,167 @@
+#include "../core/crypto.hpp"
+#include "../core/user.hpp"
+#include "../core/host_manager.hpp"
+#include "../server/watch_list.hpp"
+#include "../server/blockchain.hpp"
+using namespace std;
+
+TEST(test_watch_list_records_and_reverts_events) {
+    WatchList watch;
+    watch.init("./test-data/tmpwatch");
+    User miner;
+    User receiver;
+    User other;
+    int notified = 0;
+    watch.setListener([&notified]() {
+        notified++;
+    });
+
+    Block block;
+    block.setId(2);
+    block.addTransaction(miner.mine());
+    Transaction paid = miner.send(receiver, 5);
+    block.addTransaction(paid);
+    Transaction unwatched = miner.send(other, 7);
+    block.addTransaction(unwatched);
+
+    // nothing is watched yet, so the block leaves no trace, nor does popping it
+    watch.blockAdded(block);
+    ASSERT_EQUAL(watch.getCursor(), 0);
+    ASSERT_EQUAL(notified, 0);
+    watch.blockRemoved(block);
+    ASSERT_EQUAL(watch.getCursor(), 0);
+
+    vector<PublicWalletAddress> addresses = { receiver.getAddress(), receiver.getAddress() };
+    ASSERT_EQUAL(watch.addAddresses(addresses), 1);
+    ASSERT_TRUE(watch.isWatched(receiver.getAddress()));
+    ASSERT_FALSE(watch.isWatched(other.getAddress()));
+    watch.blockAdded(block);
+    ASSERT_EQUAL(watch.getCursor(), 1);
+    ASSERT_EQUAL(notified, 1);
+
+    // the miner is added after the block was applied, so only the receiver sees it reverted
+    addresses = { miner.getAddress() };
+    watch.addAddresses(addresses);
+    watch.blockRemoved(block);
+    vector<WatchEvent> events = watch.getEvents(0, 100);
+    ASSERT_EQUAL(events.size(), 2);
+    ASSERT_TRUE(events[0].txid == paid.hashContents());
+    ASSERT_FALSE(events[0].sent);
+    ASSERT_FALSE(events[0].reverted);
+    ASSERT_EQUAL(events[0].amount, 5);
+    ASSERT_TRUE(events[1].txid == paid.hashContents());
+    ASSERT_TRUE(events[1].address == receiver.getAddress());
+    ASSERT_TRUE(events[1].reverted);
+
+    // below where it was added, the miner sees the next block both ways
+    watch.blockAdded(block);
+    watch.blockRemoved(block);
+    events = watch.getEvents(0, 100);
+    ASSERT_EQUAL(events.size(), 10);
+    ASSERT_TRUE(events[2].address == miner.getAddress());
+    ASSERT_FALSE(events[2].reverted);
+    // the revert walks the block backwards: unwatched, paid, then the mining fee
+    ASSERT_TRUE(events[6].txid == unwatched.hashContents());
+    ASSERT_TRUE(events[6].sent);
+    ASSERT_TRUE(events[6].reverted);
+    ASSERT_TRUE(events[7].txid == paid.hashContents());
+    ASSERT_FALSE(events[7].sent);
+    ASSERT_TRUE(events[8].txid == paid.hashContents());
+    ASSERT_TRUE(events[8].sent);
+    ASSERT_TRUE(events[9].address == miner.getAddress());
+    ASSERT_FALSE(events[9].sent);
+    ASSERT_TRUE(events[9].reverted);
+    for (size_t i = 0; i < events.size(); i++) ASSERT_EQUAL(events[i].cursor, i);
+
+    // reading from a cursor only touches what came after it
+    events = watch.getEvents(3, 1);
+    ASSERT_EQUAL(events.size(), 1);
+    ASSERT_EQUAL(events[0].cursor, 3);
+    ASSERT_EQUAL(watch.getEvents(10, 100).size(), 0);
+
+    // the registry and the log survive a reopen
+    watch.closeDB();
+    WatchList reopened;
+    reopened.init("./test-data/tmpwatch");
+    reopened.load();
+    ASSERT_EQUAL(reopened.size(), 2);
+    ASSERT_EQUAL(reopened.getCursor(), 10);
+    addresses = { receiver.getAddress() };
+    ASSERT_EQUAL(reopened.removeAddresses(addresses), 1);
+    ASSERT_FALSE(reopened.isWatched(receiver.getAddress()));
+
+    reopened.closeDB();
+    reopened.deleteDB();
+}
+
+TEST(test_watch_list_reverts_blocks_lost_in_unclean_shutdown) {
+    string blockPath = "./test-data/tmpdirty-blocks";
+    string watchPath = "./test-data/tmpdirty-watch";
+    User miner;
+    User receiver;
+    Block first;
+    first.setId(1);
+    first.setTimestamp(1000);
+    first.addTransaction(miner.mine());
+    Block second;
+    second.setId(2);
+    second.setTimestamp(2000);
+    second.addTransaction(miner.mine());
+    second.addTransaction(miner.send(receiver, 5));
+
+    // block 2 was written and logged but the node died before counting it
+    BlockStore blocks;
+    blocks.init(blockPath);
+    blocks.clear();
+    blocks.setBlock(first);
+    blocks.setBlock(second);
+    blocks.setBlockCount(1);
+    blocks.setTotalWork(1);
+    blocks.setDirty(true);
+    blocks.closeDB();
+    WatchList watch;
+    watch.init(watchPath);
+    watch.load();
+    watch.setHeight(1);
+    vector<PublicWalletAddress> addresses = { receiver.getAddress() };
+    watch.addAddresses(addresses);
+    watch.blockAdded(second);
+    ASSERT_EQUAL(watch.getCursor(), 1);
+    watch.closeDB();
+
+    HostManager hosts;
+    BlockChain chain(hosts, "./test-data/tmpdirty-ledger", blockPath, "./test-data/tmpdirty-txdb");
+    ASSERT_EQUAL(chain.getBlockCount(), 1);
+    PublicWalletAddress receiverAddress = receiver.getAddress();
+    ASSERT_EQUAL(chain.getTransactionsForWallet(receiverAddress).size(), 0);
+
+    std::shared_ptr<WatchList> reopened = std::make_shared<WatchList>();
+    reopened->init(watchPath);
+    reopened->load();
+    ASSERT_EQUAL(reopened->getHeight(), 2);
+    chain.setWatchList(reopened);
+    ASSERT_EQUAL(reopened->getHeight(), 1);
+    vector<WatchEvent> events = reopened->getEvents(0, 100);
+    ASSERT_EQUAL(events.size(), 2);
+    ASSERT_TRUE(events[1].address == receiverAddress);
+    ASSERT_EQUAL(events[1].blockId, 2);
+    ASSERT_TRUE(events[1].reverted);
+
+    chain.closeDB();
+    reopened->closeDB();
+    reopened->deleteDB();
+    BlockStore reloaded;
+    reloaded.init(blockPath);
+    PublicWalletAddress minerAddress = miner.getAddress();
+    ASSERT_EQUAL(reloaded.getTransactionsForWallet(minerAddress).size(), 1);
+    ASSERT_EQUAL(reloaded.getBlockAtTime(1500, 2), 0);
+    bool statsLeft = true;
+    try {
+        reloaded.getBlockStats(2);
+    } catch (const std::exception& e) {
+        statsLeft = false;
+    }
+    ASSERT_FALSE(statsLeft);
+    reloaded.closeDB();
+    reloaded.deleteDB();
+}
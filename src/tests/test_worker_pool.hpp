@@ -0,0 +1,33 @@
+#include <atomic>
+#include <future>
+#include "../server/worker_pool.hpp"
+using namespace std;
+
+TEST(test_worker_pool_runs_and_refuses_jobs) {
+    WorkerPool pool(2, 1);
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    std::atomic<int> ran(0);
+    std::promise<void> started[2];
+    // both threads busy, the queue takes one more job
+    for (int i = 0; i < 2; i++) {
+        std::promise<void>* s = &started[i];
+        ASSERT_TRUE(pool.submit([s, released, &ran]() {
+            s->set_value();
+            released.wait();
+            ran++;
+        }));
+        started[i].get_future().wait();
+    }
+    ASSERT_TRUE(pool.submit([&ran]() { ran++; }));
+    ASSERT_FALSE(pool.submit([&ran]() { ran++; }));
+    ASSERT_EQUAL(pool.queued(), 1);
+
+    // stopping drops the queued job and waits for the running ones
+    std::thread stopper([&pool]() { pool.stop(); });
+    while (pool.queued() > 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    release.set_value();
+    stopper.join();
+    ASSERT_EQUAL(ran.load(), 2);
+    ASSERT_FALSE(pool.submit([&ran]() { ran++; }));
+}
@@ -3,7 +3,7 @@
 #include "../core/helpers.hpp"
 // #include "test_block.hpp"
 // #include "test_user.hpp"
-// #include "test_transaction_store.hpp"
+#include "test_transaction_store.hpp"
 // #include "test_executor.hpp"
 // #include "test_crypto.hpp"
 // #include "test_transaction.hpp"
@@ -11,8 +11,19 @@
 // #include "test_helpers.hpp"
 // #include "test_blockchain.hpp"
 // #include "test_merkle_tree.hpp"
-// #include "test_ledger.hpp"
+#include "test_ledger.hpp"
 #include "test_block_store.hpp"
+#include "test_cuckoo_filter.hpp"
+#include "test_block_archive.hpp"
+#include "test_storage_engine.hpp"
+#include "test_chain_view.hpp"
+#include "test_watch_list.hpp"
+#include "test_peer_relay.hpp"
+#include "test_seen_txids.hpp"
+#include "test_iblt.hpp"
+#include "test_worker_pool.hpp"
+#include "test_mempool.hpp"
+#include "test_long_poll.hpp"
 // #include "test_integration.hpp"
 
 using namespace std;
@@ -0,0 +1,95 @@
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include "../core/common.hpp"
+#include "../core/constants.hpp"
+#include "../server/block_store.hpp"
+#include "../server/block_archive.hpp"
+using namespace std;
+
+static bool sameTransactionInfo(TransactionInfo& a, TransactionInfo& b) {
+    char bufferA[TRANSACTIONINFO_BUFFER_SIZE];
+    char bufferB[TRANSACTIONINFO_BUFFER_SIZE];
+    transactionInfoToBuffer(a, bufferA);
+    transactionInfoToBuffer(b, bufferB);
+    return memcmp(bufferA, bufferB, TRANSACTIONINFO_BUFFER_SIZE) == 0 && a.from == b.from;
+}
+
+int main(int argc, char** argv) {
+    cout<<"=====ARCHIVE BENCHMARK===="<<endl;
+    string path = BLOCK_STORE_FILE_PATH;
+    uint32_t maxBlocks = UINT32_MAX;
+    if (argc > 1) path = string(argv[1]);
+    if (argc > 2) maxBlocks = std::stoul(argv[2]);
+    cout<<"Reading blocks from ["<<path<<"] (stop the node or use a copy of its data dir)"<<endl;
+
+    BlockStore blocks;
+    blocks.init(path);
+    if (!blocks.hasBlockCount()) {
+        cout<<"No blocks found"<<endl;
+        return 1;
+    }
+    uint32_t count = std::min<uint32_t>(blocks.getBlockCount(), maxBlocks);
+    uint32_t first = blocks.getPrunedHeight() + 1;
+
+    MemoryArchiveDictionary dictionary;
+    vector<vector<TransactionInfo>> originals;
+    vector<string> encoded;
+    size_t numTransactions = 0;
+    size_t rawBytes = 0;
+    size_t encodedBytes = 0;
+
+    for (uint32_t i = first; i <= count; i++) {
+        vector<TransactionInfo> transactions;
+        for (auto t : blocks.getBlock(i).getTransactions()) transactions.push_back(t.serialize());
+        numTransactions += transactions.size();
+        rawBytes += transactions.size() * sizeof(TransactionInfo);
+        originals.push_back(transactions);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (auto& transactions : originals) {
+        encoded.push_back(encodeArchivedTransactions(transactions, dictionary));
+        encodedBytes += encoded.back().size();
+    }
+    auto encodeTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    vector<vector<TransactionInfo>> decoded;
+    for (auto& data : encoded) decoded.push_back(decodeArchivedTransactions(data, dictionary));
+    auto decodeTime = std::chrono::steady_clock::now() - start;
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < originals.size(); i++) {
+        if (originals[i].size() != decoded[i].size()) {
+            mismatches++;
+            continue;
+        }
+        for (size_t j = 0; j < originals[i].size(); j++) {
+            if (!sameTransactionInfo(originals[i][j], decoded[i][j])) mismatches++;
+        }
+    }
+
+    // dictionary entries are stored once: the value plus its id in both directions
+    size_t dictionaryBytes = 0;
+    for (uint32_t id = 0; id < dictionary.size(); id++) dictionaryBytes += 2 * dictionary.valueFor(id).size() + 2 * sizeof(uint32_t);
+
+    double encodeSec = std::chrono::duration<double>(encodeTime).count();
+    double decodeSec = std::chrono::duration<double>(decodeTime).count();
+    double mb = rawBytes / (1024.0 * 1024.0);
+    cout<<"Blocks              : "<<originals.size()<<" ("<<first<<" - "<<count<<")"<<endl;
+    cout<<"Transactions        : "<<numTransactions<<endl;
+    cout<<"Raw bytes           : "<<rawBytes<<endl;
+    cout<<"Archived bytes      : "<<encodedBytes<<endl;
+    cout<<"Dictionary entries  : "<<dictionary.size()<<" ("<<dictionaryBytes<<" bytes)"<<endl;
+    if (encodedBytes + dictionaryBytes > 0) {
+        cout<<"Compression ratio   : "<<(double)rawBytes / (encodedBytes + dictionaryBytes)<<"x"<<endl;
+    }
+    if (encodeSec > 0) cout<<"Encode throughput   : "<<mb / encodeSec<<" MB/s"<<endl;
+    if (decodeSec > 0) {
+        cout<<"Decode throughput   : "<<mb / decodeSec<<" MB/s, "<<numTransactions / decodeSec<<" tx/s"<<endl;
+    }
+    cout<<"Mismatched records  : "<<mismatches<<endl;
+    blocks.closeDB();
+    return mismatches == 0 ? 0 : 1;
+}